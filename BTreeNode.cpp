@@ -1,4 +1,5 @@
 
+#include <algorithm>
 #include <cstring>
 #include "BTreeNode.h"
 using namespace std;
@@ -9,7 +10,10 @@ using namespace std;
 
 BTreeNode::BTreeNode(HeapFile &file, BlockID block_id, const KeyProfile& key_profile, bool create)
         : block(nullptr), file(file), id(block_id), key_profile(key_profile) {
-    if (create) {
+    if (create && block_id != 0) {
+        this->block = file.get(block_id);
+        this->block->clear();
+    } else if (create) {
         this->block = file.get_new();
         this->id = this->block->get_block_id();
     } else {
@@ -34,15 +38,6 @@ BlockID BTreeNode::get_block_id(RecordID record_id) const {
     return block_id;
 }
 
-// Get the record and turn it into a Handle.
-Handle BTreeNode::get_handle(RecordID record_id) const {
-    Dbt *dbt = this->block->get(record_id);
-    BlockID handle_block_id = *(BlockID *)dbt->get_data();
-    RecordID handle_record_id = *(RecordID *)((char*)dbt->get_data() + sizeof(BlockID));
-    delete dbt;
-    return Handle(handle_block_id, handle_record_id);
-}
-
 // Get the record and turn it into a KeyValue.
 KeyValue *BTreeNode::get_key(RecordID record_id) const {
     Dbt *dbt = this->block->get(record_id);
@@ -58,10 +53,7 @@ KeyValue *BTreeNode::get_key(RecordID record_id) const {
         } else if (data_type == ColumnAttribute::DataType::TEXT) {
             uint16_t size = *(uint16_t *)(bytes + offset);
             offset += sizeof(uint16_t);
-            char buffer[DbBlock::BLOCK_SZ];
-            memcpy(buffer, bytes+offset, size);
-            buffer[size] = '\0';
-            value.s = std::string(buffer);  // assume ascii for now
+            value.s.assign(bytes + offset, size);  // assume ascii for now
             offset += size;
         } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
             value.n = *(uint8_t*)(bytes + offset);
@@ -83,35 +75,96 @@ Dbt *BTreeNode::marshal_block_id(BlockID block_id) {
     return dbt;
 }
 
-// Convert handle into bytes.
-Dbt *BTreeNode::marshal_handle(Handle handle) {
-    char *bytes = new char[sizeof(BlockID) + sizeof(RecordID)];
-    Dbt *dbt = new Dbt(bytes, sizeof(BlockID) + sizeof(RecordID));
-    *(BlockID *)bytes = handle.first;
-    *(RecordID *)(bytes + sizeof(BlockID)) = handle.second;
-    return dbt;
+// Handles are marshaled in handle order as their count and then each one's distance from
+// the one before it (from zero, for the first), all as varints: rows next to each other in
+// the table take a byte apiece.
+static uint64_t handle_value(Handle handle) {
+    return ((uint64_t) handle.first << 16) | handle.second;
+}
+
+static uint varint_size(uint64_t n) {
+    uint size = 1;
+    for (; n >= 0x80; n >>= 7)
+        size++;
+    return size;
+}
+
+static char *put_varint(uint64_t n, char *bytes) {
+    for (; n >= 0x80; n >>= 7)
+        *bytes++ = (char) (n | 0x80);
+    *bytes++ = (char) n;
+    return bytes;
+}
+
+static uint64_t get_varint(const char *&bytes, const char *end) {
+    uint64_t n = 0;
+    for (uint shift = 0; bytes < end; shift += 7) {
+        uint8_t byte = (uint8_t) *bytes++;
+        n |= (uint64_t) (byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+            return n;
+    }
+    throw DbRelationError("posting list is cut short");
+}
+
+// Bytes marshal_handles() writes for handles.
+uint BTreeNode::handles_size(const Handles& handles) {
+    uint size = varint_size(handles.size());
+    uint64_t previous = 0;
+    for (auto const& handle: handles) {
+        uint64_t value = handle_value(handle);
+        size += varint_size(value - previous);
+        previous = value;
+    }
+    return size;
+}
+
+// Convert handles (in handle order) into bytes, returning where they end.
+char *BTreeNode::marshal_handles(const Handles& handles, char *bytes) {
+    bytes = put_varint(handles.size(), bytes);
+    uint64_t previous = 0;
+    for (auto const& handle: handles) {
+        uint64_t value = handle_value(handle);
+        bytes = put_varint(value - previous, bytes);
+        previous = value;
+    }
+    return bytes;
+}
+
+// Append the handles marshal_handles() put in bytes.
+void BTreeNode::unmarshal_handles(const char *bytes, uint size, Handles& handles) {
+    const char *end = bytes + size;
+    uint64_t count = get_varint(bytes, end);
+    handles.reserve(handles.size() + count);
+    uint64_t value = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        value += get_varint(bytes, end);
+        handles.push_back(Handle((BlockID) (value >> 16), (RecordID) (value & 0xffff)));
+    }
 }
 
 // Convert KeyValue into bytes.
 Dbt *BTreeNode::marshal_key(const KeyValue *key) {
-    char *bytes = new char[DbBlock::BLOCK_SZ]; // more than we need
+    uint block_size = this->file.get_block_size();
+    uint max_size = SlottedPage::max_record_size(block_size);
+    char *bytes = new char[block_size]; // more than we need
     uint offset = 0;
     uint col_num = 0;
     for (auto const& data_type: this->key_profile) {
-        Value value = (*key)[col_num];
+        Value value = (*key)[col_num++];
 
         if (data_type == ColumnAttribute::DataType::INT) {
-            if (offset + 4 > DbBlock::BLOCK_SZ - 4)
+            if (offset + 4 > max_size)
                 throw DbRelationError("index key too big to marshal");
 
             *(int32_t*) (bytes + offset) = value.n;
             offset += sizeof(int32_t);
 
         } else if (data_type == ColumnAttribute::DataType::TEXT) {
-            u_long size = (uint16_t) value.s.length();
+            u_long size = value.s.length();
             if (size > UINT16_MAX)
                 throw DbRelationError("text field too long to marshal");
-            if (offset + 2 + size > DbBlock::BLOCK_SZ)
+            if (offset + 2 + size > max_size)
                 throw DbRelationError("index key too big to marshal");
 
             *(uint16_t*) (bytes + offset) = (uint16_t) size;
@@ -120,7 +173,7 @@ Dbt *BTreeNode::marshal_key(const KeyValue *key) {
             offset += size;
 
         } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
-            if (offset + 1 > DbBlock::BLOCK_SZ - 1)
+            if (offset + 1 > max_size)
                 throw DbRelationError("index key too big to marshal");
 
             *(uint8_t*) (bytes + offset) = (uint8_t)value.n;
@@ -137,39 +190,84 @@ Dbt *BTreeNode::marshal_key(const KeyValue *key) {
     return data;
 }
 
+// Size of the record marshal_key() makes for key, without making it.
+uint BTreeNode::key_size(const KeyValue *key) const {
+    uint size = 0;
+    uint col_num = 0;
+    for (auto const& data_type: this->key_profile) {
+        if (data_type == ColumnAttribute::DataType::INT)
+            size += sizeof(int32_t);
+        else if (data_type == ColumnAttribute::DataType::TEXT)
+            size += sizeof(uint16_t) + (uint) (*key)[col_num].s.length();
+        else
+            size += sizeof(uint8_t);
+        col_num++;
+    }
+    return size;
+}
+
+// Bytes a slotted page needs for the given records: a 4-byte header for the page
+// and another for each record.
+static uint page_size(uint records, uint record_bytes) {
+    return 4 + 4 * records + record_bytes;
+}
+
 
 /******************************
  * BTreeStat statistics block *
  ******************************/
 
 BTreeStat::BTreeStat(HeapFile &file, BlockID stat_id, BlockID new_root, const KeyProfile& key_profile)
-        : BTreeNode(file, stat_id, key_profile, false), root_id(new_root), height(1) {
+        : BTreeNode(file, stat_id, key_profile, false), root_id(new_root), height(1), free(0) {
     save();
 }
 
 BTreeStat::BTreeStat(HeapFile &file, BlockID stat_id, const KeyProfile& key_profile)
-        : BTreeNode(file, stat_id, key_profile, false), root_id(get_block_id(ROOT)), height(get_block_id(HEIGHT)) {
+        : BTreeNode(file, stat_id, key_profile, false), root_id(get_block_id(ROOT)), height(get_block_id(HEIGHT)),
+          free(this->block->size() >= FREE ? get_block_id(FREE) : 0) {
 }
 
 void BTreeStat::save() {
-    Dbt *dbt = marshal_block_id(this->root_id);
-    bool is_new = (this->block->size() == 0);
-    if (is_new)
-        this->block->add(dbt);
-    else
-        this->block->put(ROOT, *dbt);
-    delete[] (char*)dbt->get_data();
-    delete dbt;
+    BlockID values[] = {this->root_id, this->height, this->free};  // height is not really a block ID but it fits
+    for (RecordID record_id = ROOT; record_id <= FREE; record_id++) {
+        Dbt *dbt = marshal_block_id(values[record_id - ROOT]);
+        if (this->block->size() < record_id)
+            this->block->add(dbt);  // new, or made before there was a free list
+        else
+            this->block->put(record_id, *dbt);
+        delete[] (char*)dbt->get_data();
+        delete dbt;
+    }
 
-    dbt = marshal_block_id(this->height);  // not really a block ID but it fits
-    if (is_new)
-        this->block->add(dbt);
-    else
-        this->block->put(HEIGHT, *dbt);
+    BTreeNode::save();
+}
+
+// Take the first block off the free list. Returns 0 if there isn't one.
+BlockID BTreeStat::allocate() {
+    BlockID block_id = this->free;
+    if (block_id != 0) {
+        SlottedPage *block = this->file.get(block_id);
+        Dbt *dbt = block->get(1);
+        this->free = *(BlockID *)dbt->get_data();
+        delete dbt;
+        delete block;
+        save();
+    }
+    return block_id;
+}
+
+// Put block_id at the front of the free list. Whatever was in it is gone.
+void BTreeStat::release(BlockID block_id) {
+    SlottedPage *block = this->file.get(block_id);
+    block->clear();
+    Dbt *dbt = marshal_block_id(this->free);
+    block->add(dbt);
     delete[] (char*)dbt->get_data();
     delete dbt;
-
-    BTreeNode::save();
+    this->file.put(block);
+    delete block;
+    this->free = block_id;
+    save();
 }
 
 
@@ -178,25 +276,25 @@ void BTreeStat::save() {
  *****************/
 
 BTreeInterior::BTreeInterior(HeapFile &file, BlockID block_id, const KeyProfile& key_profile, bool create)
-        : BTreeNode(file, block_id, key_profile, create), first(0), pointers(), boundaries() {
+        : BTreeNode(file, block_id, key_profile, create), bulk_size(page_size(1, sizeof(BlockID))),
+          first(0), pointers(), prefixes(), boundaries() {
     if (!create) {
-        RecordIDs *record_id_list = this->block->ids();
-        RecordID i = 1;
-        for (auto j = record_id_list->size(); j > 0; j--) {
+        RecordID n = this->block->size();
+        this->pointers.reserve(n / 2);
+        this->prefixes.reserve(n / 2);
+        for (RecordID i = 1; i <= n; i++) {
             if (i == 1) {
                 // first pointer
-                this->first = get_block_id(i);
+                this->first = *(BlockID *) this->block->get_record(i);
             } else if (i%2 != 0) {
                 // pointer
-                this->pointers.push_back(get_block_id(i));
+                this->pointers.push_back(*(BlockID *) this->block->get_record(i));
             } else {
-                // key
-                KeyValue *key_value = get_key(i);
-                this->boundaries.push_back(key_value);
+                // key, left packed until it's needed
+                this->prefixes.push_back(record_prefix(i));
             }
-            i++;
         }
-        delete record_id_list;
+        this->boundaries.resize(this->prefixes.size(), nullptr);
     }
 }
 
@@ -206,19 +304,94 @@ BTreeInterior::~BTreeInterior() {
     this->boundaries.clear();
 }
 
+// A key's first column packed into 64 bits so that two keys whose prefixes differ compare
+// the way the prefixes do: ints with the sign bit flipped, text as its first 8 bytes
+// (padded with zeros), booleans as their byte, each at the top of the word. Keys with the
+// same prefix have to be compared in full.
+static uint64_t int_prefix(int32_t n) {
+    return (uint64_t) ((uint32_t) n ^ 0x80000000u) << 32;
+}
+
+static uint64_t text_prefix(const char *text, uint length) {
+    uint64_t prefix = 0;
+    for (uint i = 0; i < 8; i++)
+        prefix = (prefix << 8) | (i < length ? (uint8_t) text[i] : 0);
+    return prefix;
+}
+
+static uint64_t boolean_prefix(uint8_t b) {
+    return (uint64_t) b << 56;
+}
+
+uint64_t BTreeInterior::key_prefix(const KeyValue* key) const {
+    const Value& value = (*key)[0];
+    if (this->key_profile[0] == ColumnAttribute::DataType::INT)
+        return int_prefix(value.n);
+    if (this->key_profile[0] == ColumnAttribute::DataType::TEXT)
+        return text_prefix(value.s.data(), (uint) value.s.length());
+    return boolean_prefix((uint8_t) value.n);
+}
+
+uint64_t BTreeInterior::record_prefix(RecordID record_id) const {
+    const char *bytes = this->block->get_record(record_id);
+    if (this->key_profile[0] == ColumnAttribute::DataType::INT)
+        return int_prefix(*(int32_t *) bytes);
+    if (this->key_profile[0] == ColumnAttribute::DataType::TEXT)
+        return text_prefix(bytes + sizeof(uint16_t), *(uint16_t *) bytes);
+    return boolean_prefix(*(uint8_t *) bytes);
+}
+
+// Boundary i, unpacked from the block if it hasn't been yet.
+const KeyValue* BTreeInterior::get_boundary(uint i) const {
+    if (this->boundaries[i] == nullptr)
+        this->boundaries[i] = get_key(2 + 2 * i);
+    return this->boundaries[i];
+}
+
+void BTreeInterior::set_boundary(uint i, const KeyValue& boundary) {
+    unpack_boundaries();
+    *this->boundaries[i] = boundary;
+    this->prefixes[i] = key_prefix(&boundary);
+}
+
+// Unpack every boundary still packed in the block, before the node changes.
+void BTreeInterior::unpack_boundaries() const {
+    for (uint i = 0; i < this->boundaries.size(); i++)
+        get_boundary(i);
+}
+
+// Redo the prefixes after the boundaries change.
+void BTreeInterior::repack() {
+    this->prefixes.clear();
+    for (auto const& boundary: this->boundaries)
+        this->prefixes.push_back(key_prefix(boundary));
+}
+
+// Which child key must be under: the one before the first boundary past key (the last if
+// there is none). Binary search, comparing prefixes and only falling back on the whole
+// keys when they tie (or key's first column isn't the type the index's is).
+uint BTreeInterior::find_child(const KeyValue* key) const {
+    bool packed = !key->empty() && (*key)[0].data_type == this->key_profile[0];
+    uint64_t prefix = packed ? key_prefix(key) : 0;
+    uint low = 0, high = (uint) this->prefixes.size();
+    while (low < high) {
+        uint middle = (low + high) / 2;
+        bool past;
+        if (packed && this->prefixes[middle] != prefix)
+            past = this->prefixes[middle] > prefix;
+        else
+            past = *key < *get_boundary(middle);
+        if (past)
+            high = middle;
+        else
+            low = middle + 1;
+    }
+    return low;
+}
+
 // Get next block down in tree where key must be.
 BTreeNode *BTreeInterior::find(const KeyValue* key, uint depth) const {
-    BlockID down = this->pointers.back();  // last pointer is correct if we don't find an earlier boundary
-    for (uint i = 0; i < this->boundaries.size(); i++) {
-        KeyValue *boundary = this->boundaries[i];
-        if (*boundary > *key) {
-            if (i > 0)
-                down = this->pointers[i - 1];
-            else
-                down = this->first;
-            break;
-        }
-    }
+    BlockID down = get_child(find_child(key));
     if (depth == 2)
         return new BTreeLeaf(this->file, down, this->key_profile, false);
     else
@@ -228,8 +401,10 @@ BTreeNode *BTreeInterior::find(const KeyValue* key, uint depth) const {
 // Save the pointers and boundaries in the correct order
 void BTreeInterior::save() {
     Dbt *dbt;
+    unpack_boundaries();
     this->block->clear();
     dbt = marshal_block_id(this->first);
+    this->block->add(dbt);
     delete[] (char *) dbt->get_data();
     delete dbt;
     for (uint i = 0; i < this->boundaries.size(); i++) {
@@ -249,13 +424,14 @@ void BTreeInterior::save() {
 }
 
 // Insert boundary, block_id pair into block.
-Insertion BTreeInterior::insert(const KeyValue* boundary, BlockID block_id) {
+Insertion BTreeInterior::insert(const KeyValue* boundary, BlockID block_id, BTreeStat& stat) {
     Dbt *dbt;
+    unpack_boundaries();
 
     bool inserted = false;
     for (uint i = 0; i < this->boundaries.size(); i++) {
         KeyValue *check = this->boundaries[i];
-        if (*boundary == *check) {
+        if (*boundary < *check) {
             this->boundaries.insert(this->boundaries.begin() + i, new KeyValue(*boundary));
             this->pointers.insert(this->pointers.begin() + i, block_id);
             inserted = true;
@@ -279,6 +455,7 @@ Insertion BTreeInterior::insert(const KeyValue* boundary, BlockID block_id) {
         delete dbt;
 
         // that worked, so no need to split
+        repack();
         save();
         return BTreeNode::insertion_none();
 
@@ -289,7 +466,7 @@ Insertion BTreeInterior::insert(const KeyValue* boundary, BlockID block_id) {
         // too big, so split
 
         // create the sister
-        BTreeInterior *nnode = new BTreeInterior(this->file, 0, this->key_profile, true);
+        BTreeInterior *nnode = new BTreeInterior(this->file, stat.allocate(), this->key_profile, true);
 
         // only the pointer of the middle entry goes into the sister (as it's first pointer)
         // the corresponding boundary is moved up to be inserted into the parent node
@@ -306,22 +483,138 @@ Insertion BTreeInterior::insert(const KeyValue* boundary, BlockID block_id) {
         }
         this->boundaries.erase(this->boundaries.begin() + split, this->boundaries.end());
         this->pointers.erase(this->pointers.begin() + split, this->pointers.end());
+        this->repack();
+        nnode->repack();
 
         // save everything
         nnode->save();
         this->save();
+        delete nnode;
         return ret;
     }
 }
 
+// Add a boundary, block_id pair after all the others (caller supplies them in order).
+// Returns false, leaving the node alone, if that would fill the block past fill_percent;
+// an empty node always takes the pair.
+bool BTreeInterior::append(const KeyValue* boundary, BlockID block_id, uint fill_percent) {
+    uint size = page_size(2, key_size(boundary) + sizeof(BlockID)) - 4;
+    if (!this->boundaries.empty() && this->bulk_size + size > this->file.get_block_size() * fill_percent / 100)
+        return false;
+    if (this->bulk_size + size > this->file.get_block_size())
+        throw DbRelationError("index key too big to store");
+    this->boundaries.push_back(new KeyValue(*boundary));
+    this->prefixes.push_back(key_prefix(boundary));
+    this->pointers.push_back(block_id);
+    this->bulk_size += size;
+    return true;
+}
+
+// Take out child i (which mustn't be first) and the boundary before it.
+void BTreeInterior::remove_child(uint i) {
+    unpack_boundaries();
+    delete this->boundaries[i - 1];
+    this->boundaries.erase(this->boundaries.begin() + (i - 1));
+    this->prefixes.erase(this->prefixes.begin() + (i - 1));
+    this->pointers.erase(this->pointers.begin() + (i - 1));
+}
+
+// Bytes save() would put in the block.
+uint BTreeInterior::size() const {
+    unpack_boundaries();
+    uint bytes = sizeof(BlockID);
+    for (auto const& boundary: this->boundaries)
+        bytes += key_size(boundary) + sizeof(BlockID);
+    return page_size(2 * (uint) this->boundaries.size() + 1, bytes);
+}
+
+// Append the children of right, the sister after this node, with separator (the parent's
+// boundary between the two) coming down as the boundary before right's first child.
+void BTreeInterior::absorb(BTreeInterior* right, const KeyValue* separator) {
+    unpack_boundaries();
+    right->unpack_boundaries();
+    this->boundaries.push_back(new KeyValue(*separator));
+    this->pointers.push_back(right->first);
+    this->boundaries.insert(this->boundaries.end(), right->boundaries.begin(), right->boundaries.end());
+    this->pointers.insert(this->pointers.end(), right->pointers.begin(), right->pointers.end());
+    right->boundaries.clear();
+    right->pointers.clear();
+    right->prefixes.clear();
+    repack();
+}
+
+// Hand the back half (by size) of this node's children to right, an empty sister after it.
+// Returns the boundary left in the middle, which goes up to the parent between the two.
+KeyValue BTreeInterior::share(BTreeInterior* right) {
+    unpack_boundaries();
+    uint half = size() / 2;
+    uint kept = page_size(1, sizeof(BlockID));
+    uint middle = 0;
+    while (middle + 1 < this->boundaries.size() && kept < half) {
+        kept += 8 + key_size(this->boundaries[middle]) + sizeof(BlockID);
+        middle++;
+    }
+    KeyValue new_separator = *this->boundaries[middle];
+    delete this->boundaries[middle];
+    right->first = this->pointers[middle];
+    right->boundaries.assign(this->boundaries.begin() + middle + 1, this->boundaries.end());
+    right->pointers.assign(this->pointers.begin() + middle + 1, this->pointers.end());
+    this->boundaries.erase(this->boundaries.begin() + middle, this->boundaries.end());
+    this->pointers.erase(this->pointers.begin() + middle, this->pointers.end());
+    repack();
+    right->repack();
+    return new_separator;
+}
+
+
+
+/*****************
+ * BTreeOverflow *
+ *****************/
+
+BTreeOverflow::BTreeOverflow(HeapFile &file, BlockID block_id, const KeyProfile& key_profile, bool create)
+        : BTreeNode(file, block_id, key_profile, create), next(0), handles() {
+    if (!create) {
+        this->next = get_block_id(1);
+        Dbt *dbt = this->block->get(2);
+        unmarshal_handles((char *) dbt->get_data(), (uint) dbt->get_size(), this->handles);
+        delete dbt;
+    }
+}
+
+// Save the next block and the handles
+void BTreeOverflow::save() {
+    this->block->clear();
+    Dbt *dbt = marshal_block_id(this->next);
+    this->block->add(dbt);
+    delete[] (char *) dbt->get_data();
+    delete dbt;
+
+    uint size = handles_size(this->handles);
+    char *bytes = new char[size];
+    marshal_handles(this->handles, bytes);
+    Dbt data(bytes, size);
+    this->block->add(&data);
+    delete[] bytes;
+
+    BTreeNode::save();
+}
+
+bool BTreeOverflow::fits() const {
+    return page_size(2, sizeof(BlockID) + handles_size(this->handles)) <= this->file.get_block_size();
+}
 
 
 /*************
  * BTreeLeaf *
  *************/
 
+// bytes of a posting record pointing at an overflow chain: tag, first and last blocks, count
+static const uint CHAIN_SIZE = 1 + 2 * sizeof(BlockID) + sizeof(uint32_t);
+
 BTreeLeaf::BTreeLeaf(HeapFile &file, BlockID block_id, const KeyProfile& key_profile, bool create)
-        : BTreeNode(file, block_id, key_profile, create), next_leaf(0), key_map() {
+        : BTreeNode(file, block_id, key_profile, create), bulk_size(page_size(1, sizeof(BlockID))),
+          next_leaf(0), key_map() {
     if (!create) {
         RecordIDs *record_id_list = this->block->ids();
         RecordID i = 1;
@@ -330,9 +623,10 @@ BTreeLeaf::BTreeLeaf(HeapFile &file, BlockID block_id, const KeyProfile& key_pro
                 // next leaf block
                 this->next_leaf = get_block_id(i);
             } else if (i%2 == 0) {
-                // record i-1: handle, record i: key
+                // record i-1: postings, record i: key
                 KeyValue *key_value = get_key(i);
-                this->key_map[*key_value] = get_handle(i-1);
+                this->key_map[*key_value] = get_postings(i-1);
+                delete key_value;
             }
             i++;
         }
@@ -343,9 +637,127 @@ BTreeLeaf::BTreeLeaf(HeapFile &file, BlockID block_id, const KeyProfile& key_pro
 BTreeLeaf::~BTreeLeaf() {
 }
 
-// Find the handle for a given key
-Handle BTreeLeaf::find_eq(const KeyValue* key) const {
-    return this->key_map.at(*key);
+// Get the record and turn it into Postings: a tag and then either the handles or where their chain is.
+Postings BTreeLeaf::get_postings(RecordID record_id) const {
+    Dbt *dbt = this->block->get(record_id);
+    char *bytes = (char *) dbt->get_data();
+    Postings postings;
+    if (bytes[0] == CHAINED) {
+        postings.overflow = *(BlockID *) (bytes + 1);
+        postings.last = *(BlockID *) (bytes + 1 + sizeof(BlockID));
+        postings.count = *(uint32_t *) (bytes + 1 + 2 * sizeof(BlockID));
+    } else {
+        unmarshal_handles(bytes + 1, (uint) dbt->get_size() - 1, postings.handles);
+        postings.count = (uint) postings.handles.size();
+    }
+    delete dbt;
+    return postings;
+}
+
+// Convert postings into bytes.
+Dbt *BTreeLeaf::marshal_postings(const Postings& postings) const {
+    uint size = postings_size(postings);
+    char *bytes = new char[size];
+    if (postings.overflow != 0) {
+        bytes[0] = CHAINED;
+        *(BlockID *) (bytes + 1) = postings.overflow;
+        *(BlockID *) (bytes + 1 + sizeof(BlockID)) = postings.last;
+        *(uint32_t *) (bytes + 1 + 2 * sizeof(BlockID)) = postings.count;
+    } else {
+        bytes[0] = IN_LEAF;
+        marshal_handles(postings.handles, bytes + 1);
+    }
+    return new Dbt(bytes, size);
+}
+
+// Size of the record marshal_postings() makes for postings, without making it.
+uint BTreeLeaf::postings_size(const Postings& postings) const {
+    return postings.overflow != 0 ? CHAIN_SIZE : 1 + handles_size(postings.handles);
+}
+
+// Bytes save() would put in the block.
+uint BTreeLeaf::size() const {
+    uint bytes = sizeof(BlockID);
+    for (auto const& item: this->key_map)
+        bytes += key_size(&item.first) + postings_size(item.second);
+    return page_size(2 * (uint) this->key_map.size() + 1, bytes);
+}
+
+// Find the handles for a given key, reading them from its overflow chain if they're there
+Handles* BTreeLeaf::find_eq(const KeyValue* key) const {
+    Handles *handles = new Handles();
+    auto entry = this->key_map.find(*key);
+    if (entry == this->key_map.end())
+        return handles;
+    const Postings& postings = entry->second;
+    if (postings.overflow == 0) {
+        *handles = postings.handles;
+        return handles;
+    }
+    handles->reserve(postings.count);
+    for (BlockID id = postings.overflow; id != 0; ) {
+        BTreeOverflow page(this->file, id, this->key_profile, false);
+        handles->insert(handles->end(), page.get_handles().begin(), page.get_handles().end());
+        id = page.get_next();
+    }
+    return handles;
+}
+
+// Point the entry of a row that moved at its new handle
+Insertion BTreeLeaf::relocate(const KeyValue* key, Handle from, Handle to, BTreeStat& stat) {
+    auto entry = this->key_map.find(*key);
+    if (entry == this->key_map.end() || !remove_handle(entry->second, from, stat))
+        throw DbRelationError("no index entry for the moved row");
+    add_handle(entry->second, to, stat);
+    return save_or_split(stat);
+}
+
+// Take handle out of key's entry, and the entry out of the leaf if that was its last handle
+// (putting its overflow chain, if it has one, on the free list).
+void BTreeLeaf::remove(const KeyValue* key, Handle handle, BTreeStat& stat) {
+    auto entry = this->key_map.find(*key);
+    if (entry == this->key_map.end() || !remove_handle(entry->second, handle, stat))
+        throw DbRelationError("no index entry for the row");
+    Postings& postings = entry->second;
+    if (postings.count == 0) {
+        for (BlockID id = postings.overflow; id != 0; ) {
+            BlockID next;
+            {
+                BTreeOverflow page(this->file, id, this->key_profile, false);
+                next = page.get_next();
+            }
+            stat.release(id);
+            id = next;
+        }
+        this->key_map.erase(entry);
+    }
+    save();
+}
+
+// Append the entries of right, the sister after this leaf, and take over its next_leaf.
+void BTreeLeaf::absorb(BTreeLeaf* right) {
+    this->key_map.insert(right->key_map.begin(), right->key_map.end());
+    right->key_map.clear();
+    this->next_leaf = right->next_leaf;
+}
+
+// Hand the back half (by size) of this leaf's entries to right, an empty sister to put
+// after it in the chain. Returns right's first key, the boundary between the two.
+KeyValue BTreeLeaf::share(BTreeLeaf* right) {
+    right->next_leaf = this->next_leaf;
+    this->next_leaf = right->id;
+    uint half = size() / 2;
+    uint kept = page_size(1, sizeof(BlockID));
+    auto split = this->key_map.begin();
+    while (std::next(split) != this->key_map.end() && kept < half) {
+        kept += 8 + key_size(&split->first) + postings_size(split->second);
+        split++;
+    }
+    if (split == this->key_map.begin())
+        split++;
+    right->key_map.insert(split, this->key_map.end());
+    this->key_map.erase(split, this->key_map.end());
+    return right->key_map.begin()->first;
 }
 
 // Save the key_map and next_leaf data in the correct order
@@ -353,8 +765,8 @@ void BTreeLeaf::save() {
     Dbt *dbt;
     this->block->clear();
     for (auto const& item: this->key_map) {
-        // handle
-        dbt = marshal_handle(item.second);
+        // postings
+        dbt = marshal_postings(item.second);
         this->block->add(dbt);
         delete[] (char *) dbt->get_data();
         delete dbt;
@@ -375,61 +787,224 @@ void BTreeLeaf::save() {
 }
 
 // Insert key, handle pair into block.
-Insertion BTreeLeaf::insert(const KeyValue* key, Handle handle) {
-    // check unique
-    if (this->key_map.find(*key) != this->key_map.end())
-        throw DbRelationError("Duplicate keys are not allowed in unique index");
-
-    Dbt *dbt;
-    dbt = marshal_handle(handle);
-    try {
-        // following is just a check for size (the save method will redo this in the right order)
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
-        dbt = marshal_key(key);
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
+Insertion BTreeLeaf::insert(const KeyValue* key, Handle handle, bool unique, BTreeStat& stat) {
+    auto entry = this->key_map.find(*key);
+    if (entry == this->key_map.end()) {
+        Postings postings;
+        postings.handles.push_back(handle);
+        postings.count = 1;
+        this->key_map[*key] = postings;
+    } else {
+        if (unique)
+            throw DbRelationError("Duplicate keys are not allowed in unique index");
+        add_handle(entry->second, handle, stat);
+    }
+    return save_or_split(stat);
+}
 
-        // that worked, so no need to split
-        this->key_map[*key] = handle;
+// Save the leaf if it still fits in its block. If not, split it: the entries past the middle
+// (by size) move to a new sister on the right, and the first of them is the new boundary.
+Insertion BTreeLeaf::save_or_split(BTreeStat& stat) {
+    if (size() <= this->file.get_block_size()) {
         save();
         return BTreeNode::insertion_none();
+    }
 
-    } catch (DbBlockNoRoomError &e) {
-        delete[] (char *) dbt->get_data();
-        delete dbt;
+    // create the sister and put her to the right
+    BTreeLeaf *nleaf = new BTreeLeaf(this->file, stat.allocate(), this->key_profile, true);
+    nleaf->next_leaf = this->next_leaf;
+    this->next_leaf = nleaf->id;
+
+    // move the second half of the entries to the sister
+    uint total = 0;
+    for (auto const& item: this->key_map)
+        total += key_size(&item.first) + postings_size(item.second);
+    uint kept = 0;
+    auto split = this->key_map.begin();
+    while (split != this->key_map.end() && kept < total / 2) {
+        kept += key_size(&split->first) + postings_size(split->second);
+        split++;
+    }
+    if (split == this->key_map.end())
+        split--;
+    KeyValue boundary = split->first;
+    nleaf->key_map.insert(split, this->key_map.end());
+    this->key_map.erase(split, this->key_map.end());
+
+    nleaf->save();
+    this->save();
+    BlockID nleaf_id = nleaf->id;
+    delete nleaf;
+    return Insertion(nleaf_id, boundary);
+}
 
-        // too big, so split
+// Put handle in its place in postings, moving the list out to an overflow chain once it's
+// too long to keep in the leaf.
+void BTreeLeaf::add_handle(Postings& postings, Handle handle, BTreeStat& stat) {
+    if (postings.overflow != 0) {
+        overflow_insert(postings, handle, stat);
+    } else {
+        Handles& handles = postings.handles;
+        handles.insert(std::upper_bound(handles.begin(), handles.end(), handle), handle);
+        if (handles_size(handles) > max_in_leaf())
+            spill(postings, stat);
+    }
+    postings.count++;
+}
 
-        // create the sister and put her to the right
-        BTreeLeaf *nleaf = new BTreeLeaf(this->file, 0, this->key_profile, true);
-        nleaf->next_leaf = this->next_leaf;
-        this->next_leaf = nleaf->id;
+// Take handle out of postings. Returns false if it isn't there.
+bool BTreeLeaf::remove_handle(Postings& postings, Handle handle, BTreeStat& stat) {
+    if (postings.overflow != 0) {
+        if (!overflow_remove(postings, handle, stat))
+            return false;
+    } else {
+        Handles& handles = postings.handles;
+        auto at = std::lower_bound(handles.begin(), handles.end(), handle);
+        if (at == handles.end() || *at != handle)
+            return false;
+        handles.erase(at);
+    }
+    postings.count--;
+    return true;
+}
 
-        // move half of the entries to the sister
-        auto key_list = this->key_map;       // make a copy of my key_map
-        key_list[*key] = handle;             // add key/handle to it
-        u_long split = key_list.size() / 2;  // figure out how many to keep (the rest move to nleaf)
-        this->key_map.clear();               // empty my list
-        u_long i = 0;
-        KeyValue boundary;
-        for (auto const& item: key_list) {
-            if (i < split) {
-                this->key_map[item.first] = item.second;
-            } else if (i == split) {
-                boundary = item.first;
-                nleaf->key_map[boundary] = item.second;
-            } else {
-                nleaf->key_map[item.first] = item.second;
+// Move the handles of postings out to a new overflow chain, filling each block before
+// starting the next.
+void BTreeLeaf::spill(Postings& postings, BTreeStat& stat) {
+    uint room = this->file.get_block_size() - page_size(2, sizeof(BlockID));
+    BTreeOverflow *page = new BTreeOverflow(this->file, stat.allocate(), this->key_profile, true);
+    postings.overflow = page->get_id();
+    uint bytes = 0;  // for page's handles, leaving out their count
+    uint64_t previous = 0;
+    for (auto const& handle: postings.handles) {
+        uint64_t value = handle_value(handle);
+        uint size = varint_size(value - previous);
+        uint count = (uint) page->get_handles().size();
+        if (count > 0 && varint_size(count + 1) + bytes + size > room) {
+            BTreeOverflow *next = new BTreeOverflow(this->file, stat.allocate(), this->key_profile, true);
+            page->set_next(next->get_id());
+            page->save();
+            delete page;
+            page = next;
+            bytes = 0;
+            size = varint_size(value);
+        }
+        page->get_handles().push_back(handle);
+        bytes += size;
+        previous = value;
+    }
+    page->save();
+    postings.last = page->get_id();
+    delete page;
+    postings.handles.clear();
+    postings.handles.shrink_to_fit();
+}
+
+// Put handle in its block of the overflow chain: the last block whose first handle doesn't
+// come after it (or the first block, if they all do). New rows mostly go at the end of the
+// table, so the last block is tried before walking the chain. A block that fills up splits
+// in two; or, if the handle went on the very end of the chain, hands just that one on to a
+// new last block, so appending rows leaves the blocks full.
+void BTreeLeaf::overflow_insert(Postings& postings, Handle handle, BTreeStat& stat) {
+    BTreeOverflow *page = new BTreeOverflow(this->file, postings.last, this->key_profile, false);
+    if (page->get_handles().empty() || handle < page->get_handles().front()) {
+        delete page;
+        page = new BTreeOverflow(this->file, postings.overflow, this->key_profile, false);
+        for (BlockID id = page->get_next(); id != 0; ) {
+            BTreeOverflow *next = new BTreeOverflow(this->file, id, this->key_profile, false);
+            id = next->get_next();
+            bool past = !next->get_handles().empty() && handle < next->get_handles().front();
+            if (past || next->get_handles().empty()) {
+                delete next;
+                if (past)
+                    break;
+                continue;
             }
-            i++;
+            delete page;
+            page = next;
         }
+    }
 
-        nleaf->save();
-        this->save();
-        return Insertion(nleaf->id, boundary);
+    Handles& handles = page->get_handles();
+    auto at = std::upper_bound(handles.begin(), handles.end(), handle);
+    bool at_end = at == handles.end() && page->get_id() == postings.last;
+    handles.insert(at, handle);
+    if (!page->fits()) {
+        BTreeOverflow *sister = new BTreeOverflow(this->file, stat.allocate(), this->key_profile, true);
+        sister->set_next(page->get_next());
+        page->set_next(sister->get_id());
+        u_long split = at_end ? handles.size() - 1 : handles.size() / 2;
+        sister->get_handles().assign(handles.begin() + split, handles.end());
+        handles.erase(handles.begin() + split, handles.end());
+        if (page->get_id() == postings.last)
+            postings.last = sister->get_id();
+        sister->save();
+        delete sister;
     }
+    page->save();
+    delete page;
 }
 
+// Take handle out of the overflow chain, starting at the last block if it's in there (see
+// overflow_insert). A block left empty goes on the free list, unless it's all the chain
+// has left. Returns false if the handle isn't there.
+bool BTreeLeaf::overflow_remove(Postings& postings, Handle handle, BTreeStat& stat) {
+    BlockID id = postings.overflow;
+    {
+        BTreeOverflow last(this->file, postings.last, this->key_profile, false);
+        if (!last.get_handles().empty() && !(handle < last.get_handles().front()))
+            id = postings.last;
+    }
+    while (id != 0) {
+        BTreeOverflow page(this->file, id, this->key_profile, false);
+        Handles& handles = page.get_handles();
+        auto at = std::lower_bound(handles.begin(), handles.end(), handle);
+        if (at != handles.end() && *at == handle) {
+            handles.erase(at);
+            if (!handles.empty() || postings.overflow == postings.last) {
+                page.save();
+                return true;
+            }
+
+            // unlink the empty block
+            if (id == postings.overflow) {
+                postings.overflow = page.get_next();
+            } else {
+                BTreeOverflow *previous = new BTreeOverflow(this->file, postings.overflow, this->key_profile, false);
+                while (previous->get_next() != id) {
+                    BlockID next = previous->get_next();
+                    delete previous;
+                    previous = new BTreeOverflow(this->file, next, this->key_profile, false);
+                }
+                previous->set_next(page.get_next());
+                previous->save();
+                if (id == postings.last)
+                    postings.last = previous->get_id();
+                delete previous;
+            }
+            stat.release(id);
+            return true;
+        }
+        if (at != handles.end())
+            return false;  // it would have been in this block
+        id = page.get_next();
+    }
+    return false;
+}
+
+// Add a key and its postings after all the others (caller supplies keys in order, each
+// key's handles in handle order). Returns false, leaving the leaf alone, if that would fill
+// the block past fill_percent; an empty leaf always takes them.
+bool BTreeLeaf::append(const KeyValue* key, Postings postings, uint fill_percent, BTreeStat& stat) {
+    bool chain = postings.overflow == 0 && handles_size(postings.handles) > max_in_leaf();
+    uint size = page_size(2, key_size(key) + (chain ? CHAIN_SIZE : postings_size(postings))) - 4;
+    if (!this->key_map.empty() && this->bulk_size + size > this->file.get_block_size() * fill_percent / 100)
+        return false;
+    if (this->bulk_size + size > this->file.get_block_size())
+        throw DbRelationError("index key too big to store");
+    if (chain)
+        spill(postings, stat);
+    this->key_map.emplace_hint(this->key_map.end(), *key, postings);
+    this->bulk_size += size;
+    return true;
+}
@@ -9,8 +9,23 @@ typedef std::vector<KeyValue*> KeyValues;
 typedef std::vector<BlockID> BlockPointers;
 typedef std::pair<BlockID,KeyValue> Insertion;
 
+/**
+ * The handles of the rows with one key, in handle order. A list that gets too long for its
+ * leaf moves out to a chain of overflow blocks (see BTreeOverflow) and the leaf just keeps
+ * where the chain is.
+ */
+struct Postings {
+    Handles handles;   // the list, if it's in the leaf
+    BlockID overflow;  // otherwise the first block of its chain (0 if it's in the leaf)
+    BlockID last;      // and the last one
+    uint count;        // handles in the list, wherever it is
+
+    Postings() : handles(), overflow(0), last(0), count(0) {}
+};
+
 class BTreeNode {
 public:
+    // create: a new node in block_id, a block off the free list (see BTreeStat::allocate), or a new block if 0
     BTreeNode(HeapFile &file, BlockID block_id, const KeyProfile& key_profile, bool create);
     virtual ~BTreeNode();
 
@@ -28,18 +43,43 @@ protected:
     const KeyProfile& key_profile;
 
     static Dbt *marshal_block_id(BlockID block_id);
-    static Dbt *marshal_handle(Handle handle);
+    static uint handles_size(const Handles& handles);  // bytes marshal_handles() writes
+    static char *marshal_handles(const Handles& handles, char *bytes);  // returns the end of what it wrote
+    static void unmarshal_handles(const char *bytes, uint size, Handles& handles);
     virtual Dbt *marshal_key(const KeyValue *key);
+    virtual uint key_size(const KeyValue *key) const;  // bytes marshal_key would produce
 
     virtual BlockID get_block_id(RecordID record_id) const;
-    virtual Handle get_handle(RecordID record_id) const;
     virtual KeyValue* get_key(RecordID record_id) const;
 };
 
+/**
+ * One block of a posting list's overflow chain: record 1 is the next block in the chain
+ * (0 at the end), record 2 the block's handles. Every handle in a block comes before
+ * every handle in the blocks after it.
+ */
+class BTreeOverflow : public BTreeNode {
+public:
+    BTreeOverflow(HeapFile &file, BlockID block_id, const KeyProfile& key_profile, bool create);
+    virtual ~BTreeOverflow() {}
+
+    virtual void save();
+    bool fits() const;  // would the handles fit in the block?
+
+    Handles& get_handles() { return this->handles; }
+    void set_next(BlockID next) { this->next = next; }
+    BlockID get_next() const { return this->next; }
+
+protected:
+    BlockID next;
+    Handles handles;
+};
+
 class BTreeStat : public BTreeNode {
 public:
     static const RecordID ROOT = 1;  // where we store the root id in the stat block
     static const RecordID HEIGHT = ROOT + 1;  // where we store the height in the stat block
+    static const RecordID FREE = HEIGHT + 1;  // where we store the first block of the free list
 
     BTreeStat(HeapFile &file, BlockID stat_id, BlockID new_root, const KeyProfile& key_profile);
     BTreeStat(HeapFile &file, BlockID stat_id, const KeyProfile& key_profile);
@@ -52,27 +92,56 @@ public:
     uint get_height() const { return this->height; }
     void set_height(uint height) { this->height = height; }
 
+    BlockID allocate();  // a block off the free list, or 0 if it's empty
+    void release(BlockID block_id);  // put a block nothing uses any more on the free list
+
 protected:
     BlockID root_id;
     uint height;
+    BlockID free;  // blocks freed by deletes, each holding the next one's id
 
 };
 
+/**
+ * Record 1 of an interior node is its first pointer, then boundary key and pointer records
+ * take turns. A visit unpacks just the pointers and, into one contiguous array, a fixed-width
+ * prefix of each boundary (see key_prefix); find_child() binary searches those, and unpacks a
+ * whole boundary only for a prefix that ties with the key's. Anything that changes the node
+ * unpacks all of them first.
+ */
 class BTreeInterior : public BTreeNode {
 public:
     BTreeInterior(HeapFile &file, BlockID block_id, const KeyProfile& key_profile, bool create);
     virtual ~BTreeInterior();
 
     BTreeNode *find(const KeyValue* key, uint depth) const;
-    Insertion insert(const KeyValue* boundary, BlockID block_id);
+    uint find_child(const KeyValue* key) const;  // child key is under: 0 for first, i for the one after boundary i-1
+    Insertion insert(const KeyValue* boundary, BlockID block_id, BTreeStat& stat);
+    bool append(const KeyValue* boundary, BlockID block_id, uint fill_percent);  // bulk load, boundaries in order
+    void remove_child(uint i);  // child i (not first) and the boundary before it
+    uint size() const;  // bytes the node takes in its block
+    void absorb(BTreeInterior* right, const KeyValue* separator);  // take all of right's children
+    KeyValue share(BTreeInterior* right);  // give the back half to an empty right, returns the boundary between
     virtual void save();
 
     void set_first(BlockID first) { this->first = first; }
+    BlockID get_first() const { return this->first; }
+    uint get_child_count() const { return (uint) this->pointers.size() + 1; }
+    BlockID get_child(uint i) const { return i == 0 ? this->first : this->pointers[i - 1]; }
+    const KeyValue* get_boundary(uint i) const;  // between children i and i+1
+    void set_boundary(uint i, const KeyValue& boundary);
 
 protected:
+    uint bulk_size;  // bytes append() has put in the block so far
     BlockID first;
     BlockPointers pointers;
-    KeyValues boundaries;
+    std::vector<uint64_t> prefixes;  // key_prefix() of each boundary
+    mutable KeyValues boundaries;    // nullptr until unpacked
+
+    uint64_t key_prefix(const KeyValue* key) const;
+    uint64_t record_prefix(RecordID record_id) const;  // key_prefix() of a marshaled key, without unpacking it
+    void unpack_boundaries() const;
+    void repack();
 };
 
 class BTreeLeaf : public BTreeNode {
@@ -80,12 +149,37 @@ public:
     BTreeLeaf(HeapFile &file, BlockID block_id, const KeyProfile& key_profile, bool create);
     virtual ~BTreeLeaf();
 
-    Handle find_eq(const KeyValue* key) const;  // throws if not found
-    Insertion insert(const KeyValue* key, Handle handle);
+    Handles* find_eq(const KeyValue* key) const;  // handles in handle order, none if not found (freed by caller)
+    Insertion insert(const KeyValue* key, Handle handle, bool unique, BTreeStat& stat);  // unique: throws if key is there already
+    bool append(const KeyValue* key, Postings postings, uint fill_percent, BTreeStat& stat);  // bulk load, keys in order
+    Insertion relocate(const KeyValue* key, Handle from, Handle to, BTreeStat& stat);  // throws if key isn't there with from
+    void remove(const KeyValue* key, Handle handle, BTreeStat& stat);  // throws if key isn't there with handle
+    uint size() const;  // bytes the leaf takes in its block
+    void absorb(BTreeLeaf* right);  // take all of right's entries, and its place in the chain
+    KeyValue share(BTreeLeaf* right);  // give the back half to an empty right, returns its first key
     virtual void save();
 
+    void set_next_leaf(BlockID next_leaf) { this->next_leaf = next_leaf; }
+    BlockID get_next_leaf() const { return this->next_leaf; }
+    const std::map<KeyValue,Postings>& get_key_map() const { return this->key_map; }
+
 protected:
+    static const uint8_t IN_LEAF = 0;  // posting record tags
+    static const uint8_t CHAINED = 1;
+
+    uint bulk_size;  // bytes append() has put in the block so far
     BlockID next_leaf;
-    std::map<KeyValue,Handle> key_map;
+    std::map<KeyValue,Postings> key_map;
+
+    Postings get_postings(RecordID record_id) const;
+    Dbt *marshal_postings(const Postings& postings) const;
+    uint postings_size(const Postings& postings) const;
+    uint max_in_leaf() const { return this->file.get_block_size() / 8; }  // longest list kept in the leaf, in bytes
+    Insertion save_or_split(BTreeStat& stat);
+    void add_handle(Postings& postings, Handle handle, BTreeStat& stat);
+    bool remove_handle(Postings& postings, Handle handle, BTreeStat& stat);
+    void spill(Postings& postings, BTreeStat& stat);
+    void overflow_insert(Postings& postings, Handle handle, BTreeStat& stat);
+    bool overflow_remove(Postings& postings, Handle handle, BTreeStat& stat);
 };
 
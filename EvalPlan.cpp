@@ -1,4 +1,7 @@
+#include <algorithm>
+#include <memory>
 #include "EvalPlan.h"
+#include "column_batch.h"
 
 
 class Dummy : public DbRelation {
@@ -21,23 +24,37 @@ public:
 };
 
 EvalPlan::EvalPlan(PlanType type, EvalPlan *relation)
-        : type(type), relation(relation), projection(nullptr), select_conjunction(nullptr), table(Dummy::one()) {
+        : type(type), relation(relation), projection(nullptr), select_conjunction(nullptr), table(Dummy::one()),
+          index(nullptr), min_key(nullptr), max_key(nullptr) {
 }
 
 EvalPlan::EvalPlan(ColumnNames *projection, EvalPlan *relation)
-        : type(Project), relation(relation), projection(projection), select_conjunction(nullptr), table(Dummy::one()) {
+        : type(Project), relation(relation), projection(projection), select_conjunction(nullptr), table(Dummy::one()),
+          index(nullptr), min_key(nullptr), max_key(nullptr) {
 }
 
-EvalPlan::EvalPlan(ValueDict* conjunction, EvalPlan *relation)
-        : type(Select), relation(relation), projection(nullptr), select_conjunction(conjunction), table(Dummy::one()) {
+EvalPlan::EvalPlan(Conjunction* conjunction, EvalPlan *relation)
+        : type(Select), relation(relation), projection(nullptr), select_conjunction(conjunction), table(Dummy::one()),
+          index(nullptr), min_key(nullptr), max_key(nullptr) {
 }
 
 EvalPlan::EvalPlan(DbRelation &table)
-        : type(TableScan), relation(nullptr), projection(nullptr), select_conjunction(nullptr), table(table) {
+        : type(TableScan), relation(nullptr), projection(nullptr), select_conjunction(nullptr), table(table),
+          index(nullptr), min_key(nullptr), max_key(nullptr) {
+}
+
+EvalPlan::EvalPlan(DbIndex &index, ValueDict *min_key, ValueDict *max_key, DbRelation &table)
+        : type(IndexScan), relation(nullptr), projection(nullptr), select_conjunction(nullptr), table(table),
+          index(&index), min_key(min_key), max_key(max_key) {
+}
+
+EvalPlan::EvalPlan(DbIndex &index, ValueDict *key, DbRelation &table)
+        : type(IndexLookup), relation(nullptr), projection(nullptr), select_conjunction(nullptr), table(table),
+          index(&index), min_key(key), max_key(nullptr) {
 }
 
 EvalPlan::EvalPlan(const EvalPlan *other)
-        : type(other->type), table(other->table) {
+        : type(other->type), table(other->table), index(other->index) {
     if (other->relation != nullptr)
         relation = new EvalPlan(other->relation);
     else
@@ -47,26 +64,142 @@ EvalPlan::EvalPlan(const EvalPlan *other)
     else
         projection = nullptr;
     if (other->select_conjunction != nullptr)
-        select_conjunction = new ValueDict(*other->select_conjunction);
+        select_conjunction = new Conjunction(*other->select_conjunction);
     else
         select_conjunction = nullptr;
+    min_key = other->min_key != nullptr ? new ValueDict(*other->min_key) : nullptr;
+    max_key = other->max_key != nullptr ? new ValueDict(*other->max_key) : nullptr;
 }
 
 EvalPlan::~EvalPlan() {
     delete relation;
     delete projection;
     delete select_conjunction;
+    delete min_key;
+    delete max_key;
+}
+
+EvalPlan *EvalPlan::index_scan(DbIndex &index, DbRelation &table, const Conjunction &where, bool lookup_only) {
+    const ColumnNames &key_columns = index.get_key_columns();
+    std::vector<Value*> lows(key_columns.size(), nullptr), highs(key_columns.size(), nullptr);
+    Conjunction *residual = new Conjunction();
+
+    // fold the predicates on key columns into bounds; anything the bounds don't say exactly is rechecked
+    for (auto const& predicate: where) {
+        auto it = std::find(key_columns.begin(), key_columns.end(), predicate.column_name);
+        if (it == key_columns.end()) {
+            residual->push_back(predicate);
+            continue;
+        }
+        u_long k = it - key_columns.begin();
+        if (!predicate.narrow(lows[k], highs[k]))
+            residual->push_back(predicate);
+    }
+
+    // a single-column key can take any range; a composite key (or a hash index) needs an equality on every column
+    bool usable = true;
+    for (u_long k = 0; k < key_columns.size(); k++) {
+        if (key_columns.size() == 1 && !lookup_only)
+            usable = lows[k] != nullptr || highs[k] != nullptr;
+        else if (lows[k] == nullptr || highs[k] == nullptr || *lows[k] != *highs[k])
+            usable = false;
+    }
+
+    ValueDict *min_key = nullptr, *max_key = nullptr;
+    if (usable) {
+        for (u_long k = 0; k < key_columns.size(); k++) {
+            if (lows[k] != nullptr) {
+                if (min_key == nullptr)
+                    min_key = new ValueDict();
+                (*min_key)[key_columns[k]] = *lows[k];
+            }
+            if (highs[k] != nullptr) {
+                if (max_key == nullptr)
+                    max_key = new ValueDict();
+                (*max_key)[key_columns[k]] = *highs[k];
+            }
+        }
+    }
+    for (u_long k = 0; k < key_columns.size(); k++) {
+        delete lows[k];
+        delete highs[k];
+    }
+    if (!usable) {
+        delete residual;
+        return nullptr;
+    }
+
+    EvalPlan *plan;
+    if (min_key != nullptr && max_key != nullptr && *min_key == *max_key) {
+        delete max_key;
+        plan = new EvalPlan(index, min_key, table);
+    } else {
+        plan = new EvalPlan(index, min_key, max_key, table);
+    }
+    if (residual->empty())
+        delete residual;
+    else
+        plan = new EvalPlan(residual, plan);
+    return plan;
 }
 
 
-EvalPlan *EvalPlan::optimize() {
-    return new EvalPlan(this);  // For now, we don't know how to do anything better
+EvalPlan *EvalPlan::optimize(Indices *indices) {
+    if (indices != nullptr && this->type == Select && this->relation->type == TableScan) {
+        EvalPlan *ret = optimize_select(*indices);
+        if (ret != nullptr)
+            return ret;
+    }
+
+    EvalPlan *ret = new EvalPlan(this);
+    if (this->relation != nullptr) {
+        delete ret->relation;
+        ret->relation = this->relation->optimize(indices);
+    }
+    return ret;
+}
+
+// Replace this Select over a TableScan with a scan of the best-fitting index (a lookup, for a hash index), if any fits.
+EvalPlan *EvalPlan::optimize_select(Indices &indices) const {
+    DbRelation &scanned = this->relation->table;
+    EvalPlan *best = nullptr;
+    for (auto const& index_name: indices.get_index_names(scanned.get_table_name())) {
+        ColumnNames key_columns;
+        bool is_hash, is_unique;
+        indices.get_columns(scanned.get_table_name(), index_name, key_columns, is_hash, is_unique);
+
+        EvalPlan *candidate = index_scan(indices.get_index(scanned.get_table_name(), index_name), scanned,
+                                         *this->select_conjunction, is_hash);
+        if (candidate == nullptr)
+            continue;
+        if (best == nullptr || candidate->index_rank() < best->index_rank()) {
+            delete best;
+            best = candidate;
+        } else {
+            delete candidate;
+        }
+    }
+    return best;
+}
+
+// How selective an index_scan() plan looks: lookups, then closed ranges, then open-ended ones.
+uint EvalPlan::index_rank() const {
+    const EvalPlan *scan = this->type == Select ? this->relation : this;
+    if (scan->type == IndexLookup)
+        return 0;
+    if (scan->min_key != nullptr && scan->max_key != nullptr)
+        return 1;
+    return 2;
 }
 
 ValueDicts *EvalPlan::evaluate() {
     ValueDicts *ret = nullptr;
     if (this->type != ProjectAll && this->type != Project)
         throw DbRelationError("Invalid evaluation plan--not ending with a projection");
+    if (this->relation->is_batchable())
+        return evaluate_batches();
+    if (this->relation->is_index_scan())
+        return evaluate_index_scan();
 
     EvalPipeline pipeline = this->relation->pipeline();
     DbRelation *temp_table = pipeline.first;
@@ -79,23 +212,144 @@ ValueDicts *EvalPlan::evaluate() {
     return ret;
 }
 
+// Is this a TableScan, possibly under some Selects?
+bool EvalPlan::is_batchable() const {
+    const EvalPlan *plan = this;
+    while (plan->type == Select)
+        plan = plan->relation;
+    return plan->type == TableScan;
+}
+
+// Is this an IndexScan, possibly under some Selects?
+bool EvalPlan::is_index_scan() const {
+    const EvalPlan *plan = this;
+    while (plan->type == Select)
+        plan = plan->relation;
+    return plan->type == IndexScan;
+}
+
+// The columns the projection outputs; columns gets those followed by any others the predicates use
+static ColumnNames columns_to_read(DbRelation &table, const ColumnNames *projection,
+                                   const std::vector<const Conjunction*> &conjunctions, ColumnNames &columns) {
+    const ColumnNames &all = table.get_column_names();
+    ColumnNames output = projection != nullptr ? *projection : all;
+    for (auto const& column_name: output)
+        if (std::find(all.begin(), all.end(), column_name) == all.end())
+            throw DbRelationError("table does not have column named '" + column_name + "'");
+    columns = output;
+    for (auto const& conjunction: conjunctions) {
+        std::unique_ptr<ColumnNames> used(table.check(*conjunction));
+        for (auto const& column_name: *used)
+            if (std::find(columns.begin(), columns.end(), column_name) == columns.end())
+                columns.push_back(column_name);
+    }
+    return output;
+}
+
+// Read just the columns the plan uses a batch at a time, filter each batch column-wise, then project
+ValueDicts *EvalPlan::evaluate_batches() {
+    std::vector<const Conjunction*> conjunctions;
+    EvalPlan *plan = this->relation;
+    for (; plan->type == Select; plan = plan->relation)
+        conjunctions.push_back(plan->select_conjunction);
+    DbRelation &table = plan->table;
+
+    ColumnNames columns;
+    ColumnNames output = columns_to_read(table, this->type == Project ? this->projection : nullptr, conjunctions, columns);
+
+    std::unique_ptr<ColumnAttributes> attributes(table.get_column_attributes(columns));
+    ColumnBatch batch(columns, *attributes);
+    std::unique_ptr<DbBatchCursor> cursor(table.batch_cursor(columns));
+    ValueDicts *ret = new ValueDicts();
+    try {
+        while (cursor->next(batch)) {
+            for (auto const& conjunction: conjunctions)
+                batch.filter(*conjunction);
+            for (uint row = 0; row < batch.size(); row++) {
+                ValueDict *values = new ValueDict();
+                for (uint i = 0; i < output.size(); i++)
+                    (*values)[output[i]] = batch.get(i, row);
+                ret->push_back(values);
+            }
+        }
+    } catch (...) {
+        for (auto row: *ret)
+            delete row;
+        delete ret;
+        throw;
+    }
+    return ret;
+}
+
+// Follow the index range a handle at a time, reading each row once for both the Selects and the projection,
+// so only the rows that make it into the result are ever held
+ValueDicts *EvalPlan::evaluate_index_scan() {
+    std::vector<const Conjunction*> conjunctions;
+    EvalPlan *plan = this->relation;
+    for (; plan->type == Select; plan = plan->relation)
+        conjunctions.push_back(plan->select_conjunction);
+    DbRelation &table = plan->table;
+
+    ColumnNames columns;
+    ColumnNames output = columns_to_read(table, this->type == Project ? this->projection : nullptr, conjunctions, columns);
+    plan->index->open();
+    std::unique_ptr<DbIndexCursor> cursor(plan->index->range_cursor(plan->min_key, plan->max_key));
+    ValueDicts *ret = new ValueDicts();
+    try {
+        Handle handle;
+        while (cursor->next(handle)) {
+            std::unique_ptr<ValueDict> row(table.project(handle, &columns));
+            bool selected = true;
+            for (auto const& conjunction: conjunctions) {
+                for (auto const& predicate: *conjunction) {
+                    if (!predicate.matches(row->at(predicate.column_name))) {
+                        selected = false;
+                        break;
+                    }
+                }
+                if (!selected)
+                    break;
+            }
+            if (!selected)
+                continue;
+            for (uint i = output.size(); i < columns.size(); i++)
+                row->erase(columns[i]);
+            ret->push_back(row.release());
+        }
+    } catch (...) {
+        for (auto row: *ret)
+            delete row;
+        delete ret;
+        throw;
+    }
+    return ret;
+}
+
 EvalPipeline EvalPlan::pipeline() {
     // base cases
     if (this->type == TableScan)
         return EvalPipeline(&this->table, this->table.select());
+    if (this->type == IndexScan) {
+        this->index->open();
+        return EvalPipeline(&this->table, this->index->range(this->min_key, this->max_key));
+    }
+    if (this->type == IndexLookup) {
+        this->index->open();
+        return EvalPipeline(&this->table, this->index->lookup(this->min_key));
+    }
     if (this->type == Select && this->relation->type == TableScan)
-        return EvalPipeline(&this->relation->table, this->relation->table.select(this->select_conjunction));
+        return EvalPipeline(&this->relation->table, this->relation->table.select(*this->select_conjunction));
 
     // recursive case
     if (this->type == Select) {
         EvalPipeline pipeline = this->relation->pipeline();
         DbRelation *temp_table = pipeline.first;
         Handles *handles = pipeline.second;
-        EvalPipeline ret(temp_table, temp_table->select(handles, this->select_conjunction));
+        EvalPipeline ret(temp_table, temp_table->select(handles, *this->select_conjunction));
         delete handles;
         return ret;
     }
 
-    throw DbRelationError("Not implemented: pipeline other than Select or TableScan");
+    throw DbRelationError("Not implemented: pipeline other than Select, TableScan, IndexScan, or IndexLookup");
 }
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "storage_engine.h"
+#include "schema_tables.h"
 
 
 typedef std::pair<DbRelation*,Handles*> EvalPipeline;
@@ -11,20 +12,32 @@ public:
         ProjectAll,
         Project,
         Select,
-        TableScan
+        TableScan,
+        IndexScan,
+        IndexLookup
     };
 
     EvalPlan(PlanType type, EvalPlan *relation);  // use for ProjectAll, e.g., EvalPlan(EvalPlan::ProjectAll, table);
     EvalPlan(ColumnNames *projection, EvalPlan *relation); // use for Project
-    EvalPlan(ValueDict* conjunction, EvalPlan *relation);  // use for Select
+    EvalPlan(Conjunction* conjunction, EvalPlan *relation);  // use for Select
     EvalPlan(DbRelation &table);  // use for TableScan
+    EvalPlan(DbIndex &index, ValueDict *min_key, ValueDict *max_key, DbRelation &table);  // use for IndexScan
+    EvalPlan(DbIndex &index, ValueDict *key, DbRelation &table);  // use for IndexLookup
     EvalPlan(const EvalPlan *other);  // use for copying
     virtual ~EvalPlan();
 
-    // Attempt to get the best equivalent evaluation plan
-    EvalPlan *optimize();
+    // IndexScan (or IndexLookup, for equality on the whole key) of table through index covering the
+    // key ranges in where, topped by a Select for whatever the index doesn't settle; nullptr if where
+    // puts no usable bounds on the index key (or, with lookup_only, doesn't pin down the whole key)
+    static EvalPlan *index_scan(DbIndex &index, DbRelation &table, const Conjunction &where, bool lookup_only=false);
 
-    // Evaluate the plan: evaluate gets values, pipeline gets handles
+    // Attempt to get the best equivalent evaluation plan; with indices, a Select over a TableScan
+    // is answered through the table's best index if one fits the conjunction
+    EvalPlan *optimize(Indices *indices = nullptr);
+
+    // Evaluate the plan: evaluate gets values, pipeline gets handles; a projection of Selects over
+    // a TableScan is evaluated a ColumnBatch at a time instead of a handle at a time, and one over
+    // an IndexScan streams the index range rather than collecting its handles first
     ValueDicts *evaluate();
     EvalPipeline pipeline();
 
@@ -33,7 +46,17 @@ protected:
     PlanType type;
     EvalPlan *relation;  // for everything except TableScan
     ColumnNames *projection;  // for Project
-    ValueDict *select_conjunction;  // for Select
-    DbRelation &table;  // for TableScan
+    Conjunction *select_conjunction;  // for Select
+    DbRelation &table;  // for TableScan, IndexScan, and IndexLookup
+    DbIndex *index;  // for IndexScan and IndexLookup
+    ValueDict *min_key;  // for IndexScan (nullptr if unbounded), and the key for IndexLookup
+    ValueDict *max_key;  // for IndexScan (nullptr if unbounded)
+
+    EvalPlan *optimize_select(Indices &indices) const;
+    bool is_batchable() const;
+    bool is_index_scan() const;
+    ValueDicts *evaluate_batches();
+    ValueDicts *evaluate_index_scan();
+    uint index_rank() const;
 };
 
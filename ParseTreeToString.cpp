@@ -66,14 +66,31 @@ string ParseTreeToString::get_operator_string(const Expr* expr) {
 			toReturn += "OR";
 			break;
 	    case Expr::NONE:break;
-        case Expr::BETWEEN:break;
+        case Expr::BETWEEN:
+            toReturn += "BETWEEN";
+            if (expr->exprList != NULL && expr->exprList->size() == 2)
+                toReturn += " " + get_expression_string(expr->exprList->at(0)) + " AND " +
+                            get_expression_string(expr->exprList->at(1));
+            break;
         case Expr::CASE:break;
-        case Expr::NOT_EQUALS:break;
-        case Expr::LESS_EQ:break;
-        case Expr::GREATER_EQ:break;
+        case Expr::NOT_EQUALS:
+            toReturn += "<>";
+            break;
+        case Expr::LESS_EQ:
+            toReturn += "<=";
+            break;
+        case Expr::GREATER_EQ:
+            toReturn += ">=";
+            break;
         case Expr::LIKE:break;
         case Expr::NOT_LIKE:break;
-        case Expr::IN:break;
+        case Expr::IN:
+            toReturn += "IN (";
+            if (expr->exprList != NULL)
+                for (uint i = 0; i < expr->exprList->size(); i++)
+                    toReturn += (i > 0 ? ", " : "") + get_expression_string(expr->exprList->at(i));
+            toReturn += ")";
+            break;
         case Expr::NOT:break;
         case Expr::UMINUS:break;
         case Expr::ISNULL:break;
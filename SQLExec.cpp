@@ -3,6 +3,7 @@
  * @author Kevin Lundeen
  * @see "Seattle University, CPSC5300, Summer 2018"
  */
+#include <algorithm>
 #include <unordered_set>
 #include "SQLExec.h"
 
@@ -12,6 +13,7 @@ using namespace hsql;
 // define static data
 Tables* SQLExec::tables = nullptr;
 Indices* SQLExec::indices = nullptr;
+uint SQLExec::page_size = DbBlock::BLOCK_SZ;
 
 typedef std::vector<hsql::Expr*> exprnList;
 
@@ -104,50 +106,130 @@ QueryResult *SQLExec::execute(const SQLStatement *statement) throw(SQLExecError)
             default:
                 return new QueryResult("not implemented");
         }
+    } catch (SQLExecError& e) {
+        throw;
     } catch (DbRelationError& e) {
         throw SQLExecError(string("DbRelationError: ") + e.what());
+    } catch (exception& e) {
+        // Berkeley DB, memory, a row no page has room for: anything else would end the program here
+        throw SQLExecError(e.what());
+    }
+}
+
+void SQLExec::set_page_size(uint size) throw(SQLExecError) {
+	if (!DbBlock::is_valid_block_size(size))
+		throw SQLExecError("page size must be 4096, 8192, 16384, 32768 or 65536, not " + to_string(size));
+	SQLExec::page_size = size;
+}
+
+/**
+ * Execute a run of INSERT statements into the same table as one batch.
+ * @param statements  the Hyrise ASTs of the INSERT statements
+ * @returns           the query result (freed by caller)
+ */
+QueryResult *SQLExec::execute_inserts(const vector<const InsertStatement*> &statements) throw(SQLExecError) {
+
+	if (SQLExec::tables == nullptr)
+        SQLExec::tables = new Tables();
+	
+	if (SQLExec::indices == nullptr)
+		SQLExec::indices = new Indices();
+
+    try {
+        return insert(statements);
+    } catch (SQLExecError& e) {
+        throw;
+    } catch (DbRelationError& e) {
+        throw SQLExecError(string("DbRelationError: ") + e.what());
+    } catch (exception& e) {
+        // Berkeley DB, memory, a row no page has room for: anything else would end the program here
+        throw SQLExecError(e.what());
     }
 }
 
 /**
- * Get conjunction of equality predicate from parse tree
+ * Get conjunction of predicates from parse tree
  */
-ValueDict *SQLExec::get_where_conjunction(const hsql::Expr* expr) {
-	ValueDict *where = new ValueDict();
+Conjunction *SQLExec::get_where_conjunction(const hsql::Expr* expr) {
+	Conjunction *where = new Conjunction();
 
-	get_where_conjunction(expr, *where);
+	try {
+		get_where_conjunction(expr, *where);
+	} catch (...) {
+		delete where;
+		throw;
+	}
 	return where;
 
 }
 
 //Function Overriding
-void SQLExec::get_where_conjunction(const hsql::Expr* expr, ValueDict &where) {
-	if (expr->type == hsql::kExprOperator)
-	{
-		if (expr->opType == hsql::Expr::SIMPLE_OP) 
-		{
-			Value val;
-			Identifier identifier = expr->expr->name;
-			switch (expr->expr2->type) {
-			case hsql::kExprLiteralString: {
-				val = Value(expr->expr2->name);
-				break;
-			}
-			case hsql::kExprLiteralInt: {
-				val = Value(int32_t(expr->expr2->ival));
-				break;
-			}
-			default:
-				throw DbRelationError("Not yet implemented.");
-				break;
-			}
-			where[identifier] = Value(val);
-		}
-		else if (expr->opType == hsql::Expr::AND) // need to explain
-		{
-			get_where_conjunction(expr->expr, where);
-			get_where_conjunction(expr->expr2, where);
-		}
+void SQLExec::get_where_conjunction(const hsql::Expr* expr, Conjunction &where) {
+	if (expr->type != hsql::kExprOperator)
+		throw SQLExecError("where clause must be made of comparisons");
+
+	switch (expr->opType) {
+	case hsql::Expr::AND:
+		get_where_conjunction(expr->expr, where);
+		get_where_conjunction(expr->expr2, where);
+		return;
+	case hsql::Expr::BETWEEN:
+		// column BETWEEN low AND high
+		if (expr->expr->type != hsql::kExprColumnRef || expr->exprList == nullptr || expr->exprList->size() != 2)
+			throw SQLExecError("BETWEEN must compare a column to two constants");
+		where.push_back(Predicate(expr->expr->name, get_literal(expr->exprList->at(0)), get_literal(expr->exprList->at(1))));
+		return;
+	case hsql::Expr::IN: {
+		// column IN (constant, ...)
+		if (expr->expr->type != hsql::kExprColumnRef || expr->exprList == nullptr)
+			throw SQLExecError("IN must compare a column to a list of constants");
+		std::vector<Value> values;
+		for (auto const element : *expr->exprList)
+			values.push_back(get_literal(element));
+		where.push_back(Predicate(expr->expr->name, values));
+		return;
+	}
+	default:
+		break;
+	}
+
+	Predicate::Op op;
+	if (expr->opType == hsql::Expr::SIMPLE_OP && expr->opChar == '=')
+		op = Predicate::EQ;
+	else if (expr->opType == hsql::Expr::SIMPLE_OP && expr->opChar == '<')
+		op = Predicate::LT;
+	else if (expr->opType == hsql::Expr::SIMPLE_OP && expr->opChar == '>')
+		op = Predicate::GT;
+	else if (expr->opType == hsql::Expr::NOT_EQUALS)
+		op = Predicate::NE;
+	else if (expr->opType == hsql::Expr::LESS_EQ)
+		op = Predicate::LE;
+	else if (expr->opType == hsql::Expr::GREATER_EQ)
+		op = Predicate::GE;
+	else
+		throw SQLExecError("only =, <>, <, <=, >, >=, BETWEEN, IN, and AND are supported in a where clause");
+
+	// column op constant, or constant op column (which flips the comparison)
+	if (expr->expr->type == hsql::kExprColumnRef) {
+		where.push_back(Predicate(expr->expr->name, op, get_literal(expr->expr2)));
+	} else if (expr->expr2->type == hsql::kExprColumnRef) {
+		static const Predicate::Op flipped[] = {Predicate::EQ, Predicate::NE, Predicate::GT, Predicate::GE,
+												Predicate::LT, Predicate::LE};
+		where.push_back(Predicate(expr->expr2->name, flipped[op], get_literal(expr->expr)));
+	} else {
+		throw SQLExecError("a where clause comparison must have a column on one side");
+	}
+}
+
+// The value of a string or int literal
+Value SQLExec::get_literal(const hsql::Expr* expr) {
+	switch (expr->type) {
+	case hsql::kExprLiteralString:
+		return Value(expr->name);
+	case hsql::kExprLiteralInt:
+		return Value(int32_t(expr->ival));
+	default:
+		throw SQLExecError("only string and int constants are supported in a where clause");
 	}
 }
 
@@ -155,8 +237,17 @@ void SQLExec::get_where_conjunction(const hsql::Expr* expr, ValueDict &where) {
  * Insert row into table
  */
 QueryResult *SQLExec::insert(const InsertStatement *statement) {
+	vector<const InsertStatement*> statements;
+	statements.push_back(statement);
+	return insert(statements);
+}
+
+/**
+ * Insert the rows of several INSERT statements into their (common) table in one batch
+ */
+QueryResult *SQLExec::insert(const vector<const InsertStatement*> &statements) {
 	
-	Identifier table_name = statement->tableName;
+	Identifier table_name = statements.front()->tableName;
 
 	DbRelation& table = SQLExec::tables->get_table(table_name);
 
@@ -165,55 +256,132 @@ QueryResult *SQLExec::insert(const InsertStatement *statement) {
 
 	SQLExec::tables->get_columns(table_name, column_names, column_attributes);
 
-	// Begin constructing row for insert
-	ValueDict row;
-
-	uint i = 0;
-
-	// Sets columns of new row to specified datatype
-	if(statement->columns != NULL) {
-		for(i = 0; i < statement->columns->size(); i++){
-			Identifier col = statement->columns->at(i);
-			if(find(column_names.begin(), column_names.end(), col) != column_names.end()){
-				Expr* expr = statement->values->at(i);
-				switch(expr->type) {
-					case kExprLiteralString:
-						row[col] = Value(string(expr->name));
-						break;
-					case kExprLiteralFloat:
-						row[col] = Value(float(expr->fval));
-						break;
-					case kExprLiteralInt:
-						row[col] = Value(int(expr->ival));
-						break;
-					default:
-						throw SQLExecError("Not String, Float, or Int");
-						break;
-				}
-			} else {
-				throw SQLExecError("Unrecognized column type");
-			}
+	// Begin constructing rows for insert
+	ValueDicts rows;
+	try {
+		for (auto const statement : statements) {
+			if (table_name != statement->tableName)
+				throw SQLExecError("batched INSERTs must all be into " + table_name);
+			ValueDict *row = new ValueDict();
+			rows.push_back(row);
+			insert_row(statement, column_names, *row);
 		}
+	} catch (...) {
+		for (auto row : rows)
+			delete row;
+		throw;
 	}
 
-	Handle table_insert = table.insert(&row);
+	Handles* table_inserts;
+	try {
+		table_inserts = table.insert_batch(&rows);
+	} catch (...) {
+		for (auto row : rows)
+			delete row;
+		throw;
+	}
+	for (auto row : rows)
+		delete row;
 
-	// Add to index
-	ValueDict where;
-	where["table_name"] = Value(statement->tableName);
-	Handles* hand = SQLExec::indices->select(&where);
+	// Add to each index, the whole batch at once so it can go in in the index's own order
+	auto index_names = SQLExec::indices->get_index_names(table_name);
+	try {
+		for (auto const& index_name: index_names) {
+			DbIndex& index = SQLExec::indices->get_index(table_name, index_name);
+			index.open();
+			index.insert_batch(table_inserts);
+		}
+	} catch (...) {
+		delete table_inserts;
+		throw;
+	}
 
-	string retStmt = "Successfully inserted 1 row into " + table_name;
+	u_long n = table_inserts->size();
+	string retStmt = "Successfully inserted " + to_string(n) + (n == 1 ? " row" : " rows") + " into " + table_name;
 
-	u_long index_count = hand->size();
+	u_long index_count = index_names.size();
 
 	if(index_count > 0) {
 		retStmt += " and " + to_string(index_count) + " indices.";
 	}
 
+	delete table_inserts;
     return new QueryResult(retStmt); 
 }
 
+/**
+ * Set the columns of a new row from an INSERT statement to the specified values
+ */
+void SQLExec::insert_row(const InsertStatement *statement, const ColumnNames &column_names, ValueDict &row) {
+	if (statement->columns == NULL) {
+		// no column list, so values are in table column order
+		if (statement->values->size() != column_names.size())
+			throw SQLExecError("INSERT has " + to_string(statement->values->size()) + " values but " +
+							   statement->tableName + " has " + to_string(column_names.size()) + " columns");
+	} else if (statement->columns->size() != statement->values->size()) {
+		throw SQLExecError("INSERT has a different number of columns and values");
+	}
+
+	for(uint i = 0; i < statement->values->size(); i++){
+		Identifier col = statement->columns == NULL ? column_names.at(i) : Identifier(statement->columns->at(i));
+		if(find(column_names.begin(), column_names.end(), col) != column_names.end()){
+			Expr* expr = statement->values->at(i);
+			switch(expr->type) {
+				case kExprLiteralString:
+					row[col] = Value(string(expr->name));
+					break;
+				case kExprLiteralFloat:
+					row[col] = Value(float(expr->fval));
+					break;
+				case kExprLiteralInt:
+					row[col] = Value(int(expr->ival));
+					break;
+				default:
+					throw SQLExecError("Not String, Float, or Int");
+					break;
+			}
+		} else {
+			throw SQLExecError("Unrecognized column type");
+		}
+	}
+}
+
+/**
+ * One step of VACUUM: let the table reclaim space, then follow the rows it moved in every index
+ */
+bool SQLExec::vacuum(Identifier table_name, VacuumProgress &progress, uint blocks) throw(SQLExecError) {
+	if (SQLExec::tables == nullptr)
+		SQLExec::tables = new Tables();
+	if (SQLExec::indices == nullptr)
+		SQLExec::indices = new Indices();
+
+	try {
+		if (table_name == Tables::TABLE_NAME || table_name == Columns::TABLE_NAME || table_name == Indices::TABLE_NAME)
+			throw SQLExecError("cannot vacuum a schema table");
+		ColumnNames column_names;
+		ColumnAttributes column_attributes;
+		SQLExec::tables->get_columns(table_name, column_names, column_attributes);
+		if (column_names.empty())
+			throw SQLExecError("unknown table " + table_name);
+		DbRelation& table = SQLExec::tables->get_table(table_name);
+		Relocations moved;
+		bool done = table.vacuum(progress, blocks, moved);
+		for (auto const& index_name: SQLExec::indices->get_index_names(table_name)) {
+			DbIndex& index = SQLExec::indices->get_index(table_name, index_name);
+			index.open();
+			for (auto const& relocation: moved)
+				index.relocate(relocation.first, relocation.second);
+		}
+		return done;
+	} catch (SQLExecError& e) {
+		throw;
+	} catch (DbRelationError& e) {
+		throw SQLExecError(string("DbRelationError: ") + e.what());
+	} catch (exception& e) {
+		throw SQLExecError(e.what());
+	}
+}
+
 /**
  * Delete row from table
  */
@@ -227,10 +395,12 @@ QueryResult *SQLExec::del(const DeleteStatement *statement) {
 		plan = new EvalPlan(get_where_conjunction(statement->expr), plan);
 	}
 
-	EvalPlan *optimized = plan->optimize();
+	EvalPlan *optimized = plan->optimize(SQLExec::indices);
 	EvalPipeline pipe = optimized->pipeline();
 
 	auto index_names = SQLExec::indices->get_index_names(table_name);
+	for(auto const& index_name: index_names)
+		SQLExec::indices->get_index(table_name, index_name).open();
 
 	Handles *handles = pipe.second;
 
@@ -283,7 +453,7 @@ QueryResult *SQLExec::select(const SelectStatement *statement) {
 		plan = new EvalPlan(cn, plan); //Project specific cols
 	}
 
-	EvalPlan *optimized = plan->optimize();
+	EvalPlan *optimized = plan->optimize(SQLExec::indices);
 	ValueDicts *rows = optimized->evaluate();
 
 	cas = table.get_column_attributes(*cn);
@@ -454,8 +624,9 @@ QueryResult *SQLExec::create_index(const CreateStatement *statement) {
 	row["table_name"] = table_name;
 	row["index_name"] = index_name;
 	row["index_type"] = index_type;
-	row["is_unique"] = index_type == "BTREE" ? 1 : 0;
+	row["is_unique"] = 0;  // the parser has no CREATE UNIQUE INDEX, and B-trees take duplicate keys
 	row["is_unique"].data_type = ColumnAttribute::BOOLEAN;
+	row["page_size"] = Value((int32_t) SQLExec::page_size);
 	int sequence = 1;
 	Handles index_handles;
 	
@@ -498,6 +669,7 @@ QueryResult *SQLExec::create_table(const CreateStatement *statement) {
 	
 	ValueDict row;
 	row["table_name"] = table_name;
+	row["page_size"] = Value((int32_t) SQLExec::page_size);
 	Handle table_handle = SQLExec::tables->insert(&row);
 	
 	try
@@ -674,6 +846,7 @@ QueryResult *SQLExec::show_index(const ShowStatement *statement) {
 	column_names->push_back("column_name");
 	column_names->push_back("index_type");
 	column_names->push_back("is_unique");
+	column_names->push_back("page_size");
 	
 	ValueDict where;
 	where["table_name"] = table_name;
@@ -701,9 +874,11 @@ QueryResult *SQLExec::show_index(const ShowStatement *statement) {
 QueryResult *SQLExec::show_tables() {
 	ColumnNames* column_names = new ColumnNames();
 	column_names->push_back("table_name");
+	column_names->push_back("page_size");
 	
 	ColumnAttributes* column_attrbutes = new ColumnAttributes();
 	column_attrbutes->push_back(ColumnAttribute(ColumnAttribute::TEXT));
+	column_attrbutes->push_back(ColumnAttribute(ColumnAttribute::INT));
 	
 	Handles* handles = SQLExec::tables->select();
 	u_long n = handles->size() - 3;
@@ -62,10 +62,37 @@ public:
 	 */
     static QueryResult *execute(const hsql::SQLStatement *statement) throw(SQLExecError);
 
+	/**
+	 * Execute a run of INSERT statements into one table as a single batch,
+	 * so the table fills each page before storing it.
+	 * @param statements  the Hyrise ASTs of the INSERT statements (all into the same table)
+	 * @returns           the query result (freed by caller)
+	 */
+    static QueryResult *execute_inserts(const std::vector<const hsql::InsertStatement*> &statements) throw(SQLExecError);
+
+	/**
+	 * Set the page size later CREATE TABLE and CREATE INDEX statements create their files with.
+	 * @param size  page size in bytes (a power of two from 4 KB to 64 KB)
+	 * @throws      SQLExecError if size isn't one we can use
+	 */
+	static void set_page_size(uint size) throw(SQLExecError);
+	static uint get_page_size() { return page_size; }
+
+	/**
+	 * Do one step of VACUUM <table_name>, pointing the table's indices at the rows it moved.
+	 * Each step is meant to be a transaction of its own, so others get to run in between.
+	 * @param table_name  table to vacuum
+	 * @param progress    where the previous step left off (a new VacuumProgress to start); updated
+	 * @param blocks      about how many blocks the step may touch
+	 * @returns           true once the table is done
+	 */
+	static bool vacuum(Identifier table_name, VacuumProgress &progress, uint blocks) throw(SQLExecError);
+
 protected:
 	// the one place in the system that holds the _tables table
     static Tables *tables;
 	static Indices *indices;
+	static uint page_size;  // for files created from now on
 
 	// recursive decent into the AST
 	
@@ -166,12 +193,28 @@ protected:
 	 */
 	static void ensure_index_not_exist(const hsql::CreateStatement *statement);
 
-	static void get_where_conjunction(const hsql::Expr* expr, ValueDict &where);
+	static void get_where_conjunction(const hsql::Expr* expr, Conjunction &where);
+
+	/**
+	 * Pull the constant out of an AST literal
+	 * @param expr  AST literal (string or int)
+	 * @returns     its value
+	 */
+	static Value get_literal(const hsql::Expr* expr);
 
 	static QueryResult *insert(const hsql::InsertStatement *statement);
+	static QueryResult *insert(const std::vector<const hsql::InsertStatement*> &statements);
+
+	/**
+	 * Build the row for one INSERT statement
+	 * @param statement     AST insert statement
+	 * @param column_names  columns of the target table, in order
+	 * @param row           returned by reference
+	 */
+	static void insert_row(const hsql::InsertStatement *statement, const ColumnNames &column_names, ValueDict &row);
     static QueryResult *del(const hsql::DeleteStatement *statement);
     static QueryResult *select(const hsql::SelectStatement *statement);
-    static ValueDict *get_where_conjunction(const hsql::Expr* expr);
+    static Conjunction *get_where_conjunction(const hsql::Expr* expr);
 
 };
 
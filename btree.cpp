@@ -1,21 +1,23 @@
 #include "btree.h"
+#include <algorithm>
 #include <iostream>
+#include "task_scheduler.h"
 using namespace std;
 
 /**
  * B+ Tree index
  */
-BTreeIndex::BTreeIndex(DbRelation& relation, Identifier name, ColumnNames key_columns, bool unique)
+BTreeIndex::BTreeIndex(DbRelation& relation, Identifier name, ColumnNames key_columns, bool unique, uint block_size)
 	: DbIndex(relation, name, key_columns, unique),
 	closed(true),
 	stat(nullptr),
 	root(nullptr),
-	file(relation.get_table_name() + "-" + name),
-	key_profile() {
+	file(relation.get_table_name() + "-" + name, block_size),
+	key_profile(),
+	fill_percent(DEFAULT_FILL_PERCENT),
+	deferred_merge(0),
+	deferred_deletes(0) {
 
-	if (!unique)
-		throw DbRelationError("BTree index must have unique key");
-	// FIXME - what else?!
 	build_key_profile();
 }
 
@@ -55,26 +57,167 @@ void BTreeIndex::create() {
 
 	file.create();
 	stat = new BTreeStat(this->file, this->STAT, this->STAT + 1, this->key_profile);
-	root = new BTreeLeaf(this->file, this->stat->get_root_id(), this->key_profile, true);
 	closed = false;
 
-	Handles* handles = relation.select();
-	Handles* new_handles = new Handles();
-
 	try {
-		for (auto const handle : *handles){
-			insert(handle);
-			new_handles->push_back(handle);
-		}
+		bulk_load();
 	}
 	catch (DbRelationError) {
 		file.drop();
 		throw;
 	}
+}
 
-	delete handles;
-	delete new_handles;
-	// FIXME
+/**
+ * Build the tree bottom-up from the relation's current rows: one scan for the
+ * (key, handle) pairs, sort them, and build() over each key with all its handles.
+ */
+void BTreeIndex::bulk_load() {
+
+	Handles handles;
+	ValueDicts* rows = relation.scan(&key_columns, &handles);
+	std::vector<std::pair<KeyValue, Handle>> entries;
+	entries.reserve(rows->size());
+	for (u_long i = 0; i < rows->size(); i++) {
+		KeyValue* kv = tkey((*rows)[i]);
+		entries.push_back(std::make_pair(*kv, handles[i]));
+		delete kv;
+		delete (*rows)[i];
+	}
+	delete rows;
+
+	parallel_sort(entries.begin(), entries.end(),
+		[](const std::pair<KeyValue, Handle>& a, const std::pair<KeyValue, Handle>& b) { return a < b; });
+	if (unique)
+		for (u_long i = 1; i < entries.size(); i++)
+			if (entries[i - 1].first == entries[i].first)
+				throw DbRelationError("Duplicate keys are not allowed in unique index");
+
+	Entries keys;
+	for (u_long i = 0; i < entries.size(); ) {
+		keys.push_back(std::make_pair(entries[i].first, Postings()));
+		Postings& postings = keys.back().second;
+		for (; i < entries.size() && entries[i].first == keys.back().first; i++)
+			postings.handles.push_back(entries[i].second);
+		postings.count = (uint) postings.handles.size();
+	}
+	entries.clear();
+	entries.shrink_to_fit();
+	build(keys);
+}
+
+/**
+ * Pack the entries (in key order) into leaves left to right, then each level of
+ * interior nodes over the one below it, writing every node once, and make the
+ * top one the root.
+ */
+void BTreeIndex::build(const Entries& entries) {
+
+	typedef std::pair<KeyValue, BlockID> LowKey;  // a node and the smallest key under it
+
+	// leaves
+	std::vector<LowKey> level;
+	BTreeLeaf* leaf = new BTreeLeaf(file, stat->allocate(), key_profile, true);
+	level.push_back(LowKey(KeyValue(), leaf->get_id()));
+	for (auto const& entry : entries) {
+		if (!leaf->append(&entry.first, entry.second, fill_percent, *stat)) {
+			BTreeLeaf* next = new BTreeLeaf(file, stat->allocate(), key_profile, true);
+			leaf->set_next_leaf(next->get_id());
+			leaf->save();
+			delete leaf;
+			leaf = next;
+			level.push_back(LowKey(entry.first, leaf->get_id()));
+			leaf->append(&entry.first, entry.second, fill_percent, *stat);
+		}
+	}
+	leaf->save();
+	delete leaf;
+
+	// interior levels until only the root is left
+	uint height = 1;
+	while (level.size() > 1) {
+		std::vector<LowKey> parents;
+		BTreeInterior* node = new BTreeInterior(file, stat->allocate(), key_profile, true);
+		node->set_first(level[0].second);
+		parents.push_back(LowKey(level[0].first, node->get_id()));
+		for (u_long i = 1; i < level.size(); i++) {
+			if (!node->append(&level[i].first, level[i].second, fill_percent)) {
+				node->save();
+				delete node;
+				node = new BTreeInterior(file, stat->allocate(), key_profile, true);
+				node->set_first(level[i].second);
+				parents.push_back(LowKey(level[i].first, node->get_id()));
+			}
+		}
+		node->save();
+		delete node;
+		level.swap(parents);
+		height++;
+	}
+
+	stat->set_root_id(level[0].second);
+	stat->set_height(height);
+	stat->save();
+
+	if (height == 1)
+		root = new BTreeLeaf(file, stat->get_root_id(), key_profile, false);
+	else
+		root = new BTreeInterior(file, stat->get_root_id(), key_profile, false);
+}
+
+/**
+ * Set how full create() and rebalance() pack the leaf and interior nodes.
+ */
+void BTreeIndex::set_fill_percent(uint fill_percent) {
+	if (fill_percent == 0 || fill_percent > 100)
+		throw DbRelationError("BTree fill factor must be between 1 and 100 percent");
+	this->fill_percent = fill_percent;
+}
+
+/**
+ * Choose between merging under-full nodes as del() makes them (deletes = 0, the
+ * default) and leaving them be, so a delete only rewrites its leaf, with a
+ * rebalance() after every so many deletes to tidy up after them.
+ */
+void BTreeIndex::set_deferred_merge(uint deletes) {
+	this->deferred_merge = deletes;
+	this->deferred_deletes = 0;
+}
+
+/**
+ * Rebuild the tree over the entries in its leaves, packed fill_percent full.
+ * The old nodes go on the free list first, so the new ones mostly reuse their
+ * blocks; posting lists in overflow chains stay where they are.
+ */
+void BTreeIndex::rebalance() {
+	Entries entries;
+	BlockIDs level(1, stat->get_root_id());
+	delete root;
+	root = nullptr;
+
+	// interior nodes a level at a time, down to the leaves (left to right)
+	for (uint height = stat->get_height(); height > 1; height--) {
+		BlockIDs children;
+		for (auto const& block_id : level) {
+			{
+				BTreeInterior node(file, block_id, key_profile, false);
+				for (uint i = 0; i < node.get_child_count(); i++)
+					children.push_back(node.get_child(i));
+			}
+			stat->release(block_id);
+		}
+		level.swap(children);
+	}
+	for (auto const& block_id : level) {
+		{
+			BTreeLeaf leaf(file, block_id, key_profile, false);
+			entries.insert(entries.end(), leaf.get_key_map().begin(), leaf.get_key_map().end());
+		}
+		stat->release(block_id);
+	}
+
+	build(entries);
+	deferred_deletes = 0;
 }
 
 
@@ -123,7 +266,10 @@ void BTreeIndex::close() {
  * Returns a list of row handles.
  */
 Handles* BTreeIndex::lookup(ValueDict* key_dict) const {
-	return _lookup(root, stat->get_height(), tkey(key_dict));
+	KeyValue* key = tkey(key_dict);
+	Handles* handles = _lookup(root, stat->get_height(), key);
+	delete key;
+	return handles;
 }
 
 /**
@@ -131,21 +277,17 @@ Handles* BTreeIndex::lookup(ValueDict* key_dict) const {
  */ 
 Handles* BTreeIndex::_lookup(BTreeNode* node, uint height, const KeyValue* key) const {
 
-	Handles* handles = new Handles;
-	
 	if (height == 1) {
 		//Base Case
-		try {
-			BTreeLeaf* leaf_node = (BTreeLeaf*)node;
-			handles->push_back(leaf_node->find_eq(key));
-		}
-		catch (std::out_of_range) {}
-
-		return handles;
+		BTreeLeaf* leaf_node = (BTreeLeaf*)node;
+		return leaf_node->find_eq(key);
 	} else {
 		//recursive call
 		BTreeInterior* interior_node = (BTreeInterior*)node;
-		return _lookup(interior_node->find(key, this->stat->get_height()), this->stat->get_height() - 1, key);
+		BTreeNode* child = interior_node->find(key, height);
+		Handles* handles = _lookup(child, height - 1, key);
+		delete child;
+		return handles;
 	}
 }
 
@@ -154,53 +296,89 @@ Handles* BTreeIndex::_lookup(BTreeNode* node, uint height, const KeyValue* key)
  */
 void BTreeIndex::insert(Handle handle) {
 
-	KeyValue* kv = tkey(relation.project(handle, &key_columns));
+	ValueDict* row = relation.project(handle, &key_columns);
+	KeyValue* kv = tkey(row);
+	delete row;
+
+	Insertion split_root = _insert(this->root, this->stat->get_height(), kv, handle, nullptr);
+	delete kv;
+	grow(split_root);
+}
+
+/**
+ * Insert a batch of rows in key order, so the ones that go in the same leaf come one
+ * after another and find it, and the path down to it, still in the buffer pool.
+ */
+void BTreeIndex::insert_batch(const Handles* handles) {
+	std::vector<std::pair<KeyValue, Handle>> entries;
+	entries.reserve(handles->size());
+	for (auto const& handle : *handles) {
+		ValueDict* row = relation.project(handle, &key_columns);
+		KeyValue* kv = tkey(row);
+		delete row;
+		entries.push_back(std::make_pair(*kv, handle));
+		delete kv;
+	}
+	std::sort(entries.begin(), entries.end());
 
-	Insertion split_root = _insert(this->root, this->stat->get_height(), kv, handle);
+	for (auto const& entry : entries)
+		grow(_insert(this->root, this->stat->get_height(), &entry.first, entry.second, nullptr));
+}
 
-	// If root is split, increase height
+/**
+ * If the root was split, put a new root over it and its sister.
+ */
+void BTreeIndex::grow(const Insertion& split_root) {
 	if (!BTreeNode::insertion_is_none(split_root)) {
 		BlockID rroot = split_root.first;
 		KeyValue boundary = split_root.second;
 
-		BTreeInterior *root1 = new BTreeInterior(file, 0, key_profile, true);
+		BTreeInterior *root1 = new BTreeInterior(file, stat->allocate(), key_profile, true);
 
 		root1->set_first(root->get_id());
-		root1->insert(&boundary, rroot);
+		root1->insert(&boundary, rroot, *stat);
 		root1->save();
 
 		stat->set_root_id(root1->get_id());
 		stat->set_height(stat->get_height() + 1);
 
 		stat->save();
+		delete root;
 		root = root1;
 	}
 }
 
 /**
- * Recursive insert.
+ * Recursive insert (or, given from, move of the entry for from to handle).
  * If a node is split during insert, return new node and boundary
  * of the split.
  */
-Insertion BTreeIndex::_insert(BTreeNode* node, uint height, const KeyValue* key, Handle handle) {
+Insertion BTreeIndex::_insert(BTreeNode* node, uint height, const KeyValue* key, Handle handle, const Handle* from) {
 	
 	Insertion insertion;
 
 	//Base Case: Leaf node
 	if (height == 1) {
 		BTreeLeaf* leafNode = (BTreeLeaf*)node;
-		insertion = leafNode->insert(key, handle);
-		leafNode->save();
-		return insertion;
+		if (from == nullptr)
+			return leafNode->insert(key, handle, this->unique, *stat);
+		return leafNode->relocate(key, *from, handle, *stat);
 	}
 
 	// Recursive case
 	BTreeInterior* interior = (BTreeInterior*)node;
-	insertion = _insert(interior->find(key, height), height - 1, key, handle); //Recursive Call
+	BTreeNode* child = interior->find(key, height);
+	try {
+		insertion = _insert(child, height - 1, key, handle, from); //Recursive Call
+	} catch (...) {
+		delete child;
+		throw;
+	}
+	delete child;
 
 	// Split handled automatically, no need to check if node is too full
 	if (!BTreeNode::insertion_is_none(insertion)) {
-		insertion = interior->insert(&insertion.second, insertion.first);
+		insertion = interior->insert(&insertion.second, insertion.first, *stat);
 		interior->save();
 	}
 
@@ -221,20 +399,252 @@ KeyValue *BTreeIndex::tkey(const ValueDict *key) const {
 }
 
 /**
- * Not implemented
+ * Delete the entry for a row (which must still be in the relation). A node left
+ * less than MERGE_PERCENT full is merged with a sister, or evened out with her if
+ * the two won't fit in one block, which can leave its parent under-full in turn;
+ * a root left with one child gives way to it, so the tree gets shorter. With
+ * set_deferred_merge(), under-full nodes wait for the next rebalance() instead.
  */
 void BTreeIndex::del(Handle handle) {
-    throw DbRelationError("Don't know how to delete from a BTree index yet");
-	// FIXME: Not in scope of M6
+	ValueDict* row = relation.project(handle, &key_columns);
+	KeyValue* kv = tkey(row);
+	delete row;
+
+	try {
+		_del(this->root, this->stat->get_height(), kv, handle);
+	} catch (...) {
+		delete kv;
+		throw;
+	}
+	delete kv;
+
+	if (this->deferred_merge == 0)
+		shrink();
+	else if (++this->deferred_deletes >= this->deferred_merge)
+		rebalance();
+}
+
+/**
+ * Recursive delete.
+ * Returns whether the node is left under-full.
+ */
+bool BTreeIndex::_del(BTreeNode* node, uint height, const KeyValue* key, Handle handle) {
+
+	//Base Case: Leaf node
+	if (height == 1) {
+		BTreeLeaf* leaf = (BTreeLeaf*)node;
+		leaf->remove(key, handle, *stat);
+		return underfull(leaf->size());
+	}
+
+	// Recursive case
+	BTreeInterior* interior = (BTreeInterior*)node;
+	uint child_index = interior->find_child(key);
+	BTreeNode* child = interior->find(key, height);
+	bool merge;
+	try {
+		merge = _del(child, height - 1, key, handle);
+	} catch (...) {
+		delete child;
+		throw;
+	}
+	delete child;
+
+	if (!merge || this->deferred_merge != 0)
+		return false;
+	merge_child(interior, child_index, height);
+	return underfull(interior->size());
+}
+
+/**
+ * Merge parent's under-full child with a sister (the next one, or for the last
+ * child, the one before), or if they won't fit in one block, share their entries
+ * out evenly between them. Saves parent.
+ */
+void BTreeIndex::merge_child(BTreeInterior* parent, uint child, uint height) {
+	if (parent->get_child_count() < 2)
+		return;  // no sister (its own parent will merge it away)
+	uint left = child + 1 < parent->get_child_count() ? child : child - 1;
+	BlockID right_id = parent->get_child(left + 1);
+	bool merged;
+
+	if (height == 2) {
+		BTreeLeaf* lnode = new BTreeLeaf(file, parent->get_child(left), key_profile, false);
+		BTreeLeaf* rnode = new BTreeLeaf(file, right_id, key_profile, false);
+		lnode->absorb(rnode);
+		merged = lnode->size() <= file.get_block_size();
+		if (!merged) {
+			parent->set_boundary(left, lnode->share(rnode));
+			rnode->save();
+		}
+		lnode->save();
+		delete lnode;
+		delete rnode;
+	} else {
+		BTreeInterior* lnode = new BTreeInterior(file, parent->get_child(left), key_profile, false);
+		BTreeInterior* rnode = new BTreeInterior(file, right_id, key_profile, false);
+		lnode->absorb(rnode, parent->get_boundary(left));
+		merged = lnode->size() <= file.get_block_size();
+		if (!merged) {
+			parent->set_boundary(left, lnode->share(rnode));
+			rnode->save();
+		}
+		lnode->save();
+		delete lnode;
+		delete rnode;
+	}
+
+	if (merged) {
+		parent->remove_child(left + 1);
+		stat->release(right_id);
+	}
+	parent->save();
+}
+
+/**
+ * While the root is an interior node with only one child, make the child the root.
+ */
+void BTreeIndex::shrink() {
+	while (stat->get_height() > 1 && ((BTreeInterior*)root)->get_child_count() == 1) {
+		BlockID old_root = root->get_id();
+		BlockID new_root = ((BTreeInterior*)root)->get_first();
+		delete root;
+		stat->set_root_id(new_root);
+		stat->set_height(stat->get_height() - 1);
+		stat->save();
+		if (stat->get_height() == 1)
+			root = new BTreeLeaf(file, new_root, key_profile, false);
+		else
+			root = new BTreeInterior(file, new_root, key_profile, false);
+		stat->release(old_root);
+	}
 }
 
 /**
- * Not implemented
+ * Point the entry of a row that moved at its new handle. The key, and so the path
+ * to it, is the same as before, but the new handle may take more room in the key's
+ * posting list, so the leaf can split as it does for an insert.
+ */
+void BTreeIndex::relocate(Handle from, Handle to) {
+	ValueDict* row = relation.project(to, &key_columns);
+	KeyValue* kv = tkey(row);
+	delete row;
+
+	Insertion split_root;
+	try {
+		split_root = _insert(this->root, this->stat->get_height(), kv, to, &from);
+	} catch (...) {
+		delete kv;
+		throw;
+	}
+	delete kv;
+	grow(split_root);
+}
+
+/**
+ * Find rows whose keys are between min_key and max_key (inclusive).
+ * Returns a list of row handles in key order.
  */
 Handles* BTreeIndex::range(ValueDict* min_key, ValueDict* max_key) const {
-	throw DbRelationError("Don't know how to do a range query on Btree index yet");
-	// FIXME
+	DbIndexCursor* cursor = range_cursor(min_key, max_key);
+	Handles* handles = new Handles();
+	Handle handle;
+	while (cursor->next(handle))
+		handles->push_back(handle);
+	delete cursor;
+	return handles;
+}
+
+/**
+ * Stream the rows whose keys are between min_key and max_key (inclusive);
+ * either bound may be nullptr for an open-ended range.
+ */
+DbIndexCursor* BTreeIndex::range_cursor(ValueDict* min_key, ValueDict* max_key) const {
+	KeyValue* min_kv = min_key == nullptr ? nullptr : tkey(min_key);
+	KeyValue* max_kv = max_key == nullptr ? nullptr : tkey(max_key);
+	BTreeLeaf* leaf = find_leaf(min_kv);
+	DbIndexCursor* cursor = new BTreeRangeCursor(file, key_profile, leaf, min_kv, max_kv);
+	delete min_kv;
+	delete max_kv;
+	return cursor;
 }
 
+/**
+ * Descend to the leaf where key belongs (the leftmost leaf if key is nullptr).
+ * Returns a leaf of its own, not the root (freed by caller).
+ */
+BTreeLeaf* BTreeIndex::find_leaf(const KeyValue* key) const {
+	uint height = stat->get_height();
+	if (height == 1)
+		return new BTreeLeaf(file, root->get_id(), key_profile, false);
+
+	BTreeInterior* node = (BTreeInterior*)root;
+	while (true) {
+		BTreeNode* child;
+		if (key == nullptr)
+			child = height == 2 ? (BTreeNode*)new BTreeLeaf(file, node->get_first(), key_profile, false)
+			                    : (BTreeNode*)new BTreeInterior(file, node->get_first(), key_profile, false);
+		else
+			child = node->find(key, height);
+		if (node != root)
+			delete node;
+		if (--height == 1)
+			return (BTreeLeaf*)child;
+		node = (BTreeInterior*)child;
+	}
+}
 
+/**
+ * BTreeRangeCursor
+ */
+BTreeRangeCursor::BTreeRangeCursor(HeapFile &file, const KeyProfile& key_profile, BTreeLeaf *leaf,
+		const KeyValue *min_key, const KeyValue *max_key)
+	: file(file), key_profile(key_profile), leaf(leaf), it(),
+	max_key(max_key == nullptr ? nullptr : new KeyValue(*max_key)), handles(), position(0), overflow(0) {
+
+	if (min_key == nullptr)
+		it = leaf->get_key_map().begin();
+	else
+		it = leaf->get_key_map().lower_bound(*min_key);
+}
 
+BTreeRangeCursor::~BTreeRangeCursor() {
+	delete leaf;
+	delete max_key;
+}
+
+bool BTreeRangeCursor::next(Handle &handle) {
+	while (position == handles.size()) {
+		if (overflow != 0) {
+			// on to the next block of the entry's overflow chain
+			BTreeOverflow page(file, overflow, key_profile, false);
+			handles.swap(page.get_handles());
+			overflow = page.get_next();
+			position = 0;
+			continue;
+		}
+		while (leaf != nullptr && it == leaf->get_key_map().end()) {
+			// this leaf is used up, so move along the chain
+			BlockID next_leaf = leaf->get_next_leaf();
+			delete leaf;
+			leaf = nullptr;
+			if (next_leaf != 0) {
+				leaf = new BTreeLeaf(file, next_leaf, key_profile, false);
+				it = leaf->get_key_map().begin();
+			}
+		}
+		if (leaf == nullptr)
+			return false;
+		if (max_key != nullptr && *max_key < it->first) {
+			delete leaf;
+			leaf = nullptr;
+			return false;
+		}
+		handles = it->second.handles;
+		overflow = it->second.overflow;
+		position = 0;
+		++it;
+	}
+	handle = handles[position++];
+	return true;
+}
@@ -5,7 +5,11 @@
 
 class BTreeIndex : public DbIndex {
 public:
-    BTreeIndex(DbRelation& relation, Identifier name, ColumnNames key_columns, bool unique);
+    static const uint DEFAULT_FILL_PERCENT = 90;  // how full create() packs each node
+    static const uint MERGE_PERCENT = 40;  // del() merges (or evens out) a node once it's less full than this
+
+    BTreeIndex(DbRelation& relation, Identifier name, ColumnNames key_columns, bool unique,
+               uint block_size=DbBlock::BLOCK_SZ);
     virtual ~BTreeIndex();
 
     virtual void create();
@@ -16,23 +20,76 @@ public:
 
     virtual Handles* lookup(ValueDict* key) const;
     virtual Handles* range(ValueDict* min_key, ValueDict* max_key) const;
+    virtual DbIndexCursor* range_cursor(ValueDict* min_key, ValueDict* max_key) const;
 
     virtual void insert(Handle handle);
+    virtual void insert_batch(const Handles* handles);
     virtual void del(Handle handle);
+    virtual void relocate(Handle from, Handle to);
 
     virtual KeyValue *tkey(const ValueDict *key) const; // pull out the key values from the ValueDict in order
 
+    void set_fill_percent(uint fill_percent);  // for later create() and rebalance() calls; 1 to 100
+    void set_deferred_merge(uint deletes);  // 0: del() merges as it goes; else rebalance() every so many deletes
+    void rebalance();  // rebuild the tree packed fill_percent full
+
+    // statistics
+    uint get_height() const { return this->stat->get_height(); }
+
 protected:
     static const BlockID STAT = 1;
     bool closed;
     BTreeStat *stat;
     BTreeNode *root;
-    HeapFile file;
+    mutable HeapFile file;  // lookups only pin and read blocks
     KeyProfile key_profile;
+    uint fill_percent;
+    uint deferred_merge;
+    uint deferred_deletes;  // since the last rebalance()
+
+    typedef std::vector<std::pair<KeyValue, Postings>> Entries;
 
     void build_key_profile();
+    void bulk_load();
+    void build(const Entries& entries);
+    BTreeLeaf* find_leaf(const KeyValue* key) const;
     Handles* _lookup(BTreeNode *node, uint height, const KeyValue* key) const;
-    Insertion _insert(BTreeNode *node, uint height, const KeyValue* key, Handle handle);
+    Insertion _insert(BTreeNode *node, uint height, const KeyValue* key, Handle handle, const Handle* from);
+    void grow(const Insertion& split_root);
+    bool _del(BTreeNode *node, uint height, const KeyValue* key, Handle handle);
+    void merge_child(BTreeInterior *parent, uint child, uint height);
+    void shrink();
+    bool underfull(uint size) const { return size < this->file.get_block_size() * MERGE_PERCENT / 100; }
+};
+
+/**
+ * @class BTreeRangeCursor - BTreeIndex implementation of DbIndexCursor
+ *
+ * Starts at the leaf where the min key would be and follows the next_leaf chain,
+ * handing out one handle at a time until it passes the max key. Only the current
+ * leaf is held (pinned) at any time, and a key's overflow chain is read a block at a time.
+ */
+class BTreeRangeCursor : public DbIndexCursor {
+public:
+    BTreeRangeCursor(HeapFile &file, const KeyProfile& key_profile, BTreeLeaf *leaf,
+                     const KeyValue *min_key, const KeyValue *max_key);
+    virtual ~BTreeRangeCursor();
+    BTreeRangeCursor(const BTreeRangeCursor& other) = delete;
+    BTreeRangeCursor(BTreeRangeCursor&& temp) = delete;
+    BTreeRangeCursor& operator=(const BTreeRangeCursor& other) = delete;
+    BTreeRangeCursor& operator=(BTreeRangeCursor&& temp) = delete;
+
+    virtual bool next(Handle &handle);
+
+protected:
+    HeapFile &file;
+    const KeyProfile& key_profile;
+    BTreeLeaf *leaf;                                 // nullptr once the scan is done
+    std::map<KeyValue,Postings>::const_iterator it;  // next entry in leaf
+    KeyValue *max_key;                               // nullptr if unbounded
+    Handles handles;                                 // the current entry's (or overflow block's) handles
+    u_long position;                                 // next of them to hand out
+    BlockID overflow;                                // the entry's next overflow block, if any
 };
 
 bool test_btree();
@@ -0,0 +1,187 @@
+/**
+ * @file buffer_pool.cpp - implementation of BufferFrame and BufferPool
+ *
+ * @see "Seattle University, CPSC5300, Summer 2018"
+ */
+#include "buffer_pool.h"
+#include <cstring>
+#include "heap_storage.h"
+
+using namespace std;
+
+/**
+ * @class BufferFrame - one slot of the buffer pool
+ */
+
+BufferFrame::BufferFrame() : data(new char[DbBlock::BLOCK_SZ]), size(DbBlock::BLOCK_SZ), file_name(""), file(nullptr),
+		block_id(0), pin_count(0), dirty(false), referenced(false) {
+}
+
+BufferFrame::~BufferFrame() {
+	delete[] data;
+}
+
+/**
+ * @class BufferPool - fixed-size pool of block frames with CLOCK eviction
+ */
+
+BufferPool& BufferPool::instance() {
+	static BufferPool pool;
+	return pool;
+}
+
+BufferPool::BufferPool(uint num_frames) : frames(), page_table(), clock_hand(0),
+		hits(0), misses(0), evictions(0), writes(0) {
+	for (uint i = 0; i < num_frames; i++)
+		frames.push_back(new BufferFrame());
+}
+
+// write back whatever is still dirty, then free the frames
+BufferPool::~BufferPool() {
+	checkpoint();
+	for (auto frame: frames)
+		delete frame;
+}
+
+// find the block in the pool or bring it in, evicting an unpinned frame if needed
+BufferFrame* BufferPool::pin(HeapFile *file, BlockID block_id, bool no_read) {
+	lock_guard<recursive_mutex> guard(this->latch);
+	BufferFrame *frame = pin_if_resident(file, block_id);
+	if (frame != nullptr)
+		return frame;
+
+	this->misses++;
+	frame = victim();
+	if (frame->size != file->block_size) {
+		// the file's pages are a different size than the last block the frame held
+		delete[] frame->data;
+		frame->data = new char[file->block_size];
+		frame->size = file->block_size;
+	}
+	if (no_read) {
+		memset(frame->data, 0, frame->size);
+	} else {
+		file->read_block(block_id, frame->data);
+	}
+	frame->file_name = file->dbfilename;
+	frame->file = file;
+	frame->block_id = block_id;
+	frame->pin_count = 1;
+	frame->dirty = false;
+	frame->referenced = true;
+	this->page_table[PageKey(frame->file_name, block_id)] = frame;
+	return frame;
+}
+
+// pin the block if we already have it, otherwise do nothing
+BufferFrame* BufferPool::pin_if_resident(HeapFile *file, BlockID block_id) {
+	lock_guard<recursive_mutex> guard(this->latch);
+	auto it = this->page_table.find(PageKey(file->dbfilename, block_id));
+	if (it == this->page_table.end())
+		return nullptr;
+	BufferFrame *frame = it->second;
+	this->hits++;
+	frame->pin_count++;
+	frame->referenced = true;
+	return frame;
+}
+
+void BufferPool::unpin(BufferFrame *frame) {
+	lock_guard<recursive_mutex> guard(this->latch);
+	if (frame->pin_count > 0)
+		frame->pin_count--;
+}
+
+void BufferPool::mark_dirty(BufferFrame *frame, HeapFile *file) {
+	lock_guard<recursive_mutex> guard(this->latch);
+	frame->dirty = true;
+	frame->file = file;  // write back through whichever handle changed it last
+}
+
+void BufferPool::flush(HeapFile *file) {
+	lock_guard<recursive_mutex> guard(this->latch);
+	for (auto frame: this->frames)
+		if (frame->dirty && frame->file_name == file->dbfilename)
+			write_back(frame);
+}
+
+// drop the file's frames on the floor; frames still pinned just stop being findable
+void BufferPool::discard(HeapFile *file) {
+	lock_guard<recursive_mutex> guard(this->latch);
+	for (auto frame: this->frames)
+		if (frame->file_name == file->dbfilename)
+			forget(frame);
+}
+
+void BufferPool::discard(HeapFile *file, BlockID from) {
+	lock_guard<recursive_mutex> guard(this->latch);
+	for (auto frame: this->frames)
+		if (frame->file_name == file->dbfilename && frame->block_id >= from)
+			forget(frame);
+}
+
+void BufferPool::discard_dirty() {
+	lock_guard<recursive_mutex> guard(this->latch);
+	for (auto frame: this->frames)
+		if (frame->dirty)
+			forget(frame);
+}
+
+void BufferPool::release(HeapFile *file) {
+	lock_guard<recursive_mutex> guard(this->latch);
+	for (auto frame: this->frames) {
+		if (frame->file != file)
+			continue;
+		if (frame->dirty)
+			write_back(frame);
+		frame->file = nullptr;
+	}
+}
+
+void BufferPool::checkpoint() {
+	lock_guard<recursive_mutex> guard(this->latch);
+	for (auto frame: this->frames)
+		if (frame->dirty)
+			write_back(frame);
+}
+
+// CLOCK: sweep the frames, giving referenced ones a second chance, until an unpinned one turns up
+BufferFrame* BufferPool::victim() {
+	uint n = (uint) this->frames.size();
+	for (uint sweep = 0; sweep < 2 * n; sweep++) {
+		BufferFrame *frame = this->frames[this->clock_hand];
+		this->clock_hand = (this->clock_hand + 1) % n;
+		if (frame->pin_count > 0)
+			continue;
+		if (frame->referenced) {
+			frame->referenced = false;
+			continue;
+		}
+		if (frame->dirty)
+			write_back(frame);
+		if (!frame->file_name.empty())
+			this->evictions++;
+		forget(frame);
+		return frame;
+	}
+	throw DbRelationError("buffer pool exhausted: all " + to_string(n) + " frames are pinned");
+}
+
+void BufferPool::write_back(BufferFrame *frame) {
+	if (frame->file != nullptr && !frame->file_name.empty()) {
+		frame->file->write_block(frame->block_id, frame->data);
+		this->writes++;
+	}
+	frame->dirty = false;
+}
+
+// take the frame out of the page table (its contents become garbage)
+void BufferPool::forget(BufferFrame *frame) {
+	if (!frame->file_name.empty())
+		this->page_table.erase(PageKey(frame->file_name, frame->block_id));
+	frame->file_name = "";
+	frame->file = nullptr;
+	frame->block_id = 0;
+	frame->dirty = false;
+	frame->referenced = false;
+}
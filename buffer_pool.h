@@ -0,0 +1,163 @@
+/**
+ * @file buffer_pool.h - buffer manager sitting between HeapFile and its callers.
+ * BufferFrame
+ * BufferPool
+ *
+ * @see "Seattle University, CPSC5300, Summer 2018"
+ */
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include "storage_engine.h"
+
+class HeapFile;  // forward declare
+
+/**
+ * @class BufferFrame - one slot of the buffer pool
+ *
+ * Holds a single cached block along with its bookkeeping. Frames are handed
+ * out pinned by BufferPool::pin() and must be given back with BufferPool::unpin().
+ * The memory is resized when the frame is reused for a file with a different page size.
+ */
+class BufferFrame {
+public:
+	BufferFrame();
+	virtual ~BufferFrame();
+	BufferFrame(const BufferFrame& other) = delete;
+	BufferFrame(BufferFrame&& temp) = delete;
+	BufferFrame& operator=(const BufferFrame& other) = delete;
+	BufferFrame& operator=(BufferFrame&& temp) = delete;
+
+	char *data;             // size bytes of block memory
+	uint size;              // page size of the file of the block it holds (or last held)
+	std::string file_name;  // which database file the block belongs to ("" if the frame is free)
+	HeapFile *file;         // handle used to write the block back when it is dirty
+	BlockID block_id;
+	uint pin_count;
+	bool dirty;
+	bool referenced;        // CLOCK reference bit
+};
+
+/**
+ * @class BufferPool - fixed-size pool of block frames with CLOCK eviction
+ *
+ * HeapFile::get() pins the requested block here (reading it from Berkeley DB
+ * only on a miss) and HeapFile::put() just marks the frame dirty. Dirty frames
+ * are written back when they are evicted, when their file is flushed or closed,
+ * and on checkpoint(). Every operation holds the pool's latch, so worker threads
+ * can pin and unpin concurrently; misses and write-backs do their Berkeley DB I/O
+ * under the latch too.
+ * 	pin(file, block_id)
+ * 	unpin(frame)
+ * 	mark_dirty(frame)
+ * 	flush(file)
+ * 	discard(file)
+ * 	discard_dirty()
+ * 	checkpoint()
+ */
+class BufferPool {
+public:
+	/**
+	 * Number of frames in the pool unless otherwise configured.
+	 */
+	static const uint DEFAULT_FRAMES = 256;
+
+	/**
+	 * The process-wide buffer pool used by every HeapFile.
+	 */
+	static BufferPool& instance();
+
+	// ctor/dtor
+	BufferPool(uint num_frames=DEFAULT_FRAMES);
+	virtual ~BufferPool();
+	BufferPool(const BufferPool& other) = delete;
+	BufferPool(BufferPool&& temp) = delete;
+	BufferPool& operator=(const BufferPool& other) = delete;
+	BufferPool& operator=(BufferPool&& temp) = delete;
+
+	/**
+	 * Pin a block in the pool, reading it in on a miss.
+	 * @param file      file the block belongs to
+	 * @param block_id  which block
+	 * @param no_read   if true and the block is not resident, the frame is zeroed
+	 *                  instead of read (caller is about to overwrite all of it)
+	 * @returns         the pinned frame (release with unpin())
+	 * @throws          DbRelationError if every frame is pinned
+	 */
+	virtual BufferFrame* pin(HeapFile *file, BlockID block_id, bool no_read=false);
+
+	/**
+	 * Pin a block only if it is already resident (no I/O).
+	 * @returns  the pinned frame, or nullptr if the block is not in the pool
+	 */
+	virtual BufferFrame* pin_if_resident(HeapFile *file, BlockID block_id);
+
+	/**
+	 * Release a pin taken with pin() or pin_if_resident().
+	 */
+	virtual void unpin(BufferFrame *frame);
+
+	/**
+	 * Note that the frame's block has been changed by file and must be written back.
+	 */
+	virtual void mark_dirty(BufferFrame *frame, HeapFile *file);
+
+	/**
+	 * Write back every dirty frame belonging to the given file.
+	 */
+	virtual void flush(HeapFile *file);
+
+	/**
+	 * Forget every frame belonging to the given file without writing it (used by drop).
+	 */
+	virtual void discard(HeapFile *file);
+
+	/**
+	 * Forget the frames of the given file's blocks from from on without writing them (used by truncate).
+	 */
+	virtual void discard(HeapFile *file, BlockID from);
+
+	/**
+	 * Forget every dirty frame without writing it (used by rollback, after which the
+	 * blocks are read back from disk as they were).
+	 */
+	virtual void discard_dirty();
+
+	/**
+	 * Write back dirty frames that were last changed through file and stop using file
+	 * for write-back (used when the HeapFile handle goes away).
+	 */
+	virtual void release(HeapFile *file);
+
+	/**
+	 * Write back every dirty frame in the pool.
+	 */
+	virtual void checkpoint();
+
+	// statistics
+	u_long get_hits() const { return hits; }
+	u_long get_misses() const { return misses; }
+	u_long get_evictions() const { return evictions; }
+	u_long get_writes() const { return writes; }
+	uint get_capacity() const { return (uint) frames.size(); }
+
+protected:
+	typedef std::pair<std::string, BlockID> PageKey;
+
+	std::vector<BufferFrame*> frames;
+	std::map<PageKey, BufferFrame*> page_table;
+	std::recursive_mutex latch;  // recursive: a write-back can reopen its file, which flushes
+	uint clock_hand;
+	u_long hits;
+	u_long misses;
+	u_long evictions;
+	u_long writes;
+
+	virtual BufferFrame* victim();
+	virtual void write_back(BufferFrame *frame);
+	virtual void forget(BufferFrame *frame);
+};
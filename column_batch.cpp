@@ -0,0 +1,199 @@
+/**
+ * @file column_batch.cpp - implementation of ColumnBatch and RelationBatchCursor
+ *
+ * @see "Seattle University, CPSC5300, Summer 2018"
+ */
+#include "column_batch.h"
+#include "filter_kernels.h"
+#include <algorithm>
+#include <cstring>
+#include <memory>
+
+using namespace std;
+
+/**
+ * @class ColumnBatch - a run of up to CAPACITY rows of a relation, stored column by column
+ */
+
+ColumnBatch::ColumnBatch(const ColumnNames& column_names, const ColumnAttributes& column_attributes)
+		: column_names(column_names), columns(), text(), handles() {
+	for (auto ca: column_attributes) {
+		Column column;
+		column.data_type = ca.get_data_type();
+		if (column.data_type == ColumnAttribute::DataType::TEXT) {
+			column.text_offsets.reserve(CAPACITY);
+			column.text_lengths.reserve(CAPACITY);
+		} else if (column.data_type == ColumnAttribute::DataType::BOOLEAN) {
+			column.bools.reserve(CAPACITY);
+		} else {
+			column.ints.reserve(CAPACITY);
+		}
+		this->columns.push_back(column);
+	}
+	this->handles.reserve(CAPACITY);
+}
+
+void ColumnBatch::clear() {
+	for (auto& column: this->columns) {
+		column.ints.clear();
+		column.bools.clear();
+		column.text_offsets.clear();
+		column.text_lengths.clear();
+	}
+	this->text.clear();
+	this->handles.clear();
+}
+
+void ColumnBatch::append_text(uint column, const char* bytes, uint16_t size) {
+	this->columns[column].text_offsets.push_back((uint32_t) this->text.size());
+	this->columns[column].text_lengths.push_back(size);
+	this->text.append(bytes, size);
+}
+
+void ColumnBatch::append(uint column, const Value& value) {
+	if (this->columns[column].data_type == ColumnAttribute::DataType::TEXT)
+		append_text(column, value.s.data(), (uint16_t) value.s.size());
+	else if (this->columns[column].data_type == ColumnAttribute::DataType::BOOLEAN)
+		append_bool(column, (uint8_t) value.n);
+	else
+		append_int(column, value.n);
+}
+
+uint ColumnBatch::column_index(const Identifier& column_name) const {
+	auto it = std::find(this->column_names.begin(), this->column_names.end(), column_name);
+	if (it == this->column_names.end())
+		throw DbRelationError("table does not have column named '" + column_name + "'");
+	return (uint)(it - this->column_names.begin());
+}
+
+Value ColumnBatch::get(uint column, uint row) const {
+	const Column& c = this->columns[column];
+	Value value;
+	value.data_type = c.data_type;
+	if (c.data_type == ColumnAttribute::DataType::TEXT)
+		value.s.assign(this->text, c.text_offsets[row], c.text_lengths[row]);
+	else if (c.data_type == ColumnAttribute::DataType::BOOLEAN)
+		value.n = c.bools[row];
+	else
+		value.n = c.ints[row];
+	return value;
+}
+
+void ColumnBatch::filter(const Conjunction& where) {
+	if (where.empty() || size() == 0)
+		return;
+	vector<uint8_t> keep(size(), 1);
+	for (auto const& predicate: where)
+		match(predicate, keep);
+	compact(keep);
+}
+
+// AND into keep whether each row passes the predicate
+void ColumnBatch::match(const Predicate& predicate, vector<uint8_t>& keep) const {
+	const Column& column = this->columns[column_index(predicate.column_name)];
+	const uint n = size();
+	uint8_t* k = keep.data();
+
+	if (column.data_type == ColumnAttribute::DataType::INT) {
+		vector<int32_t> operands;
+		for (auto const& operand: predicate.operands)
+			operands.push_back(operand.n);
+		FilterKernels::filter(predicate.op, column.ints.data(), n, operands, k);
+		return;
+	}
+	if (column.data_type == ColumnAttribute::DataType::BOOLEAN) {
+		vector<uint8_t> operands;
+		for (auto const& operand: predicate.operands)
+			operands.push_back((uint8_t) operand.n);
+		FilterKernels::filter(predicate.op, column.bools.data(), n, operands, k);
+		return;
+	}
+
+	// TEXT: Predicate::matches on a Value would copy every string, so compare in place
+	const char* chars = this->text.data();
+	for (uint i = 0; i < n; i++) {
+		if (!k[i])
+			continue;
+		const char* s = chars + column.text_offsets[i];
+		uint16_t size = column.text_lengths[i];
+		bool pass = predicate.op == Predicate::IN ? false : true;
+		for (uint j = 0; j < predicate.operands.size(); j++) {
+			const string& operand = predicate.operands[j].s;
+			int c = memcmp(s, operand.data(), std::min((size_t) size, operand.size()));
+			if (c == 0)
+				c = (int) size - (int) operand.size();
+			switch (predicate.op) {
+				case Predicate::EQ: pass = c == 0; break;
+				case Predicate::NE: pass = c != 0; break;
+				case Predicate::LT: pass = c < 0; break;
+				case Predicate::LE: pass = c <= 0; break;
+				case Predicate::GT: pass = c > 0; break;
+				case Predicate::GE: pass = c >= 0; break;
+				case Predicate::BETWEEN: pass = pass && (j == 0 ? c >= 0 : c <= 0); break;
+				case Predicate::IN: pass = pass || c == 0; break;
+			}
+		}
+		k[i] = pass;
+	}
+}
+
+// keep only the rows marked in keep, sliding them down in place
+void ColumnBatch::compact(const vector<uint8_t>& keep) {
+	const uint n = size();
+	uint kept = 0;
+	for (uint i = 0; i < n; i++) {
+		if (!keep[i])
+			continue;
+		if (kept != i) {
+			this->handles[kept] = this->handles[i];
+			for (auto& column: this->columns) {
+				if (column.data_type == ColumnAttribute::DataType::TEXT) {
+					column.text_offsets[kept] = column.text_offsets[i];
+					column.text_lengths[kept] = column.text_lengths[i];
+				} else if (column.data_type == ColumnAttribute::DataType::BOOLEAN) {
+					column.bools[kept] = column.bools[i];
+				} else {
+					column.ints[kept] = column.ints[i];
+				}
+			}
+		}
+		kept++;
+	}
+	this->handles.resize(kept);
+	for (auto& column: this->columns) {
+		if (column.data_type == ColumnAttribute::DataType::TEXT) {
+			column.text_offsets.resize(kept);
+			column.text_lengths.resize(kept);
+		} else if (column.data_type == ColumnAttribute::DataType::BOOLEAN) {
+			column.bools.resize(kept);
+		} else {
+			column.ints.resize(kept);
+		}
+	}
+}
+
+/**
+ * @class RelationBatchCursor - DbBatchCursor for any DbRelation, built on select() and project()
+ */
+
+RelationBatchCursor::RelationBatchCursor(DbRelation& relation, const ColumnNames& column_names)
+		: relation(relation), column_names(column_names), handles(nullptr), position(0) {
+}
+
+RelationBatchCursor::~RelationBatchCursor() {
+	delete this->handles;
+}
+
+bool RelationBatchCursor::next(ColumnBatch& batch) {
+	batch.clear();
+	if (this->handles == nullptr)
+		this->handles = this->relation.select();
+	while (this->position < this->handles->size() && !batch.full()) {
+		Handle handle = (*this->handles)[this->position++];
+		unique_ptr<ValueDict> row(this->relation.project(handle, &this->column_names));
+		batch.append_row(handle);
+		for (uint i = 0; i < this->column_names.size(); i++)
+			batch.append(i, row->at(this->column_names[i]));
+	}
+	return batch.size() > 0;
+}
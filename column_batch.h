@@ -0,0 +1,137 @@
+/**
+ * @file column_batch.h - column-at-a-time row batches for the executor.
+ * ColumnBatch
+ * DbBatchCursor
+ * RelationBatchCursor: DbBatchCursor
+ *
+ * @see "Seattle University, CPSC5300, Summer 2018"
+ */
+#pragma once
+
+#include <string>
+#include <vector>
+#include "storage_engine.h"
+
+/**
+ * @class ColumnBatch - a run of up to CAPACITY rows of a relation, stored column by column
+ *
+ * INT columns are decoded into int32_t arrays and BOOLEAN columns into uint8_t arrays;
+ * TEXT columns are offset/length views into one character buffer shared by the whole
+ * batch. Predicates on INT and BOOLEAN columns run through FilterKernels a whole
+ * batch at a time.
+ * 	clear()
+ * 	append_row(handle)
+ * 	filter(conjunction)
+ * 	get(column, row)
+ */
+class ColumnBatch {
+public:
+	/**
+	 * Most rows a batch holds.
+	 */
+	static const uint CAPACITY = 1024;
+
+	// one column of the batch
+	struct Column {
+		ColumnAttribute::DataType data_type;
+		std::vector<int32_t> ints;           // INT values
+		std::vector<uint8_t> bools;          // BOOLEAN values
+		std::vector<uint32_t> text_offsets;  // TEXT values: start of each in ColumnBatch::text
+		std::vector<uint16_t> text_lengths;  // TEXT values: length of each
+	};
+
+	ColumnBatch(const ColumnNames& column_names, const ColumnAttributes& column_attributes);
+	virtual ~ColumnBatch() {}
+	ColumnBatch(const ColumnBatch& other) = delete;
+	ColumnBatch(ColumnBatch&& temp) = delete;
+	ColumnBatch& operator=(const ColumnBatch& other) = delete;
+	ColumnBatch& operator=(ColumnBatch&& temp) = delete;
+
+	uint size() const { return (uint) handles.size(); }
+	bool full() const { return handles.size() >= CAPACITY; }
+
+	/**
+	 * Empty the batch, keeping its columns.
+	 */
+	virtual void clear();
+
+	/**
+	 * Start a new row; the caller then appends one value to every column.
+	 * @param handle  where the row lives in its relation
+	 */
+	virtual void append_row(Handle handle) { handles.push_back(handle); }
+	void append_int(uint column, int32_t n) { columns[column].ints.push_back(n); }
+	void append_bool(uint column, uint8_t b) { columns[column].bools.push_back(b); }
+	void append_text(uint column, const char* bytes, uint16_t size);
+	void append(uint column, const Value& value);
+
+	/**
+	 * Drop the rows that fail any of the predicates, keeping the rest in order.
+	 * @param where  predicates on columns of this batch
+	 */
+	virtual void filter(const Conjunction& where);
+
+	/**
+	 * Position of a column in the batch.
+	 * @throws DbRelationError  if the batch does not have the column
+	 */
+	uint column_index(const Identifier& column_name) const;
+
+	/**
+	 * Get one value out of the batch.
+	 */
+	Value get(uint column, uint row) const;
+
+	const ColumnNames& get_column_names() const { return column_names; }
+	const Handles& get_handles() const { return handles; }
+
+protected:
+	ColumnNames column_names;
+	std::vector<Column> columns;
+	std::string text;  // characters of every TEXT value in the batch
+	Handles handles;
+
+	virtual void match(const Predicate& predicate, std::vector<uint8_t>& keep) const;
+	virtual void compact(const std::vector<uint8_t>& keep);
+};
+
+/**
+ * @class DbBatchCursor - abstract base class for reading a relation a ColumnBatch at a time
+ *
+ * Returned by DbRelation::batch_cursor().
+ * 	next(batch)
+ */
+class DbBatchCursor {
+public:
+	// ctor/dtor -- subclasses should handle big-5
+	DbBatchCursor() {}
+	virtual ~DbBatchCursor() {}
+
+	/**
+	 * Refill the batch with the next rows of the relation.
+	 * @param batch  cleared, then filled with up to ColumnBatch::CAPACITY rows
+	 * @returns      false (with batch empty) once the relation is exhausted
+	 */
+	virtual bool next(ColumnBatch& batch) = 0;
+};
+
+/**
+ * @class RelationBatchCursor - DbBatchCursor for any DbRelation, built on select() and project()
+ */
+class RelationBatchCursor : public DbBatchCursor {
+public:
+	RelationBatchCursor(DbRelation& relation, const ColumnNames& column_names);
+	virtual ~RelationBatchCursor();
+	RelationBatchCursor(const RelationBatchCursor& other) = delete;
+	RelationBatchCursor(RelationBatchCursor&& temp) = delete;
+	RelationBatchCursor& operator=(const RelationBatchCursor& other) = delete;
+	RelationBatchCursor& operator=(RelationBatchCursor&& temp) = delete;
+
+	virtual bool next(ColumnBatch& batch);
+
+protected:
+	DbRelation& relation;
+	ColumnNames column_names;
+	Handles* handles;
+	u_long position;  // next handle to read
+};
@@ -0,0 +1,345 @@
+/**
+ * @file filter_kernels.cpp - implementation of FilterKernels
+ *
+ * Every kernel is a template on the comparison, so the loops have no branches in them.
+ * The SIMD versions compare a register of values at a time, narrow the all-ones/all-zeros
+ * lanes to one byte per row, and AND that into the selection; leftover rows at the end
+ * go through the scalar version.
+ *
+ * @see "Seattle University, CPSC5300, Summer 2018"
+ */
+#include "filter_kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FILTER_KERNELS_X86
+#include <immintrin.h>
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+using namespace std;
+
+FilterKernels::Isa FilterKernels::isa = FilterKernels::SCALAR;
+bool FilterKernels::detected = false;
+
+FilterKernels::Isa FilterKernels::detect_isa() {
+#ifdef FILTER_KERNELS_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return AVX2;
+	if (__builtin_cpu_supports("sse2"))
+		return SSE2;
+#endif
+	return SCALAR;
+}
+
+FilterKernels::Isa FilterKernels::get_isa() {
+	if (!detected) {
+		isa = detect_isa();
+		detected = true;
+	}
+	return isa;
+}
+
+FilterKernels::Isa FilterKernels::set_isa(Isa wanted) {
+	Isa best = detect_isa();
+	isa = wanted < best ? wanted : best;
+	detected = true;
+	return isa;
+}
+
+/*
+ * scalar
+ */
+
+// does value pass OP against x (and y, the high end for BETWEEN)?
+template <Predicate::Op OP, typename T>
+static inline bool passes(T value, T x, T y) {
+	switch (OP) {
+		case Predicate::EQ: return value == x;
+		case Predicate::NE: return value != x;
+		case Predicate::LT: return value < x;
+		case Predicate::LE: return value <= x;
+		case Predicate::GT: return value > x;
+		case Predicate::GE: return value >= x;
+		case Predicate::BETWEEN: return (value >= x) & (value <= y);
+		default: return false;
+	}
+}
+
+template <Predicate::Op OP, typename T>
+static void scalar_filter(const T* values, uint n, T x, T y, uint8_t* keep) {
+	for (uint i = 0; i < n; i++)
+		keep[i] &= passes<OP>(values[i], x, y);
+}
+
+template <typename T>
+static void scalar_in(const T* values, uint n, const vector<T>& operands, uint8_t* keep) {
+	for (uint i = 0; i < n; i++) {
+		uint8_t any = 0;
+		for (auto const& operand: operands)
+			any |= values[i] == operand;
+		keep[i] &= any;
+	}
+}
+
+#ifdef FILTER_KERNELS_X86
+
+/*
+ * SSE2: 16 rows a step
+ */
+
+// all-ones lanes where v passes OP against x (and y); cmpgt is signed, so byte lanes come in biased
+template <Predicate::Op OP>
+TARGET_SSE2 static inline __m128i sse2_lanes32(__m128i v, __m128i x, __m128i y, __m128i all) {
+	switch (OP) {
+		case Predicate::EQ: return _mm_cmpeq_epi32(v, x);
+		case Predicate::NE: return _mm_xor_si128(_mm_cmpeq_epi32(v, x), all);
+		case Predicate::LT: return _mm_cmpgt_epi32(x, v);
+		case Predicate::LE: return _mm_xor_si128(_mm_cmpgt_epi32(v, x), all);
+		case Predicate::GT: return _mm_cmpgt_epi32(v, x);
+		case Predicate::GE: return _mm_xor_si128(_mm_cmpgt_epi32(x, v), all);
+		case Predicate::BETWEEN: return _mm_andnot_si128(_mm_or_si128(_mm_cmpgt_epi32(x, v), _mm_cmpgt_epi32(v, y)), all);
+		default: return _mm_setzero_si128();
+	}
+}
+
+template <Predicate::Op OP>
+TARGET_SSE2 static inline __m128i sse2_lanes8(__m128i v, __m128i x, __m128i y, __m128i all) {
+	switch (OP) {
+		case Predicate::EQ: return _mm_cmpeq_epi8(v, x);
+		case Predicate::NE: return _mm_xor_si128(_mm_cmpeq_epi8(v, x), all);
+		case Predicate::LT: return _mm_cmpgt_epi8(x, v);
+		case Predicate::LE: return _mm_xor_si128(_mm_cmpgt_epi8(v, x), all);
+		case Predicate::GT: return _mm_cmpgt_epi8(v, x);
+		case Predicate::GE: return _mm_xor_si128(_mm_cmpgt_epi8(x, v), all);
+		case Predicate::BETWEEN: return _mm_andnot_si128(_mm_or_si128(_mm_cmpgt_epi8(x, v), _mm_cmpgt_epi8(v, y)), all);
+		default: return _mm_setzero_si128();
+	}
+}
+
+// four registers of int32 lanes down to 16 bytes, in row order
+TARGET_SSE2 static inline __m128i sse2_narrow(__m128i a, __m128i b, __m128i c, __m128i d) {
+	return _mm_packs_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+}
+
+TARGET_SSE2 static inline void sse2_and(uint8_t* keep, __m128i mask) {
+	__m128i k = _mm_loadu_si128((const __m128i*) keep);
+	_mm_storeu_si128((__m128i*) keep, _mm_and_si128(k, mask));
+}
+
+template <Predicate::Op OP>
+TARGET_SSE2 static void sse2_filter(const int32_t* values, uint n, int32_t x, int32_t y, uint8_t* keep) {
+	const __m128i all = _mm_set1_epi32(-1), vx = _mm_set1_epi32(x), vy = _mm_set1_epi32(y);
+	uint i = 0;
+	for (; i + 16 <= n; i += 16) {
+		const __m128i* v = (const __m128i*)(values + i);
+		__m128i a = sse2_lanes32<OP>(_mm_loadu_si128(v), vx, vy, all);
+		__m128i b = sse2_lanes32<OP>(_mm_loadu_si128(v + 1), vx, vy, all);
+		__m128i c = sse2_lanes32<OP>(_mm_loadu_si128(v + 2), vx, vy, all);
+		__m128i d = sse2_lanes32<OP>(_mm_loadu_si128(v + 3), vx, vy, all);
+		sse2_and(keep + i, sse2_narrow(a, b, c, d));
+	}
+	scalar_filter<OP>(values + i, n - i, x, y, keep + i);
+}
+
+template <Predicate::Op OP>
+TARGET_SSE2 static void sse2_filter(const uint8_t* values, uint n, uint8_t x, uint8_t y, uint8_t* keep) {
+	const __m128i all = _mm_set1_epi8(-1), bias = _mm_set1_epi8((char) 0x80);
+	const __m128i vx = _mm_set1_epi8((char)(x ^ 0x80)), vy = _mm_set1_epi8((char)(y ^ 0x80));
+	uint i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(values + i)), bias);
+		sse2_and(keep + i, sse2_lanes8<OP>(v, vx, vy, all));
+	}
+	scalar_filter<OP>(values + i, n - i, x, y, keep + i);
+}
+
+TARGET_SSE2 static void sse2_in(const int32_t* values, uint n, const vector<int32_t>& operands, uint8_t* keep) {
+	uint i = 0;
+	for (; i + 16 <= n; i += 16) {
+		const __m128i* v = (const __m128i*)(values + i);
+		__m128i a = _mm_loadu_si128(v), b = _mm_loadu_si128(v + 1);
+		__m128i c = _mm_loadu_si128(v + 2), d = _mm_loadu_si128(v + 3);
+		__m128i ma = _mm_setzero_si128(), mb = ma, mc = ma, md = ma;
+		for (auto const& operand: operands) {
+			__m128i x = _mm_set1_epi32(operand);
+			ma = _mm_or_si128(ma, _mm_cmpeq_epi32(a, x));
+			mb = _mm_or_si128(mb, _mm_cmpeq_epi32(b, x));
+			mc = _mm_or_si128(mc, _mm_cmpeq_epi32(c, x));
+			md = _mm_or_si128(md, _mm_cmpeq_epi32(d, x));
+		}
+		sse2_and(keep + i, sse2_narrow(ma, mb, mc, md));
+	}
+	scalar_in(values + i, n - i, operands, keep + i);
+}
+
+TARGET_SSE2 static void sse2_in(const uint8_t* values, uint n, const vector<uint8_t>& operands, uint8_t* keep) {
+	uint i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(values + i));
+		__m128i m = _mm_setzero_si128();
+		for (auto const& operand: operands)
+			m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8((char) operand)));
+		sse2_and(keep + i, m);
+	}
+	scalar_in(values + i, n - i, operands, keep + i);
+}
+
+/*
+ * AVX2: 32 rows a step
+ */
+
+template <Predicate::Op OP>
+TARGET_AVX2 static inline __m256i avx2_lanes32(__m256i v, __m256i x, __m256i y, __m256i all) {
+	switch (OP) {
+		case Predicate::EQ: return _mm256_cmpeq_epi32(v, x);
+		case Predicate::NE: return _mm256_xor_si256(_mm256_cmpeq_epi32(v, x), all);
+		case Predicate::LT: return _mm256_cmpgt_epi32(x, v);
+		case Predicate::LE: return _mm256_xor_si256(_mm256_cmpgt_epi32(v, x), all);
+		case Predicate::GT: return _mm256_cmpgt_epi32(v, x);
+		case Predicate::GE: return _mm256_xor_si256(_mm256_cmpgt_epi32(x, v), all);
+		case Predicate::BETWEEN: return _mm256_andnot_si256(_mm256_or_si256(_mm256_cmpgt_epi32(x, v), _mm256_cmpgt_epi32(v, y)), all);
+		default: return _mm256_setzero_si256();
+	}
+}
+
+template <Predicate::Op OP>
+TARGET_AVX2 static inline __m256i avx2_lanes8(__m256i v, __m256i x, __m256i y, __m256i all) {
+	switch (OP) {
+		case Predicate::EQ: return _mm256_cmpeq_epi8(v, x);
+		case Predicate::NE: return _mm256_xor_si256(_mm256_cmpeq_epi8(v, x), all);
+		case Predicate::LT: return _mm256_cmpgt_epi8(x, v);
+		case Predicate::LE: return _mm256_xor_si256(_mm256_cmpgt_epi8(v, x), all);
+		case Predicate::GT: return _mm256_cmpgt_epi8(v, x);
+		case Predicate::GE: return _mm256_xor_si256(_mm256_cmpgt_epi8(x, v), all);
+		case Predicate::BETWEEN: return _mm256_andnot_si256(_mm256_or_si256(_mm256_cmpgt_epi8(x, v), _mm256_cmpgt_epi8(v, y)), all);
+		default: return _mm256_setzero_si256();
+	}
+}
+
+// four registers of int32 lanes down to 32 bytes; the packs work within 128-bit halves, so put the dwords back in row order
+TARGET_AVX2 static inline __m256i avx2_narrow(__m256i a, __m256i b, __m256i c, __m256i d) {
+	__m256i packed = _mm256_packs_epi16(_mm256_packs_epi32(a, b), _mm256_packs_epi32(c, d));
+	return _mm256_permutevar8x32_epi32(packed, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+}
+
+TARGET_AVX2 static inline void avx2_and(uint8_t* keep, __m256i mask) {
+	__m256i k = _mm256_loadu_si256((const __m256i*) keep);
+	_mm256_storeu_si256((__m256i*) keep, _mm256_and_si256(k, mask));
+}
+
+template <Predicate::Op OP>
+TARGET_AVX2 static void avx2_filter(const int32_t* values, uint n, int32_t x, int32_t y, uint8_t* keep) {
+	const __m256i all = _mm256_set1_epi32(-1), vx = _mm256_set1_epi32(x), vy = _mm256_set1_epi32(y);
+	uint i = 0;
+	for (; i + 32 <= n; i += 32) {
+		const __m256i* v = (const __m256i*)(values + i);
+		__m256i a = avx2_lanes32<OP>(_mm256_loadu_si256(v), vx, vy, all);
+		__m256i b = avx2_lanes32<OP>(_mm256_loadu_si256(v + 1), vx, vy, all);
+		__m256i c = avx2_lanes32<OP>(_mm256_loadu_si256(v + 2), vx, vy, all);
+		__m256i d = avx2_lanes32<OP>(_mm256_loadu_si256(v + 3), vx, vy, all);
+		avx2_and(keep + i, avx2_narrow(a, b, c, d));
+	}
+	scalar_filter<OP>(values + i, n - i, x, y, keep + i);
+}
+
+template <Predicate::Op OP>
+TARGET_AVX2 static void avx2_filter(const uint8_t* values, uint n, uint8_t x, uint8_t y, uint8_t* keep) {
+	const __m256i all = _mm256_set1_epi8(-1), bias = _mm256_set1_epi8((char) 0x80);
+	const __m256i vx = _mm256_set1_epi8((char)(x ^ 0x80)), vy = _mm256_set1_epi8((char)(y ^ 0x80));
+	uint i = 0;
+	for (; i + 32 <= n; i += 32) {
+		__m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(values + i)), bias);
+		avx2_and(keep + i, avx2_lanes8<OP>(v, vx, vy, all));
+	}
+	scalar_filter<OP>(values + i, n - i, x, y, keep + i);
+}
+
+TARGET_AVX2 static void avx2_in(const int32_t* values, uint n, const vector<int32_t>& operands, uint8_t* keep) {
+	uint i = 0;
+	for (; i + 32 <= n; i += 32) {
+		const __m256i* v = (const __m256i*)(values + i);
+		__m256i a = _mm256_loadu_si256(v), b = _mm256_loadu_si256(v + 1);
+		__m256i c = _mm256_loadu_si256(v + 2), d = _mm256_loadu_si256(v + 3);
+		__m256i ma = _mm256_setzero_si256(), mb = ma, mc = ma, md = ma;
+		for (auto const& operand: operands) {
+			__m256i x = _mm256_set1_epi32(operand);
+			ma = _mm256_or_si256(ma, _mm256_cmpeq_epi32(a, x));
+			mb = _mm256_or_si256(mb, _mm256_cmpeq_epi32(b, x));
+			mc = _mm256_or_si256(mc, _mm256_cmpeq_epi32(c, x));
+			md = _mm256_or_si256(md, _mm256_cmpeq_epi32(d, x));
+		}
+		avx2_and(keep + i, avx2_narrow(ma, mb, mc, md));
+	}
+	scalar_in(values + i, n - i, operands, keep + i);
+}
+
+TARGET_AVX2 static void avx2_in(const uint8_t* values, uint n, const vector<uint8_t>& operands, uint8_t* keep) {
+	uint i = 0;
+	for (; i + 32 <= n; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)(values + i));
+		__m256i m = _mm256_setzero_si256();
+		for (auto const& operand: operands)
+			m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8((char) operand)));
+		avx2_and(keep + i, m);
+	}
+	scalar_in(values + i, n - i, operands, keep + i);
+}
+
+#endif  // FILTER_KERNELS_X86
+
+/*
+ * dispatch
+ */
+
+template <Predicate::Op OP, typename T>
+static void dispatch(FilterKernels::Isa isa, const T* values, uint n, T x, T y, uint8_t* keep) {
+#ifdef FILTER_KERNELS_X86
+	if (isa == FilterKernels::AVX2)
+		return avx2_filter<OP>(values, n, x, y, keep);
+	if (isa == FilterKernels::SSE2)
+		return sse2_filter<OP>(values, n, x, y, keep);
+#endif
+	scalar_filter<OP>(values, n, x, y, keep);
+}
+
+template <typename T>
+static void dispatch_in(FilterKernels::Isa isa, const T* values, uint n, const vector<T>& operands, uint8_t* keep) {
+#ifdef FILTER_KERNELS_X86
+	if (isa == FilterKernels::AVX2)
+		return avx2_in(values, n, operands, keep);
+	if (isa == FilterKernels::SSE2)
+		return sse2_in(values, n, operands, keep);
+#endif
+	scalar_in(values, n, operands, keep);
+}
+
+template <typename T>
+static void filter_column(FilterKernels::Isa isa, Predicate::Op op, const T* values, uint n, const vector<T>& operands,
+		uint8_t* keep) {
+	if (op == Predicate::IN)
+		return dispatch_in(isa, values, n, operands, keep);
+	T x = operands[0];
+	T y = op == Predicate::BETWEEN ? operands[1] : x;
+	switch (op) {
+		case Predicate::EQ: return dispatch<Predicate::EQ>(isa, values, n, x, y, keep);
+		case Predicate::NE: return dispatch<Predicate::NE>(isa, values, n, x, y, keep);
+		case Predicate::LT: return dispatch<Predicate::LT>(isa, values, n, x, y, keep);
+		case Predicate::LE: return dispatch<Predicate::LE>(isa, values, n, x, y, keep);
+		case Predicate::GT: return dispatch<Predicate::GT>(isa, values, n, x, y, keep);
+		case Predicate::GE: return dispatch<Predicate::GE>(isa, values, n, x, y, keep);
+		case Predicate::BETWEEN: return dispatch<Predicate::BETWEEN>(isa, values, n, x, y, keep);
+		default: throw DbRelationError("unknown predicate operator");
+	}
+}
+
+void FilterKernels::filter(Predicate::Op op, const int32_t* values, uint n, const vector<int32_t>& operands,
+		uint8_t* keep) {
+	filter_column(get_isa(), op, values, n, operands, keep);
+}
+
+void FilterKernels::filter(Predicate::Op op, const uint8_t* values, uint n, const vector<uint8_t>& operands,
+		uint8_t* keep) {
+	filter_column(get_isa(), op, values, n, operands, keep);
+}
@@ -0,0 +1,63 @@
+/**
+ * @file filter_kernels.h - predicate kernels over contiguous column arrays.
+ * FilterKernels
+ *
+ * @see "Seattle University, CPSC5300, Summer 2018"
+ */
+#pragma once
+
+#include <vector>
+#include "storage_engine.h"
+
+/**
+ * @class FilterKernels - compare a whole column array against a predicate's operands
+ *
+ * Each call ANDs the outcome for every row into a selection of one byte per row
+ * (1 to keep the row, 0 to drop it). There are AVX2 and SSE2 versions for x86 with
+ * a plain scalar one behind them; the best the CPU supports is picked the first time
+ * a kernel runs.
+ * 	filter(op, int32 values, ...)
+ * 	filter(op, uint8 values, ...)
+ */
+class FilterKernels {
+public:
+	enum Isa {
+		SCALAR,
+		SSE2,
+		AVX2
+	};
+
+	/**
+	 * AND into keep whether each value passes the predicate.
+	 * @param op        comparison to make
+	 * @param values    the column, n values long
+	 * @param n         number of rows
+	 * @param operands  one for a comparison, low then high for BETWEEN, the list for IN
+	 * @param keep      selection of n rows, updated in place
+	 */
+	static void filter(Predicate::Op op, const int32_t* values, uint n, const std::vector<int32_t>& operands,
+			uint8_t* keep);
+	static void filter(Predicate::Op op, const uint8_t* values, uint n, const std::vector<uint8_t>& operands,
+			uint8_t* keep);
+
+	/**
+	 * Instruction set the kernels are currently using.
+	 */
+	static Isa get_isa();
+
+	/**
+	 * Use a different instruction set, e.g., to test the scalar fallback.
+	 * @param isa  wanted instruction set; capped at what the CPU supports
+	 * @returns    the instruction set actually in use
+	 */
+	static Isa set_isa(Isa isa);
+
+	/**
+	 * Best instruction set this CPU supports.
+	 */
+	static Isa detect_isa();
+
+protected:
+	static Isa isa;
+	static bool detected;
+};
@@ -0,0 +1,458 @@
+/**
+ * @file hash_index.cpp - implementation of HashIndex
+ *
+ * @see "Seattle University, CPSC5300, Summer 2018"
+ */
+#include "hash_index.h"
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+static const uint HANDLE_SIZE = sizeof(BlockID) + sizeof(RecordID);
+
+// an entry as it is stored: the handle, then the marshaled key
+static string make_entry(Handle handle, const string& key) {
+	string entry(HANDLE_SIZE, '\0');
+	memcpy(&entry[0], &handle.first, sizeof(BlockID));
+	memcpy(&entry[sizeof(BlockID)], &handle.second, sizeof(RecordID));
+	return entry + key;
+}
+
+// record id of the entry in page exactly matching entry, or 0 if there isn't one (record 1 is the page's link)
+static RecordID find_entry(const SlottedPage* page, const string& entry) {
+	unique_ptr<RecordIDs> record_ids(page->ids());
+	for (auto const& record_id: *record_ids) {
+		unique_ptr<Dbt> data(page->get(record_id));
+		if (record_id != 1 && data->get_size() == entry.size() && memcmp(data->get_data(), entry.data(), entry.size()) == 0)
+			return record_id;
+	}
+	return 0;
+}
+
+HashIndex::HashIndex(DbRelation& relation, Identifier name, ColumnNames key_columns, bool unique, uint block_size)
+		: DbIndex(relation, name, key_columns, unique), closed(true),
+		file(relation.get_table_name() + "-" + name, block_size),
+		overflow(relation.get_table_name() + "-" + name + ".overflow", block_size),
+		key_profile(), level(0), next(0), entries(0), entry_bytes(0), spare(0) {
+	build_key_profile();
+}
+
+HashIndex::~HashIndex() {
+}
+
+// data types of each key column
+void HashIndex::build_key_profile() {
+	ColumnAttributes *cas = relation.get_column_attributes(key_columns);
+	for (auto& ca: *cas)
+		key_profile.push_back(ca.get_data_type());
+	delete cas;
+}
+
+void HashIndex::create() {
+	this->file.create();
+	this->overflow.create();
+	this->level = this->next = this->entries = this->entry_bytes = 0;
+	this->spare = 0;
+	this->closed = false;
+	try {
+		// the overflow file comes with a block 1: start it out as a spare page
+		unique_ptr<SlottedPage> first(this->overflow.get(1));
+		init_page(first.get(), 0);
+		this->overflow.put(first.get());
+		this->spare = 1;
+		for (uint bucket = 0; bucket < INITIAL_BUCKETS; bucket++) {
+			unique_ptr<SlottedPage> page(this->file.get_new());
+			init_page(page.get(), 0);
+			this->file.put(page.get());
+		}
+		save_state();
+
+		Handles handles;
+		unique_ptr<ValueDicts> rows(relation.scan(&key_columns, &handles));
+		try {
+			for (u_long i = 0; i < rows->size(); i++) {
+				string key = marshal_key((*rows)[i]);
+				if (this->unique) {
+					unique_ptr<Handles> found(find(key));
+					if (!found->empty())
+						throw DbRelationError("Duplicate keys are not allowed in unique index");
+				}
+				add(key, handles[i]);
+			}
+		} catch (...) {
+			for (auto row: *rows)
+				delete row;
+			throw;
+		}
+		for (auto row: *rows)
+			delete row;
+		save_state();
+	} catch (DbRelationError &e) {
+		drop();
+		throw;
+	}
+}
+
+void HashIndex::drop() {
+	this->closed = true;
+	this->file.drop();
+	this->overflow.drop();
+}
+
+void HashIndex::open() {
+	if (!this->closed)
+		return;
+	this->file.open();
+	this->overflow.open();
+	load_state();
+	this->closed = false;
+}
+
+void HashIndex::close() {
+	this->file.close();
+	this->overflow.close();
+	this->closed = true;
+}
+
+Handles* HashIndex::lookup(ValueDict* key_values) const {
+	if (this->closed)
+		throw DbRelationError("hash index " + this->name + " is not open");
+	return find(marshal_key(key_values));
+}
+
+void HashIndex::insert(Handle handle) {
+	open();
+	unique_ptr<ValueDict> row(relation.project(handle, &key_columns));
+	string key = marshal_key(row.get());
+	if (this->unique) {
+		unique_ptr<Handles> found(find(key));
+		if (!found->empty())
+			throw DbRelationError("Duplicate keys are not allowed in unique index");
+	}
+	add(key, handle);
+	save_state();
+}
+
+void HashIndex::insert_batch(const Handles* handles) {
+	open();
+	vector<string> keys;
+	vector<pair<uint, u_long>> order;  // each row's bucket and where it is in handles
+	keys.reserve(handles->size());
+	order.reserve(handles->size());
+	for (auto const& handle: *handles) {
+		unique_ptr<ValueDict> row(relation.project(handle, &key_columns));
+		keys.push_back(marshal_key(row.get()));
+		order.push_back(make_pair(bucket(hash(keys.back())), order.size()));
+	}
+	sort(order.begin(), order.end());
+
+	try {
+		for (auto const& row: order) {
+			if (this->unique) {
+				unique_ptr<Handles> found(find(keys[row.second]));
+				if (!found->empty())
+					throw DbRelationError("Duplicate keys are not allowed in unique index");
+			}
+			add(keys[row.second], (*handles)[row.second]);
+		}
+	} catch (...) {
+		save_state();  // for the rows that did go in
+		throw;
+	}
+	save_state();
+}
+
+// the row must still be in the relation, so we know its key
+void HashIndex::del(Handle handle) {
+	open();
+	unique_ptr<ValueDict> row(relation.project(handle, &key_columns));
+	string key = marshal_key(row.get());
+	string entry = make_entry(handle, key);
+
+	SlottedPage *previous = nullptr, *page = get_page(bucket(hash(key)) + 2, false);
+	bool previous_is_overflow = false, is_overflow = false;
+	while (page != nullptr) {
+		RecordID record_id = find_entry(page, entry);
+		if (record_id != 0) {
+			page->del(record_id);
+			delete page->compact();  // nothing refers to an entry by its record id, so give its slot back too
+			if (is_overflow && page->size() == 1) {
+				// nothing left but the link: take the page out of the chain and keep it spare
+				set_next_page(previous, next_page(page));
+				put_page(previous, previous_is_overflow);
+				init_page(page, this->spare);
+				this->spare = page->get_block_id();
+			}
+			put_page(page, is_overflow);
+			delete page;
+			delete previous;
+			this->entries--;
+			this->entry_bytes -= (uint) entry.size() + 4;
+			save_state();
+			return;
+		}
+		BlockID following = next_page(page);
+		delete previous;
+		previous = page;
+		previous_is_overflow = is_overflow;
+		page = following == 0 ? nullptr : get_page(following, true);
+		is_overflow = true;
+	}
+	delete previous;
+	throw DbRelationError("no entry in hash index " + this->name + " for the row");
+}
+
+// the entry stays in its bucket (the key hasn't changed); only its handle is rewritten, in place
+void HashIndex::relocate(Handle from, Handle to) {
+	open();
+	unique_ptr<ValueDict> row(relation.project(to, &key_columns));
+	string key = marshal_key(row.get());
+	string old_entry = make_entry(from, key);
+	string new_entry = make_entry(to, key);
+
+	bool is_overflow = false;
+	for (BlockID block_id = bucket(hash(key)) + 2; block_id != 0; is_overflow = true) {
+		SlottedPage *page = get_page(block_id, is_overflow);
+		RecordID record_id = find_entry(page, old_entry);
+		if (record_id != 0) {
+			page->put(record_id, Dbt((void*) new_entry.data(), (u_int32_t) new_entry.size()));
+			put_page(page, is_overflow);
+			delete page;
+			return;
+		}
+		block_id = next_page(page);
+		delete page;
+	}
+	throw DbRelationError("no entry in hash index " + this->name + " for the moved row");
+}
+
+uint HashIndex::get_overflow_pages() const {
+	uint spares = 0;
+	for (BlockID block_id = this->spare; block_id != 0; spares++) {
+		unique_ptr<SlottedPage> page(get_page(block_id, true));
+		block_id = next_page(page.get());
+	}
+	return this->overflow.get_last_block_id() - spares;
+}
+
+// the handles of the entries with exactly this (marshaled) key
+Handles* HashIndex::find(const string& key) const {
+	Handles* handles = new Handles();
+	bool is_overflow = false;
+	for (BlockID block_id = bucket(hash(key)) + 2; block_id != 0; is_overflow = true) {
+		SlottedPage *page = get_page(block_id, is_overflow);
+		unique_ptr<RecordIDs> record_ids(page->ids());
+		for (auto const& record_id: *record_ids) {
+			if (record_id == NEXT_PAGE)
+				continue;
+			unique_ptr<Dbt> data(page->get(record_id));
+			const char *bytes = (const char*) data->get_data();
+			if (data->get_size() == HANDLE_SIZE + key.size() && memcmp(bytes + HANDLE_SIZE, key.data(), key.size()) == 0) {
+				Handle handle;
+				memcpy(&handle.first, bytes, sizeof(BlockID));
+				memcpy(&handle.second, bytes + sizeof(BlockID), sizeof(RecordID));
+				handles->push_back(handle);
+			}
+		}
+		block_id = next_page(page);
+		delete page;
+	}
+	return handles;
+}
+
+// add an entry for the key and handle, then split a bucket if the buckets are getting full
+void HashIndex::add(const string& key, Handle handle) {
+	string entry = make_entry(handle, key);
+	if (entry.size() + 12 > this->file.get_block_size())  // a page's header, its link and this entry's slot
+		throw DbRelationError("key too big for hash index " + this->name);
+	add_entry(bucket(hash(key)), entry);
+	this->entries++;
+	this->entry_bytes += (uint) entry.size() + 4;
+	if ((u_long) this->entry_bytes * 100 > (u_long) FILL_PERCENT * get_bucket_count() * (this->file.get_block_size() - 8))
+		split();
+}
+
+// key columns of row in key order, each marshaled the way BTreeNode marshals keys
+string HashIndex::marshal_key(const ValueDict* row) const {
+	string key;
+	for (uint i = 0; i < this->key_columns.size(); i++) {
+		auto column = row->find(this->key_columns[i]);
+		if (column == row->end())
+			throw DbRelationError("hash index " + this->name + " needs a value for " + this->key_columns[i]);
+		const Value& value = column->second;
+		if (this->key_profile[i] == ColumnAttribute::DataType::INT) {
+			int32_t n = value.n;
+			key.append((const char*) &n, sizeof(n));
+		} else if (this->key_profile[i] == ColumnAttribute::DataType::TEXT) {
+			if (value.s.length() > UINT16_MAX)
+				throw DbRelationError("text field too long to marshal");
+			uint16_t size = (uint16_t) value.s.length();
+			key.append((const char*) &size, sizeof(size));
+			key.append(value.s);
+		} else if (this->key_profile[i] == ColumnAttribute::DataType::BOOLEAN) {
+			key.push_back((char) (value.n == 0 ? 0 : 1));
+		} else {
+			throw DbRelationError("Cannot marshal key of unknown data type");
+		}
+	}
+	return key;
+}
+
+// FNV-1a: the same on every platform and every run, which a hash kept on disk needs
+uint32_t HashIndex::hash(const string& key) {
+	uint32_t h = 2166136261u;
+	for (char c: key) {
+		h ^= (uint8_t) c;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+// the bucket a hash goes in: mod the round's bucket count, or mod twice that if its bucket has split
+uint HashIndex::bucket(uint32_t hash) const {
+	uint round = INITIAL_BUCKETS << this->level;
+	uint b = hash % round;
+	if (b < this->next)
+		b = hash % (2 * round);
+	return b;
+}
+
+void HashIndex::load_state() {
+	unique_ptr<SlottedPage> page(this->file.get(STATE));
+	unique_ptr<Dbt> data(page->get(1));
+	const uint32_t *state = (const uint32_t*) data->get_data();
+	this->level = state[0];
+	this->next = state[1];
+	this->entries = state[2];
+	this->entry_bytes = state[3];
+	this->spare = state[4];
+}
+
+void HashIndex::save_state() {
+	uint32_t state[5] = {this->level, this->next, this->entries, this->entry_bytes, this->spare};
+	Dbt data(state, sizeof(state));
+	unique_ptr<SlottedPage> page(this->file.get(STATE));
+	if (page->size() == 0)
+		page->add(&data);
+	else
+		page->put(1, data);
+	this->file.put(page.get());
+}
+
+// empty a page, leaving just its link to next_page
+void HashIndex::init_page(SlottedPage* page, BlockID next_page) const {
+	page->clear();
+	Dbt link(&next_page, sizeof(next_page));
+	page->add(&link);
+}
+
+BlockID HashIndex::next_page(const SlottedPage* page) const {
+	return *(const BlockID*) page->get_record(NEXT_PAGE);
+}
+
+void HashIndex::set_next_page(SlottedPage* page, BlockID next_page) const {
+	page->put(NEXT_PAGE, Dbt(&next_page, sizeof(next_page)));
+}
+
+SlottedPage* HashIndex::get_page(BlockID block_id, bool is_overflow) const {
+	return is_overflow ? this->overflow.get(block_id) : this->file.get(block_id);
+}
+
+void HashIndex::put_page(SlottedPage* page, bool is_overflow) {
+	if (is_overflow)
+		this->overflow.put(page);
+	else
+		this->file.put(page);
+}
+
+// a spare overflow page if there is one, else a new one
+BlockID HashIndex::new_overflow_page() {
+	BlockID block_id;
+	SlottedPage* page;
+	if (this->spare != 0) {
+		block_id = this->spare;
+		page = this->overflow.get(block_id);
+		this->spare = next_page(page);
+	} else {
+		page = this->overflow.get_new();
+		block_id = page->get_block_id();
+	}
+	init_page(page, 0);
+	this->overflow.put(page);
+	delete page;
+	return block_id;
+}
+
+// put an entry in the first page of the bucket's chain with room, chaining a new page if none has
+void HashIndex::add_entry(uint bucket, const string& entry) {
+	Dbt data((void*) entry.data(), (u_int32_t) entry.size());
+	SlottedPage* page = get_page(bucket + 2, false);
+	bool is_overflow = false;
+	while (page->free_space() < entry.size()) {
+		BlockID following = next_page(page);
+		if (following == 0) {
+			following = new_overflow_page();
+			set_next_page(page, following);
+			put_page(page, is_overflow);
+		}
+		delete page;
+		page = get_page(following, true);
+		is_overflow = true;
+	}
+	page->add(&data);
+	put_page(page, is_overflow);
+	delete page;
+}
+
+// split bucket next: its entries are spread over it and the new bucket at the end by the next round's hash
+void HashIndex::split() {
+	uint old_bucket = this->next;
+	uint new_bucket = get_bucket_count();
+	vector<string> moving;
+	auto take = [&moving](SlottedPage* page) {
+		unique_ptr<RecordIDs> record_ids(page->ids());
+		for (auto const& record_id: *record_ids) {
+			if (record_id == NEXT_PAGE)
+				continue;
+			unique_ptr<Dbt> data(page->get(record_id));
+			moving.push_back(string((const char*) data->get_data(), data->get_size()));
+		}
+	};
+
+	// empty the old bucket, keeping its overflow pages spare
+	SlottedPage* page = get_page(old_bucket + 2, false);
+	take(page);
+	BlockID chain = next_page(page);
+	init_page(page, 0);
+	put_page(page, false);
+	delete page;
+	while (chain != 0) {
+		page = get_page(chain, true);
+		take(page);
+		BlockID following = next_page(page);
+		init_page(page, this->spare);
+		this->spare = chain;
+		put_page(page, true);
+		delete page;
+		chain = following;
+	}
+
+	page = this->file.get_new();
+	if (page->get_block_id() != new_bucket + 2) {
+		delete page;
+		throw DbRelationError("hash index " + this->name + " has lost track of its buckets");
+	}
+	init_page(page, 0);
+	put_page(page, false);
+	delete page;
+
+	if (++this->next == INITIAL_BUCKETS << this->level) {
+		this->level++;
+		this->next = 0;
+	}
+	for (auto const& entry: moving)
+		add_entry(bucket(hash(entry.substr(HANDLE_SIZE))), entry);
+}
@@ -0,0 +1,117 @@
+/**
+ * @file hash_index.h - disk-based linear hashing index.
+ * HashIndex
+ *
+ * @see "Seattle University, CPSC5300, Summer 2018"
+ */
+#pragma once
+
+#include <string>
+#include "BTreeNode.h"
+#include "heap_storage.h"
+
+/**
+ * @class HashIndex - linear hashing index on top of HeapFile buckets (implementation of DbIndex)
+ *
+ * Equality lookups read the key's bucket and its overflow pages, and nothing else.
+ * Files and blocks:
+ *     <table>-<index>.db:           block 1 holds the index's state; bucket b is block b + 2
+ *     <table>-<index>.overflow.db:  overflow pages, chained off buckets (and spare ones off the state)
+ * Every page is a SlottedPage whose record 1 is the block id of the next overflow page in its
+ * chain (0 at the end). The rest are entries: the row's handle followed by its marshaled key.
+ *
+ * A key hashes to 32 bits (FNV-1a of the marshaled key). A round starts with
+ * INITIAL_BUCKETS * 2^level buckets; the key's bucket is its hash modulo that, or modulo twice
+ * that if the bucket has already been split this round (it is below next). Once the entries
+ * would fill more than FILL_PERCENT of the buckets' pages, bucket next is split: the entries that
+ * hash to the new bucket at the end move there, and next moves on, starting a new round at
+ * level + 1 when it gets to the end. So the index grows a bucket at a time rather than all at
+ * once, and a bucket that overflows in the meantime just chains another page.
+ * 	lookup(key)
+ * 	insert(handle)
+ * 	del(handle)
+ * 	relocate(from, to)
+ */
+class HashIndex : public DbIndex {
+public:
+	/**
+	 * Buckets an empty index starts with.
+	 */
+	static const uint INITIAL_BUCKETS = 4;
+
+	/**
+	 * How full the buckets get, as a percentage of their pages, before the next one is split.
+	 */
+	static const uint FILL_PERCENT = 75;
+
+	HashIndex(DbRelation& relation, Identifier name, ColumnNames key_columns, bool unique,
+			  uint block_size=DbBlock::BLOCK_SZ);
+	virtual ~HashIndex();
+	HashIndex(const HashIndex& other) = delete;
+	HashIndex(HashIndex&& temp) = delete;
+	HashIndex& operator=(const HashIndex& other) = delete;
+	HashIndex& operator=(HashIndex&& temp) = delete;
+
+	/**
+	 * Create the index's files and add an entry for every row already in the relation.
+	 */
+	virtual void create();
+	virtual void drop();
+
+	virtual void open();
+	virtual void close();
+
+	/**
+	 * Find the rows with the given key.
+	 * @param key_values  a value for every key column
+	 * @returns           handles of the matching rows (freed by caller)
+	 */
+	virtual Handles* lookup(ValueDict* key_values) const;
+
+	virtual void insert(Handle handle);
+	virtual void del(Handle handle);
+
+	/**
+	 * Insert a batch of rows in bucket order, so the ones that go in the same bucket come one
+	 * after another and find its pages still in the buffer pool. The state is saved once, at the end.
+	 * @param handles  the rows, which must be in the relation already
+	 */
+	virtual void insert_batch(const Handles* handles);
+	virtual void relocate(Handle from, Handle to);
+
+	// statistics
+	uint get_bucket_count() const { return (INITIAL_BUCKETS << level) + next; }
+	uint get_entry_count() const { return entries; }
+	uint get_overflow_pages() const;  // chained off buckets, not counting spare ones
+
+protected:
+	static const BlockID STATE = 1;
+	static const RecordID NEXT_PAGE = 1;  // record holding the block id of the next page in a chain
+
+	bool closed;
+	mutable HeapFile file;      // state and buckets; lookups only pin and read blocks
+	mutable HeapFile overflow;  // overflow pages
+	KeyProfile key_profile;
+	uint level;                 // round of splitting we're in
+	uint next;                  // next bucket to split
+	uint entries;
+	uint entry_bytes;           // bytes of all the entries, slot headers included
+	BlockID spare;              // first of a chain of empty overflow pages
+
+	void build_key_profile();
+	Handles* find(const std::string& key) const;
+	void add(const std::string& key, Handle handle);
+	std::string marshal_key(const ValueDict* row) const;
+	static uint32_t hash(const std::string& key);
+	uint bucket(uint32_t hash) const;
+	void load_state();
+	void save_state();
+	void init_page(SlottedPage* page, BlockID next_page) const;
+	BlockID next_page(const SlottedPage* page) const;
+	void set_next_page(SlottedPage* page, BlockID next_page) const;
+	SlottedPage* get_page(BlockID block_id, bool is_overflow) const;
+	void put_page(SlottedPage* page, bool is_overflow);
+	BlockID new_overflow_page();
+	void add_entry(uint bucket, const std::string& entry);
+	void split();
+};
@@ -2,14 +2,22 @@
  * @file heap_storage.cpp - concrete implementation of the heap_storage.h prototypes
  * SlottedPage: DbBlock
  * HeapFile: DbFile
+ * FreeSpaceMap
  * HeapTable: DbRelation
  *
  * @authors Brian Doersch, Jacob Mouser, Kevin Lundeen
  */
 
 #include "heap_storage.h"
+#include <algorithm>
+#include <atomic>
 #include <cstring>
+#include <functional>
+#include <map>
 #include <memory>
+#include <thread>
+#include "task_scheduler.h"
+#include "transaction.h"
 
 using namespace std;
 
@@ -21,21 +29,30 @@ typedef uint16_t u16;
  */
 
 //constructor , author K.Lundeen
-SlottedPage::SlottedPage(Dbt &block, BlockID block_id, bool is_new):DbBlock(block, block_id, is_new) {
+SlottedPage::SlottedPage(Dbt &block, BlockID block_id, bool is_new, BufferFrame *frame)
+		: DbBlock(block, block_id, is_new), frame(frame), hole_bytes(is_new ? 0 : -1) {
 	if (is_new) {
 		this->num_records=0;
-		this->end_free=DbBlock::BLOCK_SZ-1;
+		this->end_free=get_block_size()-1;
 		put_header();
 	}else{
 		get_header(this->num_records, this->end_free);
 	}
 }
+//releases the pin on the buffer pool frame, if the block lives in one
+SlottedPage::~SlottedPage() {
+	if (this->frame != nullptr)
+		BufferPool::instance().unpin(this->frame);
+}
+
 //add a new record to the block and return the id, author K.Lundeen
 RecordID SlottedPage::add(const Dbt* data) throw(DbBlockNoRoomError){
 	if (!has_room(data->get_size()))
 		throw DbBlockNoRoomError("not enough room for new record");
-	u16 id = ++this->num_records;
 	u16 size = (u16)data->get_size();
+	if (contiguous() < size + 4)
+		defragment();  // there's room, but only counting the holes
+	u16 id = ++this->num_records;
 	this->end_free -= size;
 	u16 loc = this -> end_free + 1;
 	put_header();
@@ -55,65 +72,61 @@ Dbt* SlottedPage::get(RecordID record_id) const {
 	return tempBlock;
 }
 
+//points at a record inside the block (nullptr if it has been deleted)
+const char* SlottedPage::get_record(RecordID record_id) const {
+	u16 size, loc;
+	get_header(size, loc, record_id);
+	if (loc == 0)
+		return nullptr;
+	return (const char*)this->address(loc);
+}
+
 //replaces a record at record_id with the data from the passed in Dbt structure.
+//a record that shrinks stays put; one that grows moves to free space, leaving a hole behind.
 void SlottedPage::put(RecordID record_id, const Dbt &data) throw(DbBlockNoRoomError){
-	u16 old_size, old_offset;
-	get_header(old_size, old_offset, record_id);
+	if (data.get_size() > max_record_size(get_block_size()))
+		throw DbBlockNoRoomError("record too big for any page");
+	u16 old_size, old_loc;
+	get_header(old_size, old_loc, record_id);
 	u16 new_size = (u16) data.get_size();
-	
-	if (new_size> old_size && !has_room(new_size-old_size))
-	{
-		throw DbBlockNoRoomError("not enough room for updating record");
-	}
-
-	if (new_size > old_size)
-	{
-		u16 shift_offset = new_size - old_size;
-		u16 new_offset = old_offset - shift_offset;
-
-		shift_records(record_id + 1, shift_offset);
-		memcpy(this->address(new_offset), data.get_data(), new_size);
-		put_header(record_id, new_size, new_offset);	
-
-		if (record_id == this->num_records)
-		{
-			this->end_free -= shift_offset;
-		}
-	}
-	else
-	{
-		u16 shift_offset = old_size - new_size;
-		u16 new_offset = old_offset + shift_offset;
-
-		shift_records(record_id + 1, shift_offset, false);
-		memcpy(this->address(new_offset), data.get_data(), new_size);
-		put_header(record_id, new_size, new_offset);	
 
-		if (record_id == this->num_records)
-		{
-			this->end_free += shift_offset;
-		}
+	if (new_size <= old_size) {
+		memcpy(this->address(old_loc), data.get_data(), new_size);
+		put_header(record_id, new_size, old_loc);
+		if (this->hole_bytes >= 0)
+			this->hole_bytes += old_size - new_size;
+		return;
 	}
+	if ((int) new_size > contiguous() + (int) holes() + old_size)
+		throw DbBlockNoRoomError("not enough room for updating record");
 
-	put_header();	
+	put_header(record_id, 0U, 0U);  // the old copy is a hole from now on
+	this->hole_bytes += old_size;
+	if (contiguous() < new_size)
+		defragment();
+	this->end_free -= new_size;
+	u16 new_loc = this->end_free + 1;
+	memcpy(this->address(new_loc), data.get_data(), new_size);
+	put_header(record_id, new_size, new_loc);
+	put_header();
 }
 /**
- * removes a record by setting its size and loc to 0
+ * removes a record by setting its size and loc to 0; its bytes become a hole
+ * (unless it is the record next to free space, which free space just takes back)
  * @param record_id which record to delete 
  */
 void SlottedPage::del(RecordID record_id){
-	u16 size, offset;
-	get_header(size, offset, record_id);
-
-	shift_records(record_id + 1, size, false);
+	u16 size, loc;
+	get_header(size, loc, record_id);
+	if (loc == 0)
+		return;
 	put_header(record_id, 0U, 0U);
-
-	if (record_id == this->num_records)
-	{
+	if (loc == this->end_free + 1) {
 		this->end_free += size;
+		put_header();
+	} else if (this->hole_bytes >= 0) {
+		this->hole_bytes += size;
 	}
-
-	put_header();	
 }
 
 // Count of non-deleted records
@@ -128,89 +141,80 @@ u16 SlottedPage::size() const {
     return count;
 }
 
+uint SlottedPage::free_space() const {
+	int free = contiguous() + (int) holes() - 4;  // same arithmetic as has_room()
+	return free > 0 ? (uint) free : 0;
+}
+
+RecordIDs* SlottedPage::compact() {
+	RecordIDs* old_ids = ids();
+	if (old_ids->size() == this->num_records)
+		return old_ids;  // nothing deleted
+	u16 id = 0;
+	for (auto const& old_id: *old_ids) {
+		u16 size, loc;
+		get_header(size, loc, old_id);
+		put_header(++id, size, loc);  // id <= old_id, so this never overwrites a header still to be read
+	}
+	this->num_records = id;
+	put_header();
+	return old_ids;
+}
+
 void SlottedPage::clear() {
     this->num_records = 0;
-    this->end_free = DbBlock::BLOCK_SZ - 1;
+    this->end_free = get_block_size() - 1;
+    this->hole_bytes = 0;
     put_header();
 }
 
-/**
- * Check if the block has a specific record 
- * @param record_id which record to check
- */
-bool SlottedPage::have_record(RecordID record_id)
-{
-	if (record_id == 0 || record_id > this->num_records)
-	{
-		return false;
-	}
-
-	u16 size, offset;
-	get_header(size, offset, record_id);
+//bytes between the last header and the end of free space
+int SlottedPage::contiguous() const {
+	return (int)this->end_free + 1 - (this->num_records + 1) * 4;
+}
 
-	if (offset == 0)
-	{
-		return false;
+//bytes of deleted (or shrunk) records between live ones, counted the first time they're needed
+uint SlottedPage::holes() const {
+	if (this->hole_bytes < 0) {
+		u16 size, loc;
+		uint live = 0;
+		for (RecordID record_id = 1; record_id <= this->num_records; record_id++) {
+			get_header(size, loc, record_id);
+			if (loc != 0)
+				live += size;
+		}
+		this->hole_bytes = (int)(get_block_size() - 1 - this->end_free) - (int)live;
 	}
-
-	return true;
+	return (uint) this->hole_bytes;
 }
 
 /**
- * Shift corresponding records in the block
- * @param begin_record_id the first record on the left of the deleted or updated record
- * @shift_offset          the size to shift 
- * @left 		  the direction to shift 
+ * Slide the records together against the end of the block, so the holes
+ * between them become part of free space
  */
-void SlottedPage::shift_records(RecordID begin_record_id, u_int16_t shift_offset, bool left)
+void SlottedPage::defragment()
 {
-	while(begin_record_id <= this->num_records && !have_record(begin_record_id))
-	{
-		begin_record_id++;
+	vector<pair<u16, RecordID>> records;  // offset and id of each live record
+	for (RecordID record_id = 1; record_id <= this->num_records; record_id++) {
+		u16 size, loc;
+		get_header(size, loc, record_id);
+		if (loc != 0)
+			records.push_back(make_pair(loc, record_id));
 	}
-
-	if (begin_record_id > this->num_records)
-	{
-		return;
+	// highest offset first: each record only moves up, over bytes already moved out of its way
+	sort(records.begin(), records.end(), greater<pair<u16, RecordID>>());
+	uint end = get_block_size();  // one past the last byte not yet filled
+	for (auto const& record: records) {
+		u16 size, loc;
+		get_header(size, loc, record.second);
+		u16 new_loc = (u16)(end - size);
+		if (new_loc != loc)
+			memmove(this->address(new_loc), this->address(loc), size);
+		put_header(record.second, size, new_loc);
+		end = new_loc;
 	}
-
-	u16 begin_offset, begin_size;
-	get_header(begin_size, begin_offset, begin_record_id);
-
-	u16 shift_block_size = begin_offset + begin_size - 1 - this->end_free;
-
-	char temperary[shift_block_size];
-	memcpy(temperary, this->address(this->end_free + 1), shift_block_size);
-	
-	if (left)
-	{
-		memcpy(this->address(this->end_free + 1 - shift_offset), temperary, shift_block_size);
-	}
-	else
-	{
-		memcpy(this->address(this->end_free + 1 + shift_offset), temperary, shift_block_size);
-	}
-
-	for(RecordID i = begin_record_id; i <= this->num_records; i++)
-	{
-		if (have_record(i))
-		{
-			u16 temp_offset, temp_size;
-			get_header(temp_size, temp_offset, i);
-
-			if (left)
-			{
-				put_header(i, temp_size, temp_offset-shift_offset);
-			}
-			else
-			{
-				put_header(i, temp_size, temp_offset+shift_offset);
-			}
-		}
-	}
-
-	this->end_free = left ? this->end_free - shift_offset : this->end_free + shift_offset;
-
+	this->end_free = (u16)(end - 1);
+	this->hole_bytes = 0;
 	put_header();
 }
 
@@ -237,7 +241,7 @@ void SlottedPage::get_header(u16 &size, u16 &loc, RecordID id) const {
 	
 	if (id == 0 && size == 0)
 	{
-		loc = DbBlock::BLOCK_SZ - 1;
+		loc = get_block_size() - 1;
 	}
 	else
 	{
@@ -255,10 +259,12 @@ void SlottedPage::put_header(RecordID id, u16 size, u16 loc){
 	put_n(4*id +2, loc);
 }
 
-//returns true if there is enough room in the SlottedPage for the new record of size
-bool SlottedPage::has_room(u16 size) const {
-	u16 free = (this->end_free - ((this->num_records + 2) *4));//subtract the new header room from free space as well
-	return (size <= free);
+//returns true if there is enough room in the SlottedPage for the new record of size, counting the holes
+bool SlottedPage::has_room(uint size) const {
+	if (size > max_record_size(get_block_size()))
+		return false;
+	int free = contiguous() + (int)holes() - 4;//subtract the new header room from free space as well (signed: a full page goes negative)
+	return ((int)size <= free);
 }
 
 //get 2-byte int at given offset in block, author K.Lundeen
@@ -277,14 +283,84 @@ void* SlottedPage::address(u16 offset) const {
 	return (void*)((char*)this->block.get_data()+offset);
 }
 
+/**
+ * @class HeapFileCursor - heap file implementation of DbBlockCursor
+ */
+
+//opens a Berkeley DB cursor on the (already open) RecNo file; with locking, only inside a transaction,
+//which is the locker the buffer pool's write-backs use too
+HeapFileCursor::HeapFileCursor(HeapFile &file) : DbBlockCursor(), file(file), dbc(nullptr), started(false),
+		block_id(0), disk_block_id(0), buffer(new char[file.get_block_size()]), disk_data(buffer, file.get_block_size()) {
+	this->disk_data.set_ulen(file.get_block_size());
+	this->disk_data.set_flags(DB_DBT_USERMEM);
+	DbTxn *txn = TransactionManager::instance().current();
+	if (txn != nullptr || !(HeapFile::environment_flags() & DB_INIT_LOCK))
+		file.db.cursor(txn, &this->dbc, 0);
+}
+
+HeapFileCursor::~HeapFileCursor() {
+	close();
+	delete[] this->buffer;
+}
+
+//returns the next block in the file, or nullptr once we've walked off the end
+//(a block resident in the buffer pool is returned from there since it may be newer than disk)
+SlottedPage* HeapFileCursor::next() {
+	BlockID next_id = this->block_id + 1;
+	if (next_id > this->file.get_last_block_id())
+		return nullptr;
+
+	// bring the Berkeley DB cursor up to (or past) the block we want
+	while (this->dbc != nullptr && this->disk_block_id < next_id) {
+		db_recno_t recno;
+		Dbt key(&recno, sizeof(recno));
+		key.set_ulen(sizeof(recno));
+		key.set_flags(DB_DBT_USERMEM);
+		int ret = this->dbc->get(&key, &this->disk_data, this->started ? DB_NEXT : DB_FIRST);
+		this->started = true;
+		if (ret == DB_NOTFOUND)
+			close();
+		else
+			this->disk_block_id = recno;
+	}
+	this->block_id = next_id;
+
+	BufferFrame *frame = BufferPool::instance().pin_if_resident(&this->file, next_id);
+	if (frame != nullptr) {
+		Dbt cached(frame->data, frame->size);
+		return new SlottedPage(cached, next_id, false, frame);
+	}
+	if (this->dbc != nullptr && this->disk_block_id == next_id)
+		return new SlottedPage(this->disk_data, next_id, false);
+	return this->file.get(next_id);
+}
+
+//releases the Berkeley DB cursor (safe to call more than once)
+void HeapFileCursor::close() {
+	if (this->dbc != nullptr) {
+		this->dbc->close();
+		this->dbc = nullptr;
+	}
+}
+
 /**
  * @class HeapFile - heap file implementation of DbFile
  */
 
-HeapFile::HeapFile(string name) : DbFile(name), dbfilename(""), last(0), closed(true), db(_DB_ENV, 0) {
+HeapFile::HeapFile(string name, uint block_size) : DbFile(name), dbfilename(""), block_size(block_size), last(0), closed(true),
+		latch(), db(_DB_ENV, 0) {
+	if (!DbBlock::is_valid_block_size(block_size))
+		throw DbRelationError("invalid page size " + to_string(block_size));
 	this->dbfilename = this->name + ".db";
 }
 
+//writes back anything we dirtied in the buffer pool before the handle goes away
+HeapFile::~HeapFile() {
+	TransactionManager::instance().forget(this);
+	BufferPool::instance().release(this);
+	close();
+}
+
 //creates the file using the Berkeley DB based on this architecture
 void HeapFile::create(void){
 	this->db_open (DB_CREATE | DB_EXCL);
@@ -294,6 +370,7 @@ void HeapFile::create(void){
 
 //deletes the file
 void HeapFile::drop(void){
+	BufferPool::instance().discard(this);
 	close();
 	//stdio
 	//remove(this->dbfilename.c_str());
@@ -308,44 +385,75 @@ void  HeapFile::open(void){
 
 //closes the database
 void HeapFile::close(void){
+	lock_guard<recursive_mutex> guard(this->latch);
 	if (!this->closed)
 	{
+		BufferPool::instance().flush(this);
 		this->db.close(0);
 		this->closed = true;
 	}
 }
 
-//gets a new page to use with Berkeley db, by passing a blank to db for mem managing
+//appends a new, empty page to the file; the page only exists in the buffer pool until it is written back
 SlottedPage* HeapFile::get_new(void){
-	char block[SlottedPage::BLOCK_SZ];//changed from DB_BLOCK_SZ
-	std::memset(block, 0, sizeof(block));
-	Dbt data(block, sizeof(block));
+	lock_guard<recursive_mutex> guard(this->latch);
+	BufferPool &pool = BufferPool::instance();
+	BlockID block_id = ++this->last;
+	TransactionManager::instance().touched(this);
+	BufferFrame *frame = pool.pin(this, block_id, true);
+	Dbt data(frame->data, this->block_size);
+	SlottedPage* page = new SlottedPage(data, block_id, true, frame);
+	pool.mark_dirty(frame, this);
+	return page;
+}
 
-	int block_id = ++this->last;
+//gets the page at the block_id given, pinned in the buffer pool (read from Berkeley DB on a miss)
+SlottedPage* HeapFile::get(BlockID block_id){
+	BufferFrame *frame = BufferPool::instance().pin(this, block_id);
+	Dbt data(frame->data, this->block_size);
+	return new SlottedPage(data, block_id, false, frame);
+}
+
+//puts a block in the buffer pool, to be written back to Berkeley DB later
+void HeapFile::put(DbBlock* block){
+	BufferPool &pool = BufferPool::instance();
+	BufferFrame *frame = pool.pin(this, block->get_block_id(), true);
+	if (frame->data != block->get_data())
+		memcpy(frame->data, block->get_data(), this->block_size);
+	pool.mark_dirty(frame, this);
+	pool.unpin(frame);
+	TransactionManager::instance().touched(this);
+}
+
+//reads a block from Berkeley DB straight into the given buffer (used by the buffer pool)
+void HeapFile::read_block(BlockID block_id, char *data){
+	this->open();
+	Dbt value(data, this->block_size);
+	value.set_ulen(this->block_size);
+	value.set_flags(DB_DBT_USERMEM);
 	Dbt key(&block_id, sizeof(block_id));
-	
-	//write out an empty block and read it back in so Berkeley DB is managing the memory.
-	this->db.put(nullptr, &key, &data, 0); //write it out with initialization applied
-	this->db.get(nullptr, &key, &data, 0);
-	
-	return new SlottedPage(data, this->last, true);
+	this->db.get(TransactionManager::instance().current(), &key, &value, 0);
 }
 
-//gets the page at the block_id given
-SlottedPage* HeapFile::get(BlockID block_id){
-	char block[SlottedPage::BLOCK_SZ];
-	std::memset(block, 0, sizeof(block));
-	Dbt data(block, sizeof(block));
+//writes a block to Berkeley DB (used by the buffer pool)
+void HeapFile::write_block(BlockID block_id, char *data){
+	this->open();
+	Dbt value(data, this->block_size);
 	Dbt key(&block_id, sizeof(block_id));
-	this->db.get(nullptr, &key, &data,0);
-	return new SlottedPage(data, block_id, false);
+	this->db.put(TransactionManager::instance().current(), &key, &value, 0);
 }
 
-//puts a block in the database
-void HeapFile::put(DbBlock* block){
-	BlockID id = block->get_block_id();
-	Dbt key(&id, sizeof(id));
-	this->db.put(nullptr, &key, block->get_block(), 0);
+//cuts the file back to last blocks; the records after it are deleted from the RecNo file
+void HeapFile::truncate(BlockID last){
+	lock_guard<recursive_mutex> guard(this->latch);
+	this->open();
+	BufferPool::instance().discard(this, last + 1);
+	for (BlockID block_id = this->last; block_id > last; block_id--) {
+		Dbt key(&block_id, sizeof(block_id));
+		this->db.del(TransactionManager::instance().current(), &key, 0);  // not there if never written back
+	}
+	this->last = last;
+	TransactionManager::instance().touched(this);
 }
 
 //returns a list of all used blockIDs, similar to RecordIDs
@@ -357,29 +465,344 @@ BlockIDs* HeapFile::block_ids() const {
 	
 }
 
+//returns a cursor which walks every block of the file in order (freed by caller)
+HeapFileCursor* HeapFile::cursor() {
+	this->open();
+	return new HeapFileCursor(*this);
+}
+
+u_int32_t HeapFile::environment_flags() {
+	u_int32_t flags = 0;
+	if (_DB_ENV != nullptr)
+		_DB_ENV->get_open_flags(&flags);
+	return flags;
+}
+
+//recount the blocks on disk (after a rollback took back the ones a transaction appended)
+void HeapFile::refresh() {
+	lock_guard<recursive_mutex> guard(this->latch);
+	if (!this->closed)
+		this->last = get_block_count();
+}
+
+//the number of the last record rather than a count, since truncate() leaves deleted records behind it
 uint32_t HeapFile::get_block_count() {
-	DB_BTREE_STAT* stat;
-	this->db.stat(nullptr, &stat, DB_FAST_STAT);
-	return stat->bt_ndata;
+	Dbc *dbc;
+	this->db.cursor(TransactionManager::instance().current(), &dbc, 0);
+	db_recno_t recno = 0;
+	Dbt key(&recno, sizeof(recno));
+	key.set_ulen(sizeof(recno));
+	key.set_flags(DB_DBT_USERMEM);
+	unique_ptr<char[]> buffer(new char[this->block_size]);
+	Dbt data(buffer.get(), this->block_size);
+	data.set_ulen(this->block_size);
+	data.set_flags(DB_DBT_USERMEM);
+	int ret;
+	try {
+		ret = dbc->get(&key, &data, DB_LAST);
+	} catch (DbException &e) {
+		dbc->close();
+		throw;
+	}
+	dbc->close();
+	return ret == DB_NOTFOUND ? 0 : recno;
 }
 
 //uses Berkeley db to initialize a database based on the file. 0 is the common flag.
 void HeapFile::db_open(uint flags){
+	if (!this->closed){
+		return;  // without the latch: the buffer pool calls this holding its own latch
+	}
+	lock_guard<recursive_mutex> guard(this->latch);
 	if (!this->closed){
 		return;
 	}
-	this->db.set_re_len(SlottedPage::BLOCK_SZ);
-	this->db.open(NULL, (this->dbfilename).c_str(), NULL, DB_RECNO, flags,0);
-	this->last = flags ? 0 : get_block_count();
+	this->db.set_re_len(this->block_size);
+	uint open_flags = flags | (environment_flags() & DB_THREAD);
+	if (environment_flags() & DB_INIT_TXN)
+		open_flags |= DB_AUTO_COMMIT;  // opening (and creating) the file is its own little transaction
+	this->db.open(NULL, (this->dbfilename).c_str(), NULL, DB_RECNO, open_flags, 0);
 	this->closed = false;
+	if (!flags)
+		BufferPool::instance().flush(this);  // another handle may have blocks for this file not yet on disk
+	this->last = flags ? 0 : get_block_count();
+}
+
+/**
+ * @class RecordFilter - where-clause predicates compiled against a HeapTable's record layout
+ */
+
+RecordFilter::RecordFilter(const ColumnNames& column_names, const ColumnAttributes& column_attributes,
+		const Conjunction& where) : layout(), offsets(), tests(), never(false) {
+	compile(column_names, column_attributes);
+	for (auto const& predicate: where)
+		add(column_names, predicate);
+	std::stable_sort(this->tests.begin(), this->tests.end(),
+			[](const Test& a, const Test& b) { return a.column < b.column; });
+}
+
+RecordFilter::RecordFilter(const ColumnNames& column_names, const ColumnAttributes& column_attributes,
+		const ValueDict& where) : layout(), offsets(), tests(), never(false) {
+	compile(column_names, column_attributes);
+	for (auto const& column: where)
+		add(column_names, Predicate(column.first, Predicate::EQ, column.second));
+	std::stable_sort(this->tests.begin(), this->tests.end(),
+			[](const Test& a, const Test& b) { return a.column < b.column; });
+}
+
+// work out each column's type and, up to the first TEXT column, its offset
+void RecordFilter::compile(const ColumnNames& column_names, const ColumnAttributes& column_attributes) {
+	int offset = 0;
+	for (uint i = 0; i < column_names.size(); i++) {
+		ColumnAttribute ca = column_attributes[i];
+		ColumnAttribute::DataType data_type = ca.get_data_type();
+		this->layout.push_back(data_type);
+		this->offsets.push_back(offset);
+		if (offset < 0)
+			continue;
+		if (data_type == ColumnAttribute::DataType::INT)
+			offset += sizeof(int32_t);
+		else if (data_type == ColumnAttribute::DataType::BOOLEAN)
+			offset += sizeof(uint8_t);
+		else
+			offset = -1;
+	}
+}
+
+void RecordFilter::add(const ColumnNames& column_names, const Predicate& predicate) {
+	auto it = std::find(column_names.begin(), column_names.end(), predicate.column_name);
+	if (it == column_names.end())
+		throw DbRelationError("table does not have column named '" + predicate.column_name + "'");
+
+	Test test;
+	test.column = (uint)(it - column_names.begin());
+	test.op = predicate.op;
+	ColumnAttribute::DataType data_type = this->layout[test.column];
+	for (auto const& operand: predicate.operands) {
+		if (operand.data_type != data_type)
+			this->never = true;  // as with Value::operator==, values of different types never match
+		else if (data_type == ColumnAttribute::DataType::TEXT)
+			test.texts.push_back(operand.s);
+		else
+			test.ints.push_back(operand.n);
+	}
+	this->tests.push_back(test);
+}
+
+// turn a three-way comparison of column value to operand into the predicate's answer
+bool RecordFilter::passes(Predicate::Op op, int comparison) {
+	switch (op) {
+		case Predicate::EQ:
+		case Predicate::IN:
+			return comparison == 0;
+		case Predicate::NE:
+			return comparison != 0;
+		case Predicate::LT:
+			return comparison < 0;
+		case Predicate::LE:
+			return comparison <= 0;
+		case Predicate::GT:
+			return comparison > 0;
+		case Predicate::GE:
+			return comparison >= 0;
+		default:
+			return false;
+	}
+}
+
+bool RecordFilter::matches(const char* record) const {
+	if (this->never)
+		return false;
+
+	uint column = 0;
+	uint offset = 0;
+	for (auto const& test: this->tests) {
+		// find the column: by its fixed offset if it has one, otherwise by stepping over fields
+		if (this->offsets[test.column] >= 0) {
+			column = test.column;
+			offset = (uint) this->offsets[test.column];
+		}
+		for (; column < test.column; column++) {
+			if (this->layout[column] == ColumnAttribute::DataType::INT)
+				offset += sizeof(int32_t);
+			else if (this->layout[column] == ColumnAttribute::DataType::BOOLEAN)
+				offset += sizeof(uint8_t);
+			else
+				offset += sizeof(u16) + *(u16*)(record + offset);
+		}
+
+		const char* field = record + offset;
+		uint passed = 0;
+		if (this->layout[test.column] == ColumnAttribute::DataType::TEXT) {
+			u16 size = *(u16*)field;
+			const char* text = field + sizeof(u16);
+			for (uint i = 0; i < test.texts.size(); i++) {
+				const std::string& operand = test.texts[i];
+				int comparison = memcmp(text, operand.data(), std::min((size_t)size, operand.size()));
+				if (comparison == 0)
+					comparison = (int)size - (int)operand.size();
+				Predicate::Op op = test.op != Predicate::BETWEEN ? test.op : (i == 0 ? Predicate::GE : Predicate::LE);
+				if (passes(op, comparison))
+					passed++;
+			}
+		} else {
+			int32_t value = this->layout[test.column] == ColumnAttribute::DataType::INT
+					? *(int32_t*)field : (int32_t)*(uint8_t*)field;
+			for (uint i = 0; i < test.ints.size(); i++) {
+				int32_t operand = test.ints[i];
+				int comparison = (value > operand) - (value < operand);
+				Predicate::Op op = test.op != Predicate::BETWEEN ? test.op : (i == 0 ? Predicate::GE : Predicate::LE);
+				if (passes(op, comparison))
+					passed++;
+			}
+		}
+		// IN needs one operand to match; the others (BETWEEN's two included) need every one to
+		uint operands = (uint)(test.texts.size() + test.ints.size());
+		if (test.op == Predicate::IN ? passed == 0 : passed != operands)
+			return false;
+	}
+	return true;
+}
+
+/**
+ * @class FreeSpaceMap - how much room each block of a HeapFile has, kept in a file of its own
+ */
+
+FreeSpaceMap::FreeSpaceMap(string name, uint block_size) : file(name), unit(block_size / 256), opened(false),
+		lock(), bounds(), rollbacks_seen(0) {
+}
+
+void FreeSpaceMap::create() {
+	this->file.create();
+	unique_ptr<SlottedPage> page(this->file.get(1));
+	memset(page->get_data(), 0, DbBlock::BLOCK_SZ);  // raw bytes, not a slotted page
+	this->file.put(page.get());
+	this->opened = true;
+	lock_guard<mutex> guard(this->lock);
+	this->bounds.clear();
+}
+
+// a table from before free-space maps doesn't have one to drop
+void FreeSpaceMap::drop() {
+	lock_guard<mutex> guard(this->lock);
+	this->bounds.clear();
+	this->opened = false;
+	try {
+		this->file.drop();
+	} catch (DbException &e) {
+	}
+}
+
+void FreeSpaceMap::open(HeapFile &heap) {
+	if (this->opened)
+		return;
+	try {
+		this->file.open();
+		this->opened = true;
+	} catch (DbException &e) {
+		// no map yet: build one from the blocks themselves
+		create();
+		unique_ptr<HeapFileCursor> blocks(heap.cursor());
+		for (SlottedPage *block = blocks->next(); block != nullptr; block = blocks->next()) {
+			update(block->get_block_id(), block->free_space());
+			delete block;
+		}
+	}
+}
+
+void FreeSpaceMap::close() {
+	lock_guard<mutex> guard(this->lock);
+	this->bounds.clear();
+	this->opened = false;
+	this->file.close();
+}
+
+BlockID FreeSpaceMap::find(uint size) {
+	uint needed = (size + this->unit - 1) / this->unit;
+	if (needed == 0)
+		needed = 1;
+	if (needed > UINT8_MAX)
+		return 0;
+	lock_guard<mutex> guard(this->lock);
+	load_bounds();
+	for (BlockID page_id = 1; page_id <= this->bounds.size(); page_id++) {
+		if (this->bounds[page_id - 1] < needed)
+			continue;
+		unique_ptr<SlottedPage> page(this->file.get(page_id));
+		uint8_t *bytes = (uint8_t*) page->get_data();
+		uint8_t largest = 0;
+		for (uint i = 1; i <= BLOCKS_PER_PAGE; i++) {
+			if (bytes[i] >= needed)
+				return (page_id - 1) * BLOCKS_PER_PAGE + i;
+			largest = max(largest, bytes[i]);
+		}
+		// nothing here after all: tighten the bound so we don't look again
+		bytes[0] = largest;
+		this->file.put(page.get());
+		this->bounds[page_id - 1] = largest;
+	}
+	return 0;
+}
+
+void FreeSpaceMap::update(BlockID block_id, uint free_bytes) {
+	BlockID page_id = (block_id - 1) / BLOCKS_PER_PAGE + 1;
+	uint i = (block_id - 1) % BLOCKS_PER_PAGE + 1;
+	uint8_t value = category(free_bytes);
+	lock_guard<mutex> guard(this->lock);
+	load_bounds();
+	while (this->file.get_last_block_id() < page_id) {
+		unique_ptr<SlottedPage> page(this->file.get_new());
+		memset(page->get_data(), 0, DbBlock::BLOCK_SZ);
+		this->file.put(page.get());
+		this->bounds.push_back(0);
+	}
+	unique_ptr<SlottedPage> page(this->file.get(page_id));
+	uint8_t *bytes = (uint8_t*) page->get_data();
+	if (bytes[i] == value)
+		return;  // don't dirty the block for nothing
+	bytes[i] = value;
+	if (value > bytes[0])
+		bytes[0] = value;
+	this->file.put(page.get());
+	this->bounds[page_id - 1] = bytes[0];
+}
+
+// free bytes in units of 1/256 of a heap block, rounded down so a record that fits by the map really fits
+uint8_t FreeSpaceMap::category(uint free_bytes) const {
+	return (uint8_t) min(free_bytes / this->unit, (uint) UINT8_MAX);
+}
+
+// (re)read byte 0 of every map block, unless we have them and there's been no rollback since
+void FreeSpaceMap::load_bounds() {
+	u_long rollbacks = TransactionManager::instance().get_rollbacks();
+	if (rollbacks != this->rollbacks_seen) {
+		this->bounds.clear();
+		this->rollbacks_seen = rollbacks;
+	}
+	if (this->bounds.size() == this->file.get_last_block_id())
+		return;
+	this->bounds.clear();
+	for (BlockID page_id = 1; page_id <= this->file.get_last_block_id(); page_id++) {
+		unique_ptr<SlottedPage> page(this->file.get(page_id));
+		this->bounds.push_back(((uint8_t*) page->get_data())[0]);
+	}
 }
 
 /**
  * @class HeapTable - Heap storage engine (implementation of DbRelation)
  */
 
-HeapTable::HeapTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes ) :
-		DbRelation(table_name, column_names, column_attributes), file(table_name) {
+uint HeapTable::scan_threads = 1;
+
+HeapTable::HeapTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes, uint block_size) :
+		DbRelation(table_name, column_names, column_attributes), file(table_name, block_size),
+		fsm(table_name + ".fsm", block_size) {
+}
+
+void HeapTable::set_scan_threads(uint threads) {
+	if (threads == 0)
+		threads = std::max(1u, thread::hardware_concurrency());
+	scan_threads = threads;
 }
 
 /*
@@ -387,6 +810,9 @@ HeapTable::HeapTable(Identifier table_name, ColumnNames column_names, ColumnAttr
  */
 void HeapTable::create(){ //
 	this->file.create();
+	this->fsm.create();
+	unique_ptr<SlottedPage> first(this->file.get(1));
+	this->fsm.update(1, first->free_space());
 }
 
 /*
@@ -394,6 +820,7 @@ void HeapTable::create(){ //
  */
 void HeapTable::drop(){
    this->file.drop();
+   this->fsm.drop();
 }
 
 /*
@@ -401,12 +828,14 @@ void HeapTable::drop(){
  */
 void HeapTable::open(){
 	this->file.open();
+	this->fsm.open(this->file);
 }
 
 /*
  * closes heapfile when done
  */
 void HeapTable::close(){
+	this->fsm.close();
 	this->file.close();
 }
 
@@ -439,6 +868,56 @@ Handle HeapTable::insert(const ValueDict* row){
 	return handle;
 }
 
+/*
+ * inserts a list of rows, filling each page in memory before putting it
+ * @param ValueDicts* rows to insert into relation (all validated before any is stored)
+ * @return Handles* to the new rows, in the same order (freed by caller)
+ */
+Handles* HeapTable::insert_batch(const ValueDicts* rows){
+	this->open();
+	
+	ValueDicts full_rows;
+	try {
+		for (auto const& row: *rows)
+			full_rows.push_back(validate(row));
+	} catch (...) {
+		for (auto full_row: full_rows)
+			delete full_row;
+		throw;
+	}
+	
+	Handles* handles = new Handles();
+	SlottedPage* block = nullptr;
+	try {
+		for (auto const& full_row: full_rows) {
+			unique_ptr<Dbt> data(this->marshal(full_row));
+			unique_ptr<char[]> bytes((char*)data->get_data());
+			if (block != nullptr && block->free_space() < data->get_size()) {
+				SlottedPage* full = block;
+				block = nullptr;
+				put_block(full);
+			}
+			if (block == nullptr)
+				block = block_with_room(data->get_size());
+			RecordID record_id = block->add(data.get());
+			handles->push_back(Handle(block->get_block_id(), record_id));
+		}
+	} catch (...) {
+		if (block != nullptr)
+			put_block(block);
+		for (auto full_row: full_rows)
+			delete full_row;
+		delete handles;
+		throw;
+	}
+	if (block != nullptr)
+		put_block(block);
+	
+	for (auto full_row: full_rows)
+		delete full_row;
+	return handles;
+}
+
 /*
  * changes existing row. unimplemented stub
  * @param Handle contining blockID and RecordID to update, and ValuDict 
@@ -457,6 +936,35 @@ void HeapTable::del(const Handle handle){
 	std::unique_ptr<SlottedPage> slotted_page(this->file.get(handle.first));
 	slotted_page->del(handle.second);
 	this->file.put(slotted_page.get());
+	this->fsm.update(handle.first, slotted_page->free_space());
+}
+
+/*
+ * does one step of VACUUM (see heap_storage.h)
+ * @param progress where the last step left off; updated
+ * @param blocks   how many blocks the step may empty or compact
+ * @param moved    set to the rows the step moved
+ * @return true once there's nothing left to do
+ */
+bool HeapTable::vacuum(VacuumProgress &progress, uint blocks, Relocations &moved){
+	this->open();
+	moved.clear();
+	bool done = false;
+	for (uint step = 0; step < blocks && !done; step++) {
+		BlockID last = this->file.get_last_block_id();
+		if (progress.next_block <= last) {
+			compact_block(progress.next_block++, moved);
+		} else if (last > 1 && empty_block(last, moved)) {
+			this->file.truncate(last - 1);
+			this->fsm.update(last, 0);
+			progress.blocks_freed++;
+		} else {
+			compact_block(last, moved);  // the rows that wouldn't fit any further forward
+			done = true;
+		}
+	}
+	progress.rows_moved += moved.size();
+	return done;
 }
 
 /*
@@ -464,86 +972,179 @@ void HeapTable::del(const Handle handle){
  * @return a Handles List, of Handles pointing to each row returned
  */
 Handles* HeapTable::select() {
+	return select_filtered(nullptr);
+}
+/*
+ * walks the file's blocks with a cursor and keeps the rows matching where
+ * @param the where clause on which to filter rows (nullptr for all rows)
+ * @return the Handles which point to the desired rows
+ */
+Handles* HeapTable::select(const ValueDict* where){
+	if (where == nullptr)
+		return select_filtered(nullptr);
+	RecordFilter filter(this->column_names, this->column_attributes, *where);
+	return select_filtered(&filter);
+}
+
+// Scan the table for rows passing every predicate
+Handles* HeapTable::select(const Conjunction& where){
+	delete check(where);
+	RecordFilter filter(this->column_names, this->column_attributes, where);
+	return select_filtered(&filter);
+}
+
+// Scan the table, testing each record in place in the block the cursor just read (nullptr filter for all rows)
+Handles* HeapTable::select_filtered(const RecordFilter* filter){
 	this->open();
+	if (scan_threads > 1 && this->file.get_last_block_id() >= PARALLEL_MIN_BLOCKS)
+		return select_parallel(filter, scan_threads);
 	
 	Handles* handles = new Handles();
-	BlockIDs* blockIDs = file.block_ids();
-	for (auto const& blockID: *blockIDs){
-		SlottedPage *block = file.get(blockID);
-		RecordIDs* record_ids = block->ids();
-		for (auto const& record_id: *record_ids)
-		{
-			handles->push_back(Handle(blockID, record_id));
+	unique_ptr<HeapFileCursor> cursor(file.cursor());
+	
+	try {
+		for (SlottedPage *block = cursor->next(); block != nullptr; block = cursor->next()){
+			unique_ptr<SlottedPage> page(block);
+			unique_ptr<RecordIDs> record_ids(block->ids());
+			
+			for (auto const& record_id: *record_ids)
+			{
+				if (filter == nullptr || selected(block, record_id, *filter))
+				{
+					handles->push_back(Handle(block->get_block_id(), record_id));
+				}
+			}
 		}
-		delete record_ids;
-		delete block;
+	} catch (...) {
+		delete handles;
+		throw;
 	}
 	
-	delete blockIDs;
-	
 	return handles;
 }
+
 /*
- * eventually will implement where here filter here
- * @param the where clause on which to filter rows
- * @return the Handles which point to the desired rows
+ * Scan the table on the TaskScheduler. The block range is cut into morsels of MORSEL_BLOCKS
+ * which up to threads tasks claim off a shared counter; each morsel's handles go into their
+ * own list, and the lists are joined in block order at the end, so the result is the same as
+ * a serial scan's.
+ * @param filter   rows to keep (nullptr for all rows)
+ * @param threads  most tasks to split the scan into
  */
-Handles* HeapTable::select(const ValueDict* where){
-	this->open();
+Handles* HeapTable::select_parallel(const RecordFilter* filter, uint threads){
+	BlockID last = this->file.get_last_block_id();
+	uint morsel_count = (last + MORSEL_BLOCKS - 1) / MORSEL_BLOCKS;
+	vector<Handles> morsels(morsel_count);
+	atomic<uint> next_morsel(0);
+	
+	auto work = [&]() {
+		for (uint m = next_morsel++; m < morsel_count; m = next_morsel++) {
+			BlockID first = m * MORSEL_BLOCKS + 1;
+			BlockID end = std::min(first + MORSEL_BLOCKS - 1, last);
+			for (BlockID block_id = first; block_id <= end; block_id++) {
+				unique_ptr<SlottedPage> block(this->file.get(block_id));
+				unique_ptr<RecordIDs> record_ids(block->ids());
+				for (auto const& record_id: *record_ids)
+					if (filter == nullptr || selected(block.get(), record_id, *filter))
+						morsels[m].push_back(Handle(block_id, record_id));
+			}
+		}
+	};
+	
+	TaskGroup tasks;
+	for (uint i = 0; i < std::min(threads, morsel_count); i++)
+		tasks.run([&]() {
+			try {
+				work();
+			} catch (...) {
+				next_morsel = morsel_count;  // the others can stop too
+				throw;
+			}
+		});
+	tasks.wait();
 	
 	Handles* handles = new Handles();
-	BlockIDs* blockIDs = file.block_ids();
+	for (auto const& morsel: morsels)
+		handles->insert(handles->end(), morsel.begin(), morsel.end());
+	return handles;
+}
+
+// Every row's handle and projected values, projected off each block as the cursor reads it
+ValueDicts* HeapTable::scan(const ColumnNames* column_names, Handles* handles){
+	this->open();
 	
-	for (auto const& blockID: *blockIDs){
-		SlottedPage *block = file.get(blockID);
-		RecordIDs* record_ids = block->ids();
-		
-		for (auto const& record_id: *record_ids)
-		{
-			Handle handle(blockID, record_id);
+	ValueDicts* rows = new ValueDicts();
+	unique_ptr<HeapFileCursor> cursor(file.cursor());
+	
+	try {
+		for (SlottedPage *block = cursor->next(); block != nullptr; block = cursor->next()){
+			unique_ptr<SlottedPage> page(block);
+			unique_ptr<RecordIDs> record_ids(block->ids());
 			
-			if (selected(handle, where))
+			for (auto const& record_id: *record_ids)
 			{
-				handles->push_back(handle);
+				rows->push_back(project(block, record_id, column_names));
+				handles->push_back(Handle(block->get_block_id(), record_id));
 			}
 		}
-		
-		delete record_ids;
-		delete block;
+	} catch (...) {
+		for (auto row: *rows)
+			delete row;
+		delete rows;
+		throw;
 	}
 	
-	delete blockIDs;
-	
-	return handles;
+	return rows;
+}
+
+// A batch cursor decoding the requested columns straight out of each block
+DbBatchCursor* HeapTable::batch_cursor(const ColumnNames& column_names) {
+	this->open();
+
+	vector<int> batch_columns(this->column_names.size(), -1);
+	for (uint i = 0; i < column_names.size(); i++) {
+		auto it = std::find(this->column_names.begin(), this->column_names.end(), column_names[i]);
+		if (it == this->column_names.end())
+			throw DbRelationError("table does not have column named '" + column_names[i] + "'");
+		batch_columns[it - this->column_names.begin()] = (int) i;
+	}
+	return new HeapBatchCursor(this->file, this->column_attributes, batch_columns);
 }
 
 // Refine another selection
 Handles* HeapTable::select(Handles *current_selection, const ValueDict* where) {
-    Handles* handles = new Handles();
-    for (auto const& handle: *current_selection)
-        if (selected(handle , where))
-            handles->push_back(handle);
-    return handles;
+	if (where == nullptr)
+		return new Handles(*current_selection);
+	RecordFilter filter(this->column_names, this->column_attributes, *where);
+	return select_filtered(current_selection, filter);
+}
+
+// Refine another selection
+Handles* HeapTable::select(Handles *current_selection, const Conjunction& where) {
+	delete check(where);
+	RecordFilter filter(this->column_names, this->column_attributes, where);
+	return select_filtered(current_selection, filter);
 }
 
-// See if the row at the given handle satisfies the given where clause
-bool HeapTable::selected(Handle handle, const ValueDict* where) {
+// Refine another selection, fetching each block once for a run of handles into it
+Handles* HeapTable::select_filtered(Handles *current_selection, const RecordFilter& filter) {
 	this->open();
 	
-	if (where == nullptr)
-		return true;
-	
-	unique_ptr<ValueDict> row(this->DbRelation::project(handle, where));
-	
-	for(auto const& pair : *where)
-	{
-		if (row->find(pair.first) == row->end() || row->at(pair.first) != pair.second)
-		{
-			return false;
-		}
+	Handles* handles = new Handles();
+	unique_ptr<SlottedPage> block;
+	for (auto const& handle: *current_selection) {
+		if (!block || block->get_block_id() != handle.first)
+			block.reset(this->file.get(handle.first));
+		if (selected(block.get(), handle.second, filter))
+			handles->push_back(handle);
 	}
-	
-	return true;
+	return handles;
+}
+
+// See if a record in an already-fetched block passes the filter
+bool HeapTable::selected(const SlottedPage* block, RecordID record_id, const RecordFilter& filter) {
+	const char* record = block->get_record(record_id);
+	return record != nullptr && filter.matches(record);
 }
 
 /*
@@ -563,15 +1164,19 @@ ValueDict* HeapTable::project(Handle handle){
 ValueDict* HeapTable::project(Handle handle, const ColumnNames* column_names){
 	this->open();
 	
-	BlockID block_id = handle.first;
-	RecordID record_id = handle.second;
-	
-	SlottedPage* block = this->file.get(block_id);
-	Dbt* data = block->get(record_id);
-	ValueDict* row = this->unmarshal(data);
-	
-	delete data;
-	delete block;
+	unique_ptr<SlottedPage> block(this->file.get(handle.first));
+	return project(block.get(), handle.second, column_names);
+}
+
+/*
+ * projects a record straight out of an already-fetched block
+ * @param  block        block holding the record
+ * @param  record_id    which record in block
+ * @param  ColumnNames  a list of columns to project (nullptr or empty for all)
+ */
+ValueDict* HeapTable::project(const SlottedPage* block, RecordID record_id, const ColumnNames* column_names){
+	unique_ptr<Dbt> data(block->get(record_id));
+	ValueDict* row = this->unmarshal(data.get());
 	
 	if (column_names == nullptr || column_names->empty()) {
 		return row;
@@ -583,6 +1188,8 @@ ValueDict* HeapTable::project(Handle handle, const ColumnNames* column_names){
 	{
 		if (row->find(column_name) == row->end())
 		{
+			delete row;
+			delete toReturn;
 			throw DbRelationError("table does not have column named '" + column_name + "'");
 		}
 		
@@ -621,22 +1228,119 @@ Handle HeapTable::append(const ValueDict* row){
 	this->open();
 	
 	Dbt* data = this->marshal(row);
-	SlottedPage* block = this->file.get(this->file.get_last_block_id());
+	SlottedPage* block = block_with_room(data->get_size());
 	RecordID record_id;
 	
    	try {
 		record_id = block->add(data);
 	} catch (DbBlockNoRoomError) {
-		block = this->file.get_new();
-		record_id = block->add(data);
+		delete block;  // too big for even an empty block
+		delete[] (char*)data->get_data();
+		delete data;
+		throw;
 	}
-	this->file.put(block);
+	BlockID block_id = block->get_block_id();
+	put_block(block);
 	
-	delete block;
 	delete[] (char*)data->get_data();
 	delete data;
 	
-	return Handle(this->file.get_last_block_id(), record_id);
+	return Handle(block_id, record_id);
+}
+
+/*
+ * finds a block to add a record to: the first one the free-space map knows has room, or else a new one
+ * @param size bytes of the record
+ * @param before if not 0, only blocks before this one will do (and no new one)
+ * @return the pinned block (freed by caller), or nullptr if before ruled them all out
+ */
+SlottedPage* HeapTable::block_with_room(uint size, BlockID before){
+	for (BlockID block_id = this->fsm.find(size); block_id != 0; block_id = this->fsm.find(size)) {
+		if (before != 0 && block_id >= before)
+			return nullptr;
+		SlottedPage* block = this->file.get(block_id);
+		if (block->free_space() >= size)
+			return block;
+		this->fsm.update(block_id, block->free_space());  // the map was behind
+		delete block;
+	}
+	return before != 0 ? nullptr : this->file.get_new();
+}
+
+/*
+ * puts a changed block back and notes its free space in the map
+ * @param block the block (deleted here)
+ */
+void HeapTable::put_block(SlottedPage* block){
+	this->file.put(block);
+	this->fsm.update(block->get_block_id(), block->free_space());
+	delete block;
+}
+
+/*
+ * moves every row of a block into room earlier in the file
+ * @param block_id the block to empty
+ * @param moved    each row moved is added here
+ * @return true if the block is empty now, false if some row didn't fit anywhere before it
+ */
+bool HeapTable::empty_block(BlockID block_id, Relocations &moved){
+	SlottedPage* block = this->file.get(block_id);
+	unique_ptr<RecordIDs> record_ids(block->ids());
+	bool emptied = true;
+	for (auto const& record_id: *record_ids) {
+		unique_ptr<Dbt> data(block->get(record_id));
+		SlottedPage* target;
+		try {
+			target = block_with_room(data->get_size(), block_id);
+		} catch (...) {
+			put_block(block);
+			throw;
+		}
+		if (target == nullptr) {
+			emptied = false;
+			break;
+		}
+		RecordID new_id = target->add(data.get());
+		moved.push_back(Relocation(Handle(block_id, record_id), Handle(target->get_block_id(), new_id)));
+		put_block(target);
+		block->del(record_id);
+	}
+	if (emptied)
+		delete block;  // about to be cut off
+	else
+		put_block(block);
+	return emptied;
+}
+
+/*
+ * drops the slots of a block's deleted records, renumbering the rows after them
+ * @param block_id the block to compact
+ * @param moved    rows renumbered are added here (or have their entry from earlier in the step updated)
+ */
+void HeapTable::compact_block(BlockID block_id, Relocations &moved){
+	SlottedPage* block = this->file.get(block_id);
+	uint free_before = block->free_space();
+	unique_ptr<RecordIDs> old_ids(block->compact());
+	if (block->free_space() == free_before) {
+		delete block;  // no deleted slots
+		return;
+	}
+	map<RecordID, RecordID> renumbered;
+	for (RecordID new_id = 1; new_id <= old_ids->size(); new_id++)
+		if ((*old_ids)[new_id - 1] != new_id)
+			renumbered[(*old_ids)[new_id - 1]] = new_id;
+	for (auto& relocation: moved) {
+		if (relocation.second.first != block_id)
+			continue;
+		auto it = renumbered.find(relocation.second.second);
+		if (it != renumbered.end()) {
+			relocation.second.second = it->second;  // moved here earlier in the step: one relocation
+			renumbered.erase(it);
+		}
+	}
+	for (auto const& ids: renumbered)
+		moved.push_back(Relocation(Handle(block_id, ids.first), Handle(block_id, ids.second)));
+	put_block(block);
 }
 
 /*
@@ -646,7 +1350,9 @@ Handle HeapTable::append(const ValueDict* row){
  * @return Dbt* containing raw bitstring of row data
 */
 Dbt* HeapTable::marshal(const ValueDict* row) const{
-	char *bytes = new char[DbBlock::BLOCK_SZ]; // more than we need (we insist that one row fits into DbBlock::BLOCK_SZ)
+	uint block_size = this->file.get_block_size();
+	uint max_size = SlottedPage::max_record_size(block_size);  // one row has to fit into one of the file's blocks
+	char *bytes = new char[block_size]; // more than we need
     uint offset = 0;
     uint col_num = 0;
     for (auto const& column_name: this->column_names) {
@@ -655,7 +1361,7 @@ Dbt* HeapTable::marshal(const ValueDict* row) const{
 		Value value = column->second;
 
 		if (ca.get_data_type() == ColumnAttribute::DataType::INT) {
-			if (offset + 4 > DbBlock::BLOCK_SZ - 4)
+			if (offset + 4 > max_size)
 				throw DbRelationError("row too big to marshal");
 			*(int32_t*) (bytes + offset) = value.n;
 			offset += sizeof(int32_t);
@@ -663,14 +1369,14 @@ Dbt* HeapTable::marshal(const ValueDict* row) const{
 			u_long size = value.s.length();
 			if (size > UINT16_MAX)
 				throw DbRelationError("text field too long to marshal");
-			if (offset + 2 + size > DbBlock::BLOCK_SZ)
+			if (offset + 2 + size > max_size)
 				throw DbRelationError("row too big to marshal");
 			*(u16*) (bytes + offset) = size;
 			offset += sizeof(u16);
 			memcpy(bytes+offset, value.s.c_str(), size); // assume ascii for now
 			offset += size;
         } else if (ca.get_data_type() == ColumnAttribute::DataType::BOOLEAN) {
-            if (offset + 1 > DbBlock::BLOCK_SZ - 1)
+            if (offset + 1 > max_size)
                 throw DbRelationError("row too big to marshal");
             *(uint8_t*) (bytes + offset) = (uint8_t)value.n;
             offset += sizeof(uint8_t);
@@ -698,6 +1404,8 @@ ValueDict* HeapTable::unmarshal(Dbt* data) const {
     uint offset = 0;
     uint col_num = 0;
     for (auto const& column_name: this->column_names) {
+    	if (offset >= data->get_size())
+    		break;  // written before the columns after this one were added: they're left out of the row
     	ColumnAttribute ca = this->column_attributes[col_num++];
 		value.data_type = ca.get_data_type();
     	if (ca.get_data_type() == ColumnAttribute::DataType::INT) {
@@ -706,10 +1414,7 @@ ValueDict* HeapTable::unmarshal(Dbt* data) const {
     	} else if (ca.get_data_type() == ColumnAttribute::DataType::TEXT) {
     		u16 size = *(u16*)(bytes + offset);
     		offset += sizeof(u16);
-    		char buffer[DbBlock::BLOCK_SZ];
-    		memcpy(buffer, bytes+offset, size);
-    		buffer[size] = '\0';
-    		value.s = string(buffer);  // assume ascii for now
+    		value.s.assign(bytes + offset, size);  // assume ascii for now
             offset += size;
         } else if (ca.get_data_type() == ColumnAttribute::DataType::BOOLEAN) {
             value.n = *(uint8_t*)(bytes + offset);
@@ -722,6 +1427,76 @@ ValueDict* HeapTable::unmarshal(Dbt* data) const {
     return row;
 }
 
+/**
+ * @class HeapBatchCursor - HeapTable implementation of DbBatchCursor
+ */
+
+HeapBatchCursor::HeapBatchCursor(HeapFile &file, const ColumnAttributes& column_attributes, vector<int> batch_columns)
+		: DbBatchCursor(), cursor(file.cursor()), layout(), batch_columns(batch_columns), block(), record_ids(), position(0) {
+	for (auto ca: column_attributes)
+		this->layout.push_back(ca.get_data_type());
+}
+
+// Fill batch from the current block, then from the blocks after it
+bool HeapBatchCursor::next(ColumnBatch& batch) {
+	batch.clear();
+	while (!batch.full()) {
+		if (this->block == nullptr || this->position >= this->record_ids->size()) {
+			this->record_ids.reset();
+			this->block.reset();  // done with it before the cursor moves on
+			SlottedPage *next = this->cursor->next();
+			if (next == nullptr)
+				break;
+			this->block.reset(next);
+			this->record_ids.reset(next->ids());
+			this->position = 0;
+		}
+		while (this->position < this->record_ids->size() && !batch.full()) {
+			RecordID record_id = (*this->record_ids)[this->position++];
+			const char* record = this->block->get_record(record_id);
+			if (record == nullptr)
+				continue;
+			batch.append_row(Handle(this->block->get_block_id(), record_id));
+			decode(record, batch);
+		}
+	}
+	return batch.size() > 0;
+}
+
+// Walk the marshaled record once, appending the columns the batch wants
+void HeapBatchCursor::decode(const char* record, ColumnBatch& batch) const {
+	uint offset = 0;
+	for (uint i = 0; i < this->layout.size(); i++) {
+		int column = this->batch_columns[i];
+		switch (this->layout[i]) {
+			case ColumnAttribute::DataType::INT:
+				if (column >= 0) {
+					int32_t n;
+					memcpy(&n, record + offset, sizeof(int32_t));
+					batch.append_int(column, n);
+				}
+				offset += sizeof(int32_t);
+				break;
+			case ColumnAttribute::DataType::TEXT: {
+				u16 size;
+				memcpy(&size, record + offset, sizeof(u16));
+				offset += sizeof(u16);
+				if (column >= 0)
+					batch.append_text(column, record + offset, size);
+				offset += size;
+				break;
+			}
+			case ColumnAttribute::DataType::BOOLEAN:
+				if (column >= 0)
+					batch.append_bool(column, *(uint8_t*)(record + offset));
+				offset += sizeof(uint8_t);
+				break;
+			default:
+				throw DbRelationError("Only know how to unmarshal INT, TEXT, and BOOLEAN");
+		}
+	}
+}
+
 void test_set_row(ValueDict &row, int a, string b) {
 	row["a"] = Value(a);
 	row["b"] = Value(b);
@@ -2,15 +2,22 @@
  * @file heap_storage.h - Implementation of storage_engine with a heap file structure.
  * SlottedPage: DbBlock
  * HeapFile: DbFile
+ * FreeSpaceMap
  * HeapTable: DbRelation
+ * HeapBatchCursor: DbBatchCursor
  *
  * @author Kevin Lundeen
  * @see "Seattle University, CPSC5300, Summer 2018"
  */
 #pragma once
 
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include "db_cxx.h"
 #include "storage_engine.h"
+#include "buffer_pool.h"
+#include "column_batch.h"
 
 /**
  * @class SlottedPage - heap file implementation of DbBlock.
@@ -25,15 +32,27 @@
             Bytes 0x04 - 0x05: size of record 1
             Bytes 0x06 - 0x07: offset to record 1
             etc.
+
+        Deleting a record (or shrinking it with put()) leaves a hole rather than moving the
+        records around it; the bytes only come back when add() or put() needs more contiguous
+        room than there is, which slides all the records together once. The holes are counted
+        the first time they're needed, so has_room() and free_space() count them exactly.
+
+        The block is as big as its file's page size. Offsets stay 2 bytes even for 64 KB
+        pages: the last byte of the block is at 0xFFFF and the end of free space is stored
+        as the offset of the last free byte, so every offset fits.
+
+        A page read by HeapFile lives in a BufferPool frame which the SlottedPage keeps pinned,
+        so records returned by get() stay valid for as long as the SlottedPage handle is alive.
  *
  */
 
 class SlottedPage : public DbBlock {
 public:
-	SlottedPage(Dbt &block, BlockID block_id, bool is_new=false);
+	SlottedPage(Dbt &block, BlockID block_id, bool is_new=false, BufferFrame *frame=nullptr);
 	// Big 5 - we only need the destructor, copy-ctor, move-ctor, and op= are unnecessary
 	// but we delete them explicitly just to make sure we don't use them accidentally
-	virtual ~SlottedPage() {}
+	virtual ~SlottedPage();
 	SlottedPage(const SlottedPage& other) = delete;
 	SlottedPage(SlottedPage&& temp) = delete;
 	SlottedPage& operator=(const SlottedPage& other) = delete;
@@ -47,32 +66,122 @@ public:
 	virtual void clear();
 	virtual uint16_t size() const;
 
+	/**
+	 * Look at a record in place, without copying it into a Dbt.
+	 * @returns  the record's bytes (valid while this page is), or nullptr if it was deleted
+	 */
+	virtual const char* get_record(RecordID record_id) const;
+
+	/**
+	 * Size of the largest record add() would take right now.
+	 * @returns  bytes of free space, less the header a new record needs
+	 */
+	virtual uint free_space() const;
+
+	/**
+	 * Size of the largest record a page can ever hold: the whole block less the page's
+	 * header and the record's own. Anything bigger is refused before its size is stored
+	 * in a 2-byte header, where a 64 KB record would wrap around to 0.
+	 * @param block_size  page size
+	 */
+	static uint max_record_size(uint block_size) { return block_size - 8; }
+
+	/**
+	 * Drop the slots of deleted records, renumbering the rest 1, 2, ... in the same order.
+	 * The records themselves stay where they are.
+	 * @returns  the old id of each record, in new id order (freed by caller)
+	 */
+	virtual RecordIDs* compact();
+
 protected:
 	uint16_t num_records;
 	uint16_t end_free;
+	BufferFrame *frame;  // buffer pool frame holding block's memory (unpinned with this page), or nullptr
+	mutable int hole_bytes;  // bytes of holes between the records, or -1 until holes() counts them
 	
 	virtual void get_header(uint16_t &size, uint16_t &loc, RecordID id=0) const;
 	virtual void put_header(RecordID id=0, uint16_t size=0, uint16_t loc=0);
-	virtual bool has_room(uint16_t size) const;
+	virtual bool has_room(uint size) const;
 	virtual uint16_t get_n(uint16_t offset) const;
 	virtual void put_n(uint16_t offset, uint16_t n);
 	virtual void* address(uint16_t offset) const;
-	void shift_records(RecordID begin_record_id, uint16_t shift_offset, bool left = true);
-	virtual bool have_record(RecordID record_id);
+	virtual int contiguous() const;
+	virtual uint holes() const;
+	virtual void defragment();
+};
+
+/**
+ * @class HeapFileCursor - heap file implementation of DbBlockCursor
+ *
+ * Walks a HeapFile with a Berkeley DB cursor over the RecNo file, so a full scan reads
+        the blocks sequentially (and gets Berkeley DB's readahead) rather than doing one
+        random get per block. Blocks resident in the BufferPool (which may be newer than disk,
+        or not written back yet at all) are handed out from there instead. The SlottedPage
+        handed back by next() may refer to the cursor's buffer, so it must be consumed before
+        next() is called again.
+
+        In an environment with the locking subsystem a positioned cursor holds a read lock on
+        its page, so it is opened inside the current transaction: the buffer pool's write-backs
+        go through the same DbTxn and so never wait on it. Outside a transaction such a
+        write-back would wait on the cursor forever, so there the blocks are fetched through the
+        BufferPool instead.
+ */
+class HeapFile;  // forward declare
+
+class HeapFileCursor : public DbBlockCursor {
+public:
+	HeapFileCursor(HeapFile &file);
+	virtual ~HeapFileCursor();
+	HeapFileCursor(const HeapFileCursor& other) = delete;
+	HeapFileCursor(HeapFileCursor&& temp) = delete;
+	HeapFileCursor& operator=(const HeapFileCursor& other) = delete;
+	HeapFileCursor& operator=(HeapFileCursor&& temp) = delete;
+
+	virtual SlottedPage* next();
+
+	/**
+	 * Is there still a Berkeley DB cursor reading the file sequentially?
+	 */
+	bool is_sequential() const { return dbc != nullptr; }
+
+protected:
+	HeapFile &file;
+	Dbc *dbc;
+	bool started;
+	BlockID block_id;       // last block handed out by next()
+	BlockID disk_block_id;  // block the Berkeley DB cursor is sitting on
+	char *buffer;           // its contents
+	Dbt disk_data;          // the Dbt Berkeley DB reads into buffer
+	virtual void close();
 };
 
 /**
  * @class HeapFile - heap file implementation of DbFile
  *
  * Heap file organization. Built on top of Berkeley DB RecNo file. There is one of our
-        database blocks for each Berkeley DB record in the RecNo file. In this way we are using Berkeley DB
-        for buffer management and file management.
-        Uses SlottedPage for storing records within blocks.
+        database blocks for each Berkeley DB record in the RecNo file. Blocks are cached in the
+        BufferPool: get() pins a frame and put() only marks it dirty; Berkeley DB is used for
+        file management and for the reads and write-backs the pool asks for.
+        Uses SlottedPage for storing records within blocks. The page size (4 KB by default, up
+        to 64 KB) is fixed when the file is created; whoever opens it again must pass the same
+        size, which the schema tables record.
+
+        If the environment was opened with DB_THREAD, so is the file, and every Dbt Berkeley DB
+        fills in points at our own memory. Opening, closing and growing the file are serialized
+        on the file's latch, so threads can share one HeapFile. Reads and write-backs go through
+        the TransactionManager's current transaction, if any.
  */
 class HeapFile : public DbFile {
+	friend class BufferPool;
+	friend class HeapFileCursor;
 public:
-	HeapFile(std::string name);
-	virtual ~HeapFile() {}
+	/**
+	 * @param name        file name (without the .db)
+	 * @param block_size  page size the file is created with (and was, if it exists)
+	 * @throws            DbRelationError if block_size isn't DbBlock::is_valid_block_size()
+	 */
+	HeapFile(std::string name, uint block_size=DbBlock::BLOCK_SZ);
+	virtual ~HeapFile();
 	HeapFile(const HeapFile& other) = delete;
 	HeapFile(HeapFile&& temp) = delete;
 	HeapFile& operator=(const HeapFile& other) = delete;
@@ -86,6 +195,7 @@ public:
 	virtual SlottedPage* get(BlockID block_id);
 	virtual void put(DbBlock* block);
 	virtual BlockIDs* block_ids() const;
+	virtual HeapFileCursor* cursor();
 
 	/**
 	 * Get the id of the current final block in the heap file.
@@ -93,13 +203,151 @@ public:
 	 */
 	virtual uint32_t get_last_block_id() {return last;}
 
+	/**
+	 * Cut the file back to its first blocks, forgetting whatever the buffer pool holds of the rest.
+	 * @param last  block id of the new final block (none of the blocks after it may be pinned)
+	 */
+	virtual void truncate(BlockID last);
+
+	/**
+	 * Get the size of the file's blocks.
+	 * @returns  page size in bytes
+	 */
+	uint get_block_size() const {return block_size;}
+
+	/**
+	 * Recount the blocks on disk (after a rollback took back ones appended in the transaction).
+	 */
+	virtual void refresh();
+
+	/**
+	 * Flags the database environment was opened with (e.g., DB_THREAD, DB_INIT_LOCK).
+	 */
+	static u_int32_t environment_flags();
+
 protected:
 	std::string dbfilename;
-	uint32_t last;
-	bool closed;
+	uint block_size;
+	std::atomic<uint32_t> last;
+	std::atomic<bool> closed;
+	std::recursive_mutex latch;  // held while opening, closing or growing the file
 	Db db;
 	virtual void db_open(uint flags=0);
 	virtual uint32_t get_block_count();
+	virtual void read_block(BlockID block_id, char *data);
+	virtual void write_block(BlockID block_id, char *data);
+};
+
+/**
+ * @class RecordFilter - where-clause predicates compiled against a HeapTable's record layout
+ *
+ * Tests a marshaled record in place: operands are converted once to the on-disk form of
+ * their column, and columns are located by fixed offset until the first TEXT column, then
+ * by stepping over the length-prefixed fields. No ValueDict is built for a record.
+ */
+class RecordFilter {
+public:
+	RecordFilter(const ColumnNames& column_names, const ColumnAttributes& column_attributes,
+			const Conjunction& where);
+	RecordFilter(const ColumnNames& column_names, const ColumnAttributes& column_attributes,
+			const ValueDict& where);  // all equalities; a value of the wrong type matches nothing
+	virtual ~RecordFilter() {}
+
+	/**
+	 * Does the marshaled record pass every predicate?
+	 * @param record  the record's bytes, as laid out by HeapTable::marshal()
+	 */
+	virtual bool matches(const char* record) const;
+
+protected:
+	// one predicate with its operands in the column's stored form
+	struct Test {
+		uint column;
+		Predicate::Op op;
+		std::vector<int32_t> ints;       // INT and BOOLEAN operands
+		std::vector<std::string> texts;  // TEXT operands
+	};
+
+	std::vector<ColumnAttribute::DataType> layout;  // data type of each column, in record order
+	std::vector<int> offsets;                       // fixed offset of each column, or -1 after a TEXT
+	std::vector<Test> tests;                        // sorted by column
+	bool never;                                     // some test can't be passed by any record
+
+	void add(const ColumnNames& column_names, const Predicate& predicate);
+	void compile(const ColumnNames& column_names, const ColumnAttributes& column_attributes);
+	static bool passes(Predicate::Op op, int comparison);
+};
+
+/**
+ * @class FreeSpaceMap - how much room each block of a HeapFile has, kept in a file of its own
+ *
+ * One byte per heap block holds its free space in 1/256ths of the heap's page size (rounded
+        down), so a block whose byte says a record fits really has room for it. The bytes live
+        in the blocks of a separate 4 KB-page HeapFile (<table>.fsm.db) read through the
+        BufferPool like any other block, so changes to the map are written back, committed and
+        rolled back together with the heap blocks they describe:
+            Byte 0x000:         at least as big as any other byte in this block
+            Bytes 0x001-0xFFF:  one per heap block, the next 4095 heap blocks in order
+        find() skips map blocks whose byte 0 says nothing in them is big enough, and tightens
+        byte 0 when a search of the block comes up empty. It looks at blocks from the front of
+        the heap, so space freed near the front is reused first.
+ */
+class FreeSpaceMap {
+public:
+	/**
+	 * @param name        name of the map's file (without the .db)
+	 * @param block_size  page size of the heap file the map describes
+	 */
+	FreeSpaceMap(std::string name, uint block_size);
+	virtual ~FreeSpaceMap() {}
+	FreeSpaceMap(const FreeSpaceMap& other) = delete;
+	FreeSpaceMap(FreeSpaceMap&& temp) = delete;
+	FreeSpaceMap& operator=(const FreeSpaceMap& other) = delete;
+	FreeSpaceMap& operator=(FreeSpaceMap&& temp) = delete;
+
+	/**
+	 * Create the map's file (empty: every block looks full until update() says otherwise).
+	 */
+	virtual void create();
+	virtual void drop();
+
+	/**
+	 * Open the map, building it from heap if its file doesn't exist yet (a table from
+	 * before there were free-space maps).
+	 * @param heap  the file the map describes (already open)
+	 */
+	virtual void open(HeapFile &heap);
+	virtual void close();
+
+	/**
+	 * Find a block with room for a record.
+	 * @param size  bytes of the record
+	 * @returns     the first such block, or 0 if no block has room
+	 */
+	virtual BlockID find(uint size);
+
+	/**
+	 * Record how much room a block has now.
+	 * @param block_id    heap block
+	 * @param free_bytes  its SlottedPage::free_space()
+	 */
+	virtual void update(BlockID block_id, uint free_bytes);
+
+	/**
+	 * Blocks of the heap each block of the map covers.
+	 */
+	static const uint BLOCKS_PER_PAGE = DbBlock::BLOCK_SZ - 1;
+
+protected:
+	HeapFile file;
+	uint unit;                    // bytes of free space per step of a map byte
+	std::atomic<bool> opened;
+	std::mutex lock;              // guards the map blocks' contents, bounds and rollbacks_seen
+	std::vector<uint8_t> bounds;  // copy of byte 0 of each map block
+	u_long rollbacks_seen;        // a rollback puts old bounds back on disk, so the copy must be reread
+
+	virtual uint8_t category(uint free_bytes) const;
+	virtual void load_bounds();
 };
 
 /**
@@ -111,7 +359,8 @@ protected:
 
 class HeapTable : public DbRelation {
 public:
-	HeapTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes);
+	HeapTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes,
+			  uint block_size=DbBlock::BLOCK_SZ);
 	virtual ~HeapTable() {}
 	HeapTable(const HeapTable& other) = delete;
 	HeapTable(HeapTable&& temp) = delete;
@@ -126,23 +375,90 @@ public:
 	virtual void close();
 
 	virtual Handle insert(const ValueDict* row);
+	virtual Handles* insert_batch(const ValueDicts* rows);
 	virtual void update(const Handle handle, const ValueDict* new_values);
 	virtual void del(const Handle handle);
 
 	virtual Handles* select();
 	virtual Handles* select(const ValueDict* where);
 	virtual Handles* select(Handles *current_selection, const ValueDict* where);
+	virtual Handles* select(const Conjunction& where);
+	virtual Handles* select(Handles* current_selection, const Conjunction& where);
 	virtual ValueDict* project(Handle handle);
 	virtual ValueDict* project(Handle handle, const ColumnNames* column_names);
 	using DbRelation::project;
+	virtual ValueDicts* scan(const ColumnNames* column_names, Handles* handles);
+	virtual DbBatchCursor* batch_cursor(const ColumnNames& column_names);
+
+	/**
+	 * VACUUM in steps: first each block in turn has the slots of its deleted records dropped;
+	 * then the rows of the last block are moved into room the free-space map finds earlier in
+	 * the file and the emptied block is cut off the end, until a block's rows don't all fit.
+	 */
+	virtual bool vacuum(VacuumProgress &progress, uint blocks, Relocations &moved);
+
+	/**
+	 * Number of tasks select() splits a scan of a large table into, run on the TaskScheduler.
+	 * @param threads  1 for a serial scan; 0 for one per hardware thread
+	 */
+	static void set_scan_threads(uint threads);
+	static uint get_scan_threads() { return scan_threads; }
+
+	/**
+	 * Blocks a worker claims at a time in a parallel scan.
+	 */
+	static const uint MORSEL_BLOCKS = 16;
+
+	/**
+	 * Tables smaller than this many blocks are always scanned serially.
+	 */
+	static const uint PARALLEL_MIN_BLOCKS = 4 * MORSEL_BLOCKS;
 
 protected:
+	static uint scan_threads;
 	HeapFile file;
+	FreeSpaceMap fsm;
 	virtual ValueDict* validate(const ValueDict* row) const;
 	virtual Handle append(const ValueDict* row);
+	virtual SlottedPage* block_with_room(uint size, BlockID before=0);
+	virtual void put_block(SlottedPage* block);
+	virtual bool empty_block(BlockID block_id, Relocations &moved);
+	virtual void compact_block(BlockID block_id, Relocations &moved);
 	virtual Dbt* marshal(const ValueDict* row) const;
 	virtual ValueDict* unmarshal(Dbt* data) const;
-	virtual bool selected(Handle handle, const ValueDict* where);
+	virtual Handles* select_filtered(const RecordFilter* filter);
+	virtual Handles* select_filtered(Handles* current_selection, const RecordFilter& filter);
+	virtual Handles* select_parallel(const RecordFilter* filter, uint threads);
+	virtual bool selected(const SlottedPage* block, RecordID record_id, const RecordFilter& filter);
+	virtual ValueDict* project(const SlottedPage* block, RecordID record_id, const ColumnNames* column_names);
+};
+
+/**
+ * @class HeapBatchCursor - HeapTable implementation of DbBatchCursor
+ *
+ * Walks the table's blocks with a HeapFileCursor and decodes each marshaled record
+ * straight into the batch's columns, with no ValueDict in between. A block whose
+ * records don't all fit is held on to until the next call picks up where it left off.
+ */
+class HeapBatchCursor : public DbBatchCursor {
+public:
+	HeapBatchCursor(HeapFile &file, const ColumnAttributes& column_attributes, std::vector<int> batch_columns);
+	virtual ~HeapBatchCursor() {}
+	HeapBatchCursor(const HeapBatchCursor& other) = delete;
+	HeapBatchCursor(HeapBatchCursor&& temp) = delete;
+	HeapBatchCursor& operator=(const HeapBatchCursor& other) = delete;
+	HeapBatchCursor& operator=(HeapBatchCursor&& temp) = delete;
+
+	virtual bool next(ColumnBatch& batch);
+
+protected:
+	std::unique_ptr<HeapFileCursor> cursor;
+	std::vector<ColumnAttribute::DataType> layout;  // data type of each column, in record order
+	std::vector<int> batch_columns;                 // batch column of each record column, or -1 if unread
+	std::unique_ptr<SlottedPage> block;             // block being decoded
+	std::unique_ptr<RecordIDs> record_ids;          // its records
+	uint position;                                  // next of record_ids to decode
+	virtual void decode(const char* record, ColumnBatch& batch) const;
 };
 
 bool test_heap_storage();
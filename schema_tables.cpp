@@ -6,6 +6,7 @@
 #include "schema_tables.h"
 #include "ParseTreeToString.h"
 #include "btree.h"
+#include "hash_index.h"
 
 
 void initialize_schema_tables() {
@@ -49,12 +50,15 @@ bool is_acceptable_data_type(std::string dt) {
 const Identifier Tables::TABLE_NAME = "_tables";
 Columns* Tables::columns_table = nullptr;
 std::map<Identifier,DbRelation*> Tables::table_cache;
+std::recursive_mutex Tables::table_cache_lock;
 
 // get the column name for _tables column
 ColumnNames& Tables::COLUMN_NAMES() {
     static ColumnNames cn;
-    if (cn.empty())
+    if (cn.empty()) {
         cn.push_back("table_name");
+        cn.push_back("page_size");
+    }
     return cn;
 }
 
@@ -64,12 +68,15 @@ ColumnAttributes& Tables::COLUMN_ATTRIBUTES() {
     if (cas.empty()) {
         ColumnAttribute ca(ColumnAttribute::TEXT);
         cas.push_back(ca);
+        ca.set_data_type(ColumnAttribute::INT);
+        cas.push_back(ca);
     }
     return cas;
 }
 
-// ctor - we have a fixed table structure of just one column: table_name
+// ctor - we have a fixed table structure: table_name, page_size
 Tables::Tables() : HeapTable(TABLE_NAME, COLUMN_NAMES(), COLUMN_ATTRIBUTES()) {
+    std::lock_guard<std::recursive_mutex> guard(Tables::table_cache_lock);
     Tables::table_cache[TABLE_NAME] = this;
     if (Tables::columns_table == nullptr)
         columns_table = new Columns();
@@ -88,15 +95,23 @@ void Tables::create() {
 	insert(&row);
 }
 
-// Manually check that table_name is unique.
+// Manually check that table_name is unique and page_size is one we can use (default page size if not given).
 Handle Tables::insert(const ValueDict* row) {
     // Try SELECT * FROM _tables WHERE table_name = row["table_name"] and it should return nothing
-    Handles* handles = select(row);
+    ValueDict where;
+    where["table_name"] = row->at("table_name");
+    Handles* handles = select(&where);
     bool unique = handles->empty();
     delete handles;
     if (!unique)
         throw DbRelationError(row->at("table_name").s + " already exists");
-    return HeapTable::insert(row);
+
+    ValueDict full_row = *row;
+    if (full_row.find("page_size") == full_row.end())
+        full_row["page_size"] = Value((int32_t) DbBlock::BLOCK_SZ);
+    if (!DbBlock::is_valid_block_size((uint) full_row["page_size"].n))
+        throw DbRelationError("unacceptable page size " + std::to_string(full_row["page_size"].n));
+    return HeapTable::insert(&full_row);
 }
 
 // Remove a row, but first remove from table cache if there
@@ -105,15 +120,27 @@ void Tables::del(Handle handle) {
     // remove from cache, if there
     ValueDict* row = project(handle);
     Identifier table_name = row->at("table_name").s;
-    if (Tables::table_cache.find(table_name) != Tables::table_cache.end()) {
-        DbRelation* table = Tables::table_cache.at(table_name);
-        Tables::table_cache.erase(table_name);
-        delete table;
+    delete row;
+    {
+        std::lock_guard<std::recursive_mutex> guard(Tables::table_cache_lock);
+        if (Tables::table_cache.find(table_name) != Tables::table_cache.end()) {
+            DbRelation* table = Tables::table_cache.at(table_name);
+            Tables::table_cache.erase(table_name);
+            delete table;
+        }
     }
 
     HeapTable::del(handle);
 }
 
+// A catalog from before page sizes ends its rows at table_name; fill in the default page size.
+ValueDict* Tables::unmarshal(Dbt* data) const {
+    ValueDict* row = HeapTable::unmarshal(data);
+    if (row->find("page_size") == row->end())
+        (*row)["page_size"] = Value((int32_t) DbBlock::BLOCK_SZ);
+    return row;
+}
+
 // Return a list of column names and column attributes for given table.
 void Tables::get_columns(Identifier table_name, ColumnNames &column_names, ColumnAttributes &column_attributes) {
     // SELECT * FROM _columns WHERE table_name = <table_name>
@@ -145,9 +172,27 @@ void Tables::get_columns(Identifier table_name, ColumnNames &column_names, Colum
     delete handles;
 }
 
+// Return the page size the table's file was created with (the default page size for a table not in _tables).
+uint Tables::get_page_size(Identifier table_name) {
+    std::lock_guard<std::recursive_mutex> guard(Tables::table_cache_lock);
+    DbRelation* tables = Tables::table_cache.at(TABLE_NAME);
+    ValueDict where;
+    where["table_name"] = table_name;
+    Handles* handles = tables->select(&where);
+    uint page_size = DbBlock::BLOCK_SZ;
+    for (auto const& handle: *handles) {
+        ValueDict* row = tables->project(handle);
+        page_size = (uint) (*row)["page_size"].n;
+        delete row;
+    }
+    delete handles;
+    return page_size;
+}
+
 // Return a table for given table_name.
 DbRelation& Tables::get_table(Identifier table_name) {
     // if they are asking about a table we've once constructed, then just return that one
+    std::lock_guard<std::recursive_mutex> guard(Tables::table_cache_lock);
 	
     if (Tables::table_cache.find(table_name) != Tables::table_cache.end())
         return  *Tables::table_cache[table_name];
@@ -156,7 +201,7 @@ DbRelation& Tables::get_table(Identifier table_name) {
     ColumnNames column_names;
     ColumnAttributes column_attributes;
     get_columns(table_name, column_names, column_attributes);
-    DbRelation* table = new HeapTable(table_name, column_names, column_attributes);
+    DbRelation* table = new HeapTable(table_name, column_names, column_attributes, get_page_size(table_name));
     Tables::table_cache[table_name] = table;
 	
     return *table;
@@ -205,6 +250,10 @@ void Columns::create() {
     row["table_name"] = Value("_tables");
     row["column_name"] = Value("table_name");
     insert(&row);
+    row["column_name"] = Value("page_size");
+    row["data_type"] = Value("INT");
+    insert(&row);
+    row["data_type"] = Value("TEXT");
     row["table_name"] = Value("_columns");
     row["column_name"] = Value("table_name");
     insert(&row);
@@ -228,6 +277,9 @@ void Columns::create() {
 	row["column_name"] = Value("is_unique");
 	row["data_type"] = Value("BOOLEAN");
 	insert(&row);
+	row["column_name"] = Value("page_size");
+	row["data_type"] = Value("INT");
+	insert(&row);
 }
 
 // Manually check that (table_name, column_name) is unique.
@@ -261,6 +313,7 @@ Handle Columns::insert(const ValueDict* row) {
  */
 const Identifier Indices::TABLE_NAME = "_indices";
 std::map<std::pair<Identifier,Identifier>,DbIndex*> Indices::index_cache;
+std::recursive_mutex Indices::index_cache_lock;
 
 // get the column name for _indices column
 ColumnNames& Indices::COLUMN_NAMES() {
@@ -272,6 +325,7 @@ ColumnNames& Indices::COLUMN_NAMES() {
         cn.push_back("column_name");
         cn.push_back("index_type");
         cn.push_back("is_unique");
+        cn.push_back("page_size");
     }
     return cn;
 }
@@ -290,6 +344,8 @@ ColumnAttributes& Indices::COLUMN_ATTRIBUTES() {
         cas.push_back(ca);  // index_type
         ca.set_data_type(ColumnAttribute::BOOLEAN);
         cas.push_back(ca);  // is_unique
+        ca.set_data_type(ColumnAttribute::INT);
+        cas.push_back(ca);  // page_size
     }
     return cas;
 }
@@ -317,7 +373,13 @@ Handle Indices::insert(const ValueDict* row) {
     delete handles;
     if (!unique)
         throw DbRelationError("duplicate index " + row->at("table_name").s + " " + row->at("index_name").s);
-    return HeapTable::insert(row);
+
+    ValueDict full_row = *row;
+    if (full_row.find("page_size") == full_row.end())
+        full_row["page_size"] = Value((int32_t) DbBlock::BLOCK_SZ);
+    if (!DbBlock::is_valid_block_size((uint) full_row["page_size"].n))
+        throw DbRelationError("unacceptable page size " + std::to_string(full_row["page_size"].n));
+    return HeapTable::insert(&full_row);
 }
 
 // Remove a row, but first remove from index cache if there
@@ -327,18 +389,38 @@ void Indices::del(Handle handle) {
     ValueDict* row = project(handle);
     Identifier table_name = row->at("table_name").s;
     Identifier index_name = row->at("index_name").s;
+    delete row;
     std::pair<Identifier,Identifier> cache_key(table_name, index_name);
-    if (Indices::index_cache.find(cache_key) != Indices::index_cache.end()) {
-        DbIndex* index = Indices::index_cache.at(cache_key);
-        Indices::index_cache.erase(cache_key);
-        delete index;
+    {
+        std::lock_guard<std::recursive_mutex> guard(Indices::index_cache_lock);
+        if (Indices::index_cache.find(cache_key) != Indices::index_cache.end()) {
+            DbIndex* index = Indices::index_cache.at(cache_key);
+            Indices::index_cache.erase(cache_key);
+            delete index;
+        }
     }
     HeapTable::del(handle);
 }
 
+// A catalog from before page sizes ends its rows at is_unique; fill in the default page size.
+ValueDict* Indices::unmarshal(Dbt* data) const {
+    ValueDict* row = HeapTable::unmarshal(data);
+    if (row->find("page_size") == row->end())
+        (*row)["page_size"] = Value((int32_t) DbBlock::BLOCK_SZ);
+    return row;
+}
+
 // Return a list of column names and column attributes for given table.
 void Indices::get_columns(Identifier table_name, Identifier index_name,
                           ColumnNames &column_names, bool &is_hash, bool &is_unique) {
+    uint page_size;
+    get_columns(table_name, index_name, column_names, is_hash, is_unique, page_size);
+}
+
+// Same, and the page size the index's file was created with.
+void Indices::get_columns(Identifier table_name, Identifier index_name,
+                          ColumnNames &column_names, bool &is_hash, bool &is_unique, uint &page_size) {
+    page_size = DbBlock::BLOCK_SZ;
     // SELECT * FROM _indices WHERE table_name = <table_name> AND index_name = <index_name>
     ValueDict where;
     where["table_name"] = table_name;
@@ -357,6 +439,7 @@ void Indices::get_columns(Identifier table_name, Identifier index_name,
             size = which;
         is_unique = (*row)["is_unique"].n != 0;
         is_hash = (*row)["index_type"].s == "HASH";
+        page_size = (uint) (*row)["page_size"].n;
         delete row;
     }
     for (uint i = 0; i < size; i++)
@@ -364,37 +447,25 @@ void Indices::get_columns(Identifier table_name, Identifier index_name,
     delete handles;
 }
 
-// FIXME - use this for now until we have BTreeIndex and HashIndex
-class DummyIndex : public DbIndex {
-public:
-    DummyIndex(DbRelation& rel, Identifier idx, ColumnNames key, bool unq) : DbIndex(rel, idx, key, unq) {}
-    void create() {}
-    void drop() {}
-    void open() {}
-    void close() {}
-    Handles* lookup(ValueDict* key_values) const {return nullptr;}
-    void insert(Handle handle) {}
-    void del(Handle handle) {}
-};
-
-
 // Return a table for given table_name.
 DbIndex& Indices::get_index(Identifier table_name, Identifier index_name) {
     // if they are asking about an index we've once constructed, then just return that one
     std::pair<Identifier,Identifier> cache_key(table_name, index_name);
+    std::lock_guard<std::recursive_mutex> guard(Indices::index_cache_lock);
     if (Indices::index_cache.find(cache_key) != Indices::index_cache.end())
         return  *Indices::index_cache[cache_key];
 
-    // otherwise assume it is a DummyIndex (for now)
+    // otherwise construct it from the catalog
     ColumnNames column_names;
     bool is_hash, is_unique;
-    get_columns(table_name, index_name, column_names, is_hash, is_unique);
+    uint page_size;
+    get_columns(table_name, index_name, column_names, is_hash, is_unique, page_size);
     DbRelation& table = Tables::get_table(table_name);
     DbIndex* index;
     if (is_hash) {
-        index = new DummyIndex(table, index_name, column_names, is_unique);  // FIXME - change to HashIndex
+        index = new HashIndex(table, index_name, column_names, is_unique, page_size);
     } else {
-        index = new BTreeIndex(table, index_name, column_names, is_unique);  // FIXME - change to BTreeIndex
+        index = new BTreeIndex(table, index_name, column_names, is_unique, page_size);
     }
     Indices::index_cache[cache_key] = index;
     return *index;
@@ -413,4 +484,12 @@ IndexNames Indices::get_index_names(Identifier table_name) {
     }
     delete handles;
     return ret;
-}
\ No newline at end of file
+}
+
+// delete the cached index objects; their files are reopened on the next get_index()
+void Indices::clear_cache() {
+    std::lock_guard<std::recursive_mutex> guard(Indices::index_cache_lock);
+    for (auto const& entry: Indices::index_cache)
+        delete entry.second;
+    Indices::index_cache.clear();
+}
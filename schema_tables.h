@@ -7,6 +7,7 @@
  */
 #pragma once
 
+#include <mutex>
 #include "heap_storage.h"
 
 /**
@@ -57,17 +58,28 @@ public:
 	 */
     static DbRelation& get_table(Identifier table_name);
 
+	/**
+	 * Get the page size a table's file was created with.
+	 * @param table_name  table to look up
+	 * @returns           its page size (DbBlock::BLOCK_SZ for a table not in _tables)
+	 */
+    static uint get_page_size(Identifier table_name);
+
 protected:
 	// hard-coded columns for _tables table
     static ColumnNames& COLUMN_NAMES();
     static ColumnAttributes& COLUMN_ATTRIBUTES();
 
+	// rows written before page sizes were recorded have none: those tables are on the default
+    virtual ValueDict* unmarshal(Dbt* data) const;
+
 	// keep a reference to the columns table (for get_columns method)
     static Columns* columns_table;
 
 private:
 	// keep a cache of all the tables we've instantiated so far
     static std::map<Identifier,DbRelation*> table_cache;
+    static std::recursive_mutex table_cache_lock;  // guards table_cache
 };
 
 
@@ -121,6 +133,13 @@ public:
 	virtual void get_columns(Identifier table_name, Identifier index_name,
                              ColumnNames &column_names, bool &is_hash, bool &is_unique);
 
+	/**
+	 * Same, also getting the page size the index's file was created with.
+	 * @param page_size       returned by reference: page size in bytes
+	 */
+	virtual void get_columns(Identifier table_name, Identifier index_name,
+                             ColumnNames &column_names, bool &is_hash, bool &is_unique, uint &page_size);
+
 	/**
 	 * Get the instantiated DbIndex for the given index.
 	 * @param table_name  what table the requested index is on
@@ -136,6 +155,12 @@ public:
 	 */
 	virtual IndexNames get_index_names(Identifier table_name);
 
+	/**
+	 * Drop every instantiated DbIndex, so get_index() opens them afresh from disk
+	 * (used after a rollback, which leaves their in-memory nodes stale).
+	 */
+	static void clear_cache();
+
 	// overrides
 	virtual Handle insert(const ValueDict* row);
 	virtual void del(Handle handle);
@@ -144,6 +169,10 @@ protected:
 	static ColumnNames& COLUMN_NAMES();
 	static ColumnAttributes& COLUMN_ATTRIBUTES();
 
+	// rows written before page sizes were recorded have none: those indices are on the default
+	virtual ValueDict* unmarshal(Dbt* data) const;
+
 private:
 	static std::map<std::pair<Identifier,Identifier>,DbIndex*> index_cache;
+	static std::recursive_mutex index_cache_lock;  // guards index_cache
 };
@@ -2,6 +2,10 @@
  * This program runs a basic sql interpreter line
  * It requires one command line argument, the existing
  * r/w directory in which to create the DB environment.
+ * With "--serve <socket path>" after it, it serves SQL sessions
+ * on that Unix domain socket instead (see SQLServer); "--cache-mb <n>"
+ * sets the size of Berkeley DB's mpool cache. BEGIN, COMMIT and ROLLBACK
+ * group statements into transactions (see SQLSession).
  *
  * @author Jacob Mouser, Brian Doersh, Kevin Lundeen
  */
@@ -16,6 +20,7 @@
 #include "SQLParser.h"
 #include "ParseTreeToString.h"
 #include "SQLExec.h"
+#include "sql_server.h"
 #include "unit_test.h"
 #include "btree.h"
 
@@ -27,20 +32,51 @@ DbEnv* _DB_ENV;
 
 /*
  * we allocate and initialize the _DB_ENV global
+ * @param envHome   directory holding the environment
+ * @param cache_mb  size of the Berkeley DB mpool cache in megabytes (0 for its default)
  */
-void initialize_environment(char *envHome);
+void initialize_environment(char *envHome, u_int32_t cache_mb=0);
 
  
 // main methood with 1 arg (directory path), drives execute
 int main(int argc, char *argv[]) {
    
+	const char *usage = "Usage: sql5300 <env dir> [--cache-mb <n>] [--serve <socket path>]";
 	if (argc <=1) {
-		cerr << "Incorrect usage" << endl;
+		cerr << usage << endl;
 		exit(1);
 	}
-	initialize_environment(argv[1]);
+	u_int32_t cache_mb = 0;
+	const char *socket_path = nullptr;
+	for (int i = 2; i < argc; i++) {
+		if (strcmp(argv[i], "--cache-mb") == 0 && i + 1 < argc) {
+			cache_mb = (u_int32_t) atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+			socket_path = argv[++i];
+		} else {
+			cerr << usage << endl;
+			exit(1);
+		}
+	}
+	initialize_environment(argv[1], cache_mb);
+
+	if (socket_path != nullptr) {
+		SQLServer server(socket_path);
+		try {
+			server.listen();
+		} catch (runtime_error &e) {
+			cerr << "(sql5300: " << e.what() << ")" << endl;
+			exit(1);
+		}
+		cout << "(sql5300: serving on " << socket_path << ")" << endl;
+		server.serve();
+		BufferPool::instance().checkpoint();
+		_DB_ENV->txn_checkpoint(0, 0, 0);
+		return 0;
+	}
 
    //create a user input loop
+	SQLSession session;
 	while(1) {
 		// get user input
 		cout << "SQL> ";
@@ -51,6 +87,9 @@ int main(int argc, char *argv[]) {
 			continue;  // blank line -- just skip
 		//if response is "quit" then exit
 		if (input == "quit") {
+			session.hang_up();
+			BufferPool::instance().checkpoint();
+			_DB_ENV->txn_checkpoint(0, 0, 0);
 			break;
 		}
 		//test our code up to date
@@ -66,34 +105,19 @@ int main(int argc, char *argv[]) {
 		}
 
 
-		// parse result
-		SQLParserResult* parse = SQLParser::parseSQLString(input);       
-
-		//Check that parse tree is valid
-		if(parse->isValid()) {
-			//call our execute function
-			for  (uint i = 0; i < parse->size(); i++) {
-				const SQLStatement *statement = parse->getStatement(i);
-				try {
-					cout << ParseTreeToString::statement(statement) << endl;
-					QueryResult *result = SQLExec::execute(statement);
-					cout << *result << endl;
-					delete result;
-				} catch (SQLExecError& e) {
-					cout << "Error: " << e.what() << endl;
-				}
-			}
-		}
-		else {
-			cout << "Invalid SQL: " << input << endl;
-			cout << parse->errorMsg() << endl;
+		try {
+			session.run(input, cout);
+		} catch (exception& e) {
+			session.fail();
+			cout << "Error: " << e.what() << endl;
 		}
-		delete parse;
 	}
 	return 0;
 }
 
-void initialize_environment(char *envHome) {
+// threaded, transactional environment with locking, so sessions and scan workers can share it;
+// recovery at open rolls back whatever a crash left uncommitted
+void initialize_environment(char *envHome, u_int32_t cache_mb) {
 	cout << "(sql5300: running with database environment at " << envHome
 		 << ")" << endl;
 
@@ -101,11 +125,16 @@ void initialize_environment(char *envHome) {
 	env->set_message_stream(&cout);
 	env->set_error_stream(&cerr);
 	try {
-		env->open(envHome, DB_CREATE | DB_INIT_MPOOL, 0);
+		if (cache_mb > 0)
+			env->set_cachesize(cache_mb / 1024, (cache_mb % 1024) * 1024 * 1024, 1);
+		env->set_lk_detect(DB_LOCK_DEFAULT);
+		env->log_set_config(DB_LOG_AUTO_REMOVE, 1);
+		env->open(envHome, DB_CREATE | DB_INIT_MPOOL | DB_INIT_LOCK | DB_INIT_LOG | DB_INIT_TXN | DB_RECOVER | DB_THREAD, 0);
 	} catch (DbException &exc) {
 		cerr << "(sql5300: " << exc.what() << ")" << endl;
 		exit(1);
 	}
 	_DB_ENV = env;
+	HeapTable::set_scan_threads(0);  // big scans use every core
 	initialize_schema_tables();
 }
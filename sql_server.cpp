@@ -0,0 +1,517 @@
+/**
+ * @file sql_server.cpp - implementation of SQLServer
+ *
+ * @see "Seattle University, CPSC5300, Summer 2018"
+ */
+#include "sql_server.h"
+#include <arpa/inet.h>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <poll.h>
+#include <sstream>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "SQLExec.h"
+#include "transaction.h"
+
+using namespace std;
+using namespace hsql;
+
+/**
+ * @class SQLSession - one client's view of the database: runs its SQL and owns its transaction
+ */
+
+mutex SQLSession::engine_lock;
+
+SQLSession::SQLSession() : transaction(false), aborted(false), page_size(DbBlock::BLOCK_SZ), engine(engine_lock, defer_lock) {
+}
+
+// a session that goes away without COMMIT never committed
+SQLSession::~SQLSession() {
+	hang_up();
+}
+
+void SQLSession::hang_up() {
+	if (this->transaction)
+		abort_transaction();
+}
+
+void SQLSession::fail() {
+	if (this->transaction)
+		fail_transaction();
+	else
+		abort_transaction();  // an autocommit statement may have been under way
+}
+
+// split a line at the semicolons that aren't inside quotes
+static vector<string> split_statements(const string& sql) {
+	vector<string> statements;
+	string statement;
+	char quote = 0;
+	for (char c: sql) {
+		if (quote != 0) {
+			if (c == quote)
+				quote = 0;
+		} else if (c == '\'' || c == '"') {
+			quote = c;
+		} else if (c == ';') {
+			statements.push_back(statement);
+			statement.clear();
+			continue;
+		}
+		statement += c;
+	}
+	statements.push_back(statement);
+	return statements;
+}
+
+void SQLSession::run(const string& sql, ostream& out) {
+	vector<string> statements = split_statements(sql);
+	bool any_control = false;
+	for (auto const& statement: statements)
+		if (control(statement) != NONE)
+			any_control = true;
+	if (!any_control) {
+		execute(sql, out);
+		return;
+	}
+
+	// hand the parser each run of ordinary statements between the transaction commands
+	string pending;
+	for (auto const& statement: statements) {
+		Control command = control(statement);
+		if (command == NONE) {
+			if (statement.find_first_not_of(" \t\r\n") != string::npos)
+				pending += statement + ";";
+			continue;
+		}
+		if (!pending.empty()) {
+			execute(pending, out);
+			pending.clear();
+		}
+		if (command == PAGE_SIZE)
+			set_page_size(statement, out);
+		else if (command == VACUUM)
+			vacuum(statement, out);
+		else if (command == BEGIN)
+			begin(out);
+		else if (command == COMMIT)
+			commit(out);
+		else
+			rollback(out);
+	}
+	if (!pending.empty())
+		execute(pending, out);
+}
+
+SQLSession::Control SQLSession::control(const string& statement) {
+	istringstream words(statement);
+	string phrase, word;
+	while (words >> word) {
+		for (auto& c: word)
+			c = (char) toupper(c);
+		phrase += (phrase.empty() ? "" : " ") + word;
+	}
+	if (phrase == "BEGIN" || phrase == "BEGIN TRANSACTION" || phrase == "BEGIN WORK" || phrase == "START TRANSACTION")
+		return BEGIN;
+	if (phrase == "COMMIT" || phrase == "COMMIT TRANSACTION" || phrase == "COMMIT WORK" || phrase == "END")
+		return COMMIT;
+	if (phrase == "ROLLBACK" || phrase == "ROLLBACK TRANSACTION" || phrase == "ROLLBACK WORK" || phrase == "ABORT")
+		return ROLLBACK;
+	if (phrase.compare(0, 13, "SET PAGE_SIZE") == 0)
+		return PAGE_SIZE;
+	if (phrase.compare(0, 7, "VACUUM ") == 0)
+		return VACUUM;
+	return NONE;
+}
+
+void SQLSession::execute(const string& sql, ostream& out) {
+	SQLParserResult* parse = SQLParser::parseSQLString(sql);
+	if (!parse->isValid()) {
+		out << "Invalid SQL: " << sql << endl;
+		out << parse->errorMsg() << endl;
+		delete parse;
+		return;
+	}
+	TransactionManager &manager = TransactionManager::instance();
+	for (uint i = 0; i < parse->size(); i++) {
+		const SQLStatement *statement = parse->getStatement(i);
+		out << ParseTreeToString::statement(statement) << endl;
+		vector<const InsertStatement*> inserts;
+		if (statement->type() == kStmtInsert) {
+			// consecutive INSERTs into the same table go in as one batch
+			inserts.push_back((const InsertStatement *) statement);
+			while (i + 1 < parse->size() && parse->getStatement(i + 1)->type() == kStmtInsert &&
+				   strcmp(((const InsertStatement *) parse->getStatement(i + 1))->tableName,
+						  inserts.front()->tableName) == 0) {
+				statement = parse->getStatement(++i);
+				out << ParseTreeToString::statement(statement) << endl;
+				inserts.push_back((const InsertStatement *) statement);
+			}
+		}
+		if (this->aborted) {
+			out << "Error: the transaction was rolled back; statements are ignored until COMMIT or ROLLBACK" << endl;
+			continue;
+		}
+		if (this->transaction && (statement->type() == kStmtCreate || statement->type() == kStmtDrop)) {
+			out << "Error: CREATE and DROP are not allowed inside a transaction" << endl;
+			continue;
+		}
+
+		bool autocommit = !this->transaction;
+		if (autocommit)
+			this->engine.lock();
+		QueryResult *result;
+		try {
+			if (autocommit)
+				manager.begin();
+			SQLExec::set_page_size(this->page_size);
+			if (inserts.empty())
+				result = SQLExec::execute(statement);
+			else
+				result = SQLExec::execute_inserts(inserts);
+		} catch (SQLExecError& e) {
+			out << "Error: " << e.what() << endl;
+			if (autocommit) {
+				abort_transaction();
+			} else {
+				fail_transaction();
+				out << "(transaction rolled back)" << endl;
+			}
+			continue;
+		} catch (...) {
+			if (autocommit)
+				abort_transaction();
+			else
+				fail_transaction();
+			delete parse;
+			throw;
+		}
+		if (autocommit && !end_transaction(out)) {
+			delete result;
+			continue;
+		}
+		out << *result << endl;
+		delete result;
+	}
+	delete parse;
+}
+
+// SET PAGE_SIZE [=|TO] <bytes>: page size of the files this session's CREATE TABLE and CREATE INDEX make
+void SQLSession::set_page_size(const string& statement, ostream& out) {
+	istringstream words(statement);
+	string word, last;
+	while (words >> word)
+		last = word;
+	out << "SET PAGE_SIZE " << last << endl;
+	uint size = (uint) strtoul(last.c_str(), nullptr, 10);
+	if (!DbBlock::is_valid_block_size(size)) {
+		out << "Error: page size must be 4096, 8192, 16384, 32768 or 65536" << endl;
+		return;
+	}
+	this->page_size = size;
+	out << "page size " << size << endl;
+}
+
+// VACUUM <table>: one transaction per step, letting go of the engine in between
+void SQLSession::vacuum(const string& statement, ostream& out) {
+	istringstream words(statement);
+	string word, table_name;
+	words >> word >> table_name;
+	out << "VACUUM " << table_name << endl;
+	if (words >> word) {
+		out << "Error: VACUUM takes just a table name" << endl;
+		return;
+	}
+	if (this->transaction) {
+		out << "Error: VACUUM is not allowed inside a transaction" << endl;
+		return;
+	}
+	TransactionManager &manager = TransactionManager::instance();
+	VacuumProgress progress;
+	bool done = false;
+	while (!done) {
+		this->engine.lock();
+		try {
+			manager.begin();
+			done = SQLExec::vacuum(table_name, progress, VACUUM_BLOCKS);
+		} catch (SQLExecError& e) {
+			abort_transaction();
+			out << "Error: " << e.what() << endl;
+			return;
+		} catch (...) {
+			abort_transaction();
+			throw;
+		}
+		if (!end_transaction(out))
+			return;
+	}
+	out << "vacuumed " << table_name << ": moved " << progress.rows_moved << " rows, freed "
+		<< progress.blocks_freed << " blocks" << endl;
+}
+
+void SQLSession::begin(ostream& out) {
+	out << "BEGIN" << endl;
+	if (this->transaction) {
+		out << "Error: a transaction is already in progress" << endl;
+		return;
+	}
+	this->engine.lock();
+	try {
+		TransactionManager::instance().begin();
+	} catch (...) {
+		this->engine.unlock();
+		throw;
+	}
+	this->transaction = true;
+	out << "transaction started" << endl;
+}
+
+void SQLSession::commit(ostream& out) {
+	out << "COMMIT" << endl;
+	if (!this->transaction) {
+		out << "Error: no transaction in progress" << endl;
+		return;
+	}
+	if (this->aborted) {
+		abort_transaction();
+		out << "transaction rolled back" << endl;
+		return;
+	}
+	if (end_transaction(out))
+		out << "transaction committed" << endl;
+}
+
+void SQLSession::rollback(ostream& out) {
+	out << "ROLLBACK" << endl;
+	if (!this->transaction) {
+		out << "Error: no transaction in progress" << endl;
+		return;
+	}
+	abort_transaction();
+	out << "transaction rolled back" << endl;
+}
+
+// commit, let go of the engine, then wait for the log to reach disk; false if the commit failed (and was rolled back)
+bool SQLSession::end_transaction(ostream& out) {
+	TransactionManager &manager = TransactionManager::instance();
+	u_long ticket;
+	try {
+		ticket = manager.commit();
+	} catch (exception& e) {
+		Indices::clear_cache();
+		this->transaction = false;
+		this->engine.unlock();
+		out << "Error: commit failed: " << e.what() << endl;
+		return false;
+	}
+	this->transaction = false;
+	this->engine.unlock();
+	manager.make_durable(ticket);
+	return true;
+}
+
+// roll back the open transaction and let go of the engine
+void SQLSession::abort_transaction() {
+	// without the engine, the manager's transaction (if any) belongs to another session
+	if (this->engine.owns_lock()) {
+		TransactionManager &manager = TransactionManager::instance();
+		if (manager.in_transaction())
+			manager.rollback();
+		Indices::clear_cache();  // index nodes held in memory may have seen the undone changes
+		this->engine.unlock();
+	}
+	this->transaction = false;
+	this->aborted = false;
+}
+
+// roll back the transaction a statement failed in, but stay in it until COMMIT or ROLLBACK
+void SQLSession::fail_transaction() {
+	abort_transaction();
+	this->transaction = true;
+	this->aborted = true;
+}
+
+/**
+ * @class SQLServer - accepts client sessions on a Unix domain socket and runs their SQL
+ */
+
+SQLServer::SQLServer(string socket_path, uint idle_transaction_seconds) : socket_path(socket_path), listen_fd(-1),
+		idle_transaction_seconds(idle_transaction_seconds), stopping(false),
+		sessions(), sessions_lock() {
+}
+
+SQLServer::~SQLServer() {
+	stop();
+}
+
+void SQLServer::listen() {
+	if (this->listen_fd >= 0)
+		return;
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (this->socket_path.size() >= sizeof(address.sun_path))
+		throw runtime_error("socket path too long: " + this->socket_path);
+	strncpy(address.sun_path, this->socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		throw runtime_error(string("socket: ") + strerror(errno));
+	unlink(this->socket_path.c_str());
+	if (bind(fd, (sockaddr*) &address, sizeof(address)) < 0 || ::listen(fd, SOMAXCONN) < 0) {
+		string error = strerror(errno);
+		close(fd);
+		throw runtime_error("cannot listen on " + this->socket_path + ": " + error);
+	}
+	this->listen_fd = fd;
+}
+
+void SQLServer::serve() {
+	listen();
+	int listening = this->listen_fd;
+	while (!this->stopping) {
+		int fd = accept(listening, nullptr, nullptr);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			break;  // stop() shut the listening socket
+		}
+		reap();
+		lock_guard<mutex> guard(this->sessions_lock);
+		if (this->stopping) {
+			close(fd);
+			break;
+		}
+		Session *session = new Session();
+		session->fd = fd;
+		session->done = false;
+		this->sessions.push_back(session);
+		session->thread = thread(&SQLServer::session, this, session);
+	}
+}
+
+void SQLServer::stop() {
+	this->stopping = true;
+	if (this->listen_fd >= 0) {
+		shutdown(this->listen_fd, SHUT_RDWR);  // wakes up accept()
+		close(this->listen_fd);
+		this->listen_fd = -1;
+		unlink(this->socket_path.c_str());
+	}
+	list<Session*> hanging_up;
+	{
+		lock_guard<mutex> guard(this->sessions_lock);
+		for (auto session: this->sessions)
+			shutdown(session->fd, SHUT_RDWR);  // wakes up its read
+		hanging_up.swap(this->sessions);
+	}
+	for (auto session: hanging_up) {
+		session->thread.join();
+		close(session->fd);
+		delete session;
+	}
+}
+
+// join the threads of sessions that have hung up
+void SQLServer::reap() {
+	lock_guard<mutex> guard(this->sessions_lock);
+	for (auto it = this->sessions.begin(); it != this->sessions.end(); ) {
+		Session *session = *it;
+		if (!session->done) {
+			it++;
+			continue;
+		}
+		session->thread.join();
+		close(session->fd);
+		delete session;
+		it = this->sessions.erase(it);
+	}
+}
+
+// wait up to seconds for fd to have something to read (or to hang up); false if it timed out
+static bool wait_readable(int fd, uint seconds) {
+	pollfd ready = {fd, POLLIN, 0};
+	while (true) {
+		int n = poll(&ready, 1, (int) seconds * 1000);
+		if (n < 0 && errno == EINTR)
+			continue;
+		return n != 0;
+	}
+}
+
+// one client: read a line of SQL, send back what running it printed, until it hangs up
+void SQLServer::session(Session* session) {
+	SQLSession sql;
+	string request;
+	while (!this->stopping) {
+		// don't let an idle client keep every other session waiting on its open transaction
+		if (sql.in_transaction() && !sql.is_aborted() && !wait_readable(session->fd, this->idle_transaction_seconds))
+			sql.fail();
+		if (!read_message(session->fd, request))
+			break;
+		if (request == "quit")
+			break;
+		ostringstream out;
+		try {
+			sql.run(request, out);
+		} catch (exception& e) {
+			// Berkeley DB, memory, or a row too big for any page: this request fails, not the server
+			sql.fail();
+			out << "Error: " << e.what() << endl;
+		}
+		if (!write_message(session->fd, out.str()))
+			break;
+	}
+	sql.hang_up();
+	lock_guard<mutex> guard(this->sessions_lock);
+	session->done = true;
+}
+
+// read exactly size bytes unless the peer hangs up first
+static bool read_fully(int fd, char *data, size_t size) {
+	while (size > 0) {
+		ssize_t n = read(fd, data, size);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		data += n;
+		size -= n;
+	}
+	return true;
+}
+
+static bool write_fully(int fd, const char *data, size_t size) {
+	while (size > 0) {
+		ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		data += n;
+		size -= n;
+	}
+	return true;
+}
+
+bool SQLServer::read_message(int fd, string& message) {
+	uint32_t length;
+	if (!read_fully(fd, (char*) &length, sizeof(length)))
+		return false;
+	length = ntohl(length);
+	if (length > MAX_MESSAGE)
+		return false;
+	message.resize(length);
+	return length == 0 || read_fully(fd, &message[0], length);
+}
+
+bool SQLServer::write_message(int fd, const string& message) {
+	uint32_t length = htonl((uint32_t) message.size());
+	return write_fully(fd, (const char*) &length, sizeof(length)) &&
+		   write_fully(fd, message.data(), message.size());
+}
@@ -0,0 +1,188 @@
+/**
+ * @file sql_server.h - SQL front end serving many sessions over a Unix domain socket.
+ * SQLSession
+ * SQLServer
+ *
+ * @see "Seattle University, CPSC5300, Summer 2018"
+ */
+#pragma once
+
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+
+/**
+ * @class SQLSession - one client's view of the database: runs its SQL and owns its transaction
+ *
+ * Statements run one at a time across every session under the engine lock, since SQLExec's
+ * table cache and the storage layer underneath it are shared. Outside BEGIN ... COMMIT each
+ * statement (or batch of consecutive INSERTs) is a transaction of its own. BEGIN takes the
+ * engine lock and keeps it until COMMIT or ROLLBACK, so other sessions wait for the whole
+ * transaction rather than seeing it half done. A statement that fails inside a transaction
+ * rolls the whole transaction back, and the session then refuses every statement until
+ * COMMIT or ROLLBACK (either of which just ends the aborted transaction), so nothing meant
+ * to go in with the failed statement goes in without it. CREATE and DROP are refused inside
+ * a transaction. Since an open transaction holds up every other session, SQLServer gives a
+ * client SQLServer::IDLE_TRANSACTION_SECONDS between requests inside one; a client that takes
+ * longer has its transaction rolled back as if a statement had failed (see fail()), and
+ * finds out at its next request. Commits
+ * become durable after the engine lock is let go (see TransactionManager::make_durable), so
+ * one log sync can cover the commits of many sessions.
+ *
+ * SET PAGE_SIZE <bytes> (4096 up to 65536) picks the page size of the files created by
+ * the session's later CREATE TABLE and CREATE INDEX statements.
+ *
+ * VACUUM <table> reclaims the space of the table's deleted rows (see SQLExec::vacuum). It
+ * runs as a series of short transactions of VACUUM_BLOCKS blocks each, letting go of the
+ * engine lock in between, so other sessions are held up for one step at a time rather than
+ * the whole table. It is refused inside a transaction.
+ * 	run(sql, out)
+ * 	hang_up()
+ */
+class SQLSession {
+public:
+	SQLSession();
+	virtual ~SQLSession();
+	SQLSession(const SQLSession& other) = delete;
+	SQLSession(SQLSession&& temp) = delete;
+	SQLSession& operator=(const SQLSession& other) = delete;
+	SQLSession& operator=(SQLSession&& temp) = delete;
+
+	/**
+	 * Parse and execute one line of SQL, writing what the prompt shows for it to out:
+	 * each statement echoed back followed by its result or error. Consecutive INSERTs
+	 * into the same table go in as one batch. BEGIN, COMMIT and ROLLBACK (or START
+	 * TRANSACTION, END and ABORT), SET PAGE_SIZE and VACUUM are handled here rather
+	 * than by the parser.
+	 * @param sql  one or more ;-separated statements
+	 * @param out  where to write the results
+	 */
+	virtual void run(const std::string& sql, std::ostream& out);
+
+	/**
+	 * Roll back the session's transaction, if it left one open (done by the destructor, too).
+	 */
+	virtual void hang_up();
+
+	/**
+	 * Roll back after an error that got out of run(), or after the client idled too long inside
+	 * a transaction. Inside BEGIN ... COMMIT the session is left in the aborted transaction, as
+	 * if a statement had failed there.
+	 */
+	virtual void fail();
+
+	/**
+	 * Is the session inside BEGIN ... COMMIT?
+	 */
+	bool in_transaction() const { return transaction; }
+
+	/**
+	 * Has a statement failed inside the session's transaction, which now waits for COMMIT or ROLLBACK?
+	 */
+	bool is_aborted() const { return aborted; }
+
+	/**
+	 * Blocks each VACUUM transaction works through.
+	 */
+	static const uint VACUUM_BLOCKS = 16;
+
+protected:
+	enum Control { NONE, BEGIN, COMMIT, ROLLBACK, PAGE_SIZE, VACUUM };
+
+	bool transaction;
+	bool aborted;    // rolled back by a failed statement, still waiting for COMMIT or ROLLBACK
+	uint page_size;  // for the files this session's CREATE statements make
+	std::unique_lock<std::mutex> engine;  // held from BEGIN to COMMIT or ROLLBACK
+
+	static std::mutex engine_lock;  // held while a statement or transaction executes
+
+	static Control control(const std::string& statement);
+	virtual void execute(const std::string& sql, std::ostream& out);
+	virtual void set_page_size(const std::string& statement, std::ostream& out);
+	virtual void vacuum(const std::string& statement, std::ostream& out);
+	virtual void begin(std::ostream& out);
+	virtual void commit(std::ostream& out);
+	virtual void rollback(std::ostream& out);
+	virtual bool end_transaction(std::ostream& out);
+	virtual void abort_transaction();
+	virtual void fail_transaction();
+};
+
+/**
+ * @class SQLServer - accepts client sessions on a Unix domain socket and runs their SQL
+ *
+ * Protocol: every message in either direction is a 4-byte length in network byte order
+ * followed by that many bytes of text. A client sends one line of SQL per message and
+ * gets back one message with exactly what the sql5300 prompt would have printed for it.
+ * Sending "quit" (or closing the socket) ends the session.
+ *
+ * Each session has its own thread and SQLSession, which reads, parses and formats
+ * concurrently with the others. Statements themselves run one at a time under the
+ * SQLSession engine lock; large scans still spread out over the TaskScheduler. A session
+ * that hangs up inside a transaction has it rolled back, and so does one that sends nothing
+ * for IDLE_TRANSACTION_SECONDS while it holds the engine lock.
+ * 	serve()
+ * 	stop()
+ */
+class SQLServer {
+public:
+	/**
+	 * Largest request accepted, in bytes; a session sending more is dropped.
+	 */
+	static const uint MAX_MESSAGE = 1 << 20;
+
+	/**
+	 * Default limit on how long a session may wait for its client inside a transaction.
+	 */
+	static const uint IDLE_TRANSACTION_SECONDS = 30;
+
+	SQLServer(std::string socket_path, uint idle_transaction_seconds = IDLE_TRANSACTION_SECONDS);
+	virtual ~SQLServer();
+	SQLServer(const SQLServer& other) = delete;
+	SQLServer(SQLServer&& temp) = delete;
+	SQLServer& operator=(const SQLServer& other) = delete;
+	SQLServer& operator=(SQLServer&& temp) = delete;
+
+	/**
+	 * Bind the socket and start listening (replacing any stale socket file).
+	 * @throws std::runtime_error  if the socket can't be set up
+	 */
+	virtual void listen();
+
+	/**
+	 * Accept and serve sessions until stop() is called. Calls listen() if need be.
+	 */
+	virtual void serve();
+
+	/**
+	 * Stop accepting, hang up on every session, and wait for their threads to finish.
+	 */
+	virtual void stop();
+
+	/**
+	 * Read or write one length-prefixed message.
+	 * @returns  false if the peer hung up (or, for reads, sent too much)
+	 */
+	static bool read_message(int fd, std::string& message);
+	static bool write_message(int fd, const std::string& message);
+
+protected:
+	struct Session {
+		int fd;
+		std::thread thread;
+		bool done;
+	};
+
+	std::string socket_path;
+	int listen_fd;
+	uint idle_transaction_seconds;
+	std::atomic<bool> stopping;
+	std::list<Session*> sessions;
+	std::mutex sessions_lock;
+
+	virtual void session(Session* session);
+	virtual void reap();
+};
@@ -1,5 +1,6 @@
 #include <algorithm>
 #include "storage_engine.h"
+#include "column_batch.h"
 
 bool Value::operator==(const Value &other) const {
     if (this->data_type != other.data_type)
@@ -31,6 +32,81 @@ bool Value::operator<(const Value &other) const {
     return this->n < other.n;
 }
 
+Predicate::Predicate(Identifier column_name, Op op, const Value& operand)
+        : column_name(column_name), op(op), operands() {
+    operands.push_back(operand);
+}
+
+Predicate::Predicate(Identifier column_name, const Value& low, const Value& high)
+        : column_name(column_name), op(BETWEEN), operands() {
+    operands.push_back(low);
+    operands.push_back(high);
+}
+
+Predicate::Predicate(Identifier column_name, const std::vector<Value>& operands)
+        : column_name(column_name), op(IN), operands(operands) {
+}
+
+bool Predicate::matches(const Value& value) const {
+    switch (this->op) {
+        case EQ:
+            return value == this->operands[0];
+        case NE:
+            return value != this->operands[0];
+        case LT:
+            return value < this->operands[0];
+        case LE:
+            return !(this->operands[0] < value);
+        case GT:
+            return this->operands[0] < value;
+        case GE:
+            return !(value < this->operands[0]);
+        case BETWEEN:
+            return !(value < this->operands[0]) && !(this->operands[1] < value);
+        case IN:
+            return std::find(this->operands.begin(), this->operands.end(), value) != this->operands.end();
+        default:
+            return false;
+    }
+}
+
+bool Predicate::narrow(Value* &low, Value* &high) const {
+    const Value *new_low = nullptr, *new_high = nullptr;
+    bool exact = true;
+    switch (this->op) {
+        case EQ:
+            new_low = new_high = &this->operands[0];
+            break;
+        case LT:
+            exact = false;
+            // fall through
+        case LE:
+            new_high = &this->operands[0];
+            break;
+        case GT:
+            exact = false;
+            // fall through
+        case GE:
+            new_low = &this->operands[0];
+            break;
+        case BETWEEN:
+            new_low = &this->operands[0];
+            new_high = &this->operands[1];
+            break;
+        default:
+            return false;  // NE and IN don't make a single range
+    }
+    if (new_low != nullptr && (low == nullptr || *low < *new_low)) {
+        delete low;
+        low = new Value(*new_low);
+    }
+    if (new_high != nullptr && (high == nullptr || *new_high < *high)) {
+        delete high;
+        high = new Value(*new_high);
+    }
+    return exact;
+}
+
 // Get only selected column attributes
 ColumnAttributes* DbRelation::get_column_attributes(const ColumnNames &select_column_names) const {
     ColumnAttributes *ret = new ColumnAttributes();
@@ -46,6 +122,86 @@ ColumnAttributes* DbRelation::get_column_attributes(const ColumnNames &select_co
     return ret;
 }
 
+// Make sure each predicate's column exists and its operands are the column's type
+ColumnNames* DbRelation::check(const Conjunction& where) const {
+    ColumnNames *ret = new ColumnNames();
+    for (auto const& predicate: where) {
+        auto it = std::find(this->column_names.begin(), this->column_names.end(), predicate.column_name);
+        if (it == this->column_names.end()) {
+            delete ret;
+            throw DbRelationError("unknown column " + predicate.column_name);
+        }
+        ColumnAttribute ca = this->column_attributes[it - this->column_names.begin()];
+        for (auto const& operand: predicate.operands) {
+            if (operand.data_type != ca.get_data_type()) {
+                delete ret;
+                throw DbRelationError("cannot compare " + predicate.column_name + " (" + ca.get_data_type_string() +
+                                      ") to a value of another type");
+            }
+        }
+        if (std::find(ret->begin(), ret->end(), predicate.column_name) == ret->end())
+            ret->push_back(predicate.column_name);
+    }
+    return ret;
+}
+
+// Select everything, then test each row
+Handles* DbRelation::select(const Conjunction& where) {
+    Handles *all = select();
+    Handles *ret = select(all, where);
+    delete all;
+    return ret;
+}
+
+// Test each of the given rows
+Handles* DbRelation::select(Handles* current_selection, const Conjunction& where) {
+    ColumnNames *columns = check(where);
+    Handles *ret = new Handles();
+    for (auto const& handle: *current_selection) {
+        ValueDict *row = project(handle, columns);
+        bool selected = true;
+        for (auto const& predicate: where) {
+            if (!predicate.matches(row->at(predicate.column_name))) {
+                selected = false;
+                break;
+            }
+        }
+        delete row;
+        if (selected)
+            ret->push_back(handle);
+    }
+    delete columns;
+    return ret;
+}
+
+// Insert each of a list of rows
+Handles* DbRelation::insert_batch(const ValueDicts* rows) {
+    Handles *ret = new Handles();
+    for (auto const& row: *rows)
+        ret->push_back(insert(row));
+    return ret;
+}
+
+// Select everything, then project it
+ValueDicts* DbRelation::scan(const ColumnNames* column_names, Handles* handles) {
+    Handles *all = select();
+    ValueDicts *rows = project(all, column_names);
+    handles->insert(handles->end(), all->begin(), all->end());
+    delete all;
+    return rows;
+}
+
+// Generic batches: select everything, then project it a row at a time
+DbBatchCursor* DbRelation::batch_cursor(const ColumnNames& column_names) {
+    return new RelationBatchCursor(*this, column_names);
+}
+
+// Nothing to reclaim
+bool DbRelation::vacuum(VacuumProgress &progress, uint blocks, Relocations &moved) {
+    moved.clear();
+    return true;
+}
+
 // Just pulls out the column names from a ValueDict and passes that to the usual form of project().
 ValueDict* DbRelation::project(Handle handle, const ValueDict* where) {
     ColumnNames t;
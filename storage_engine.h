@@ -43,14 +43,27 @@ typedef std::length_error DbBlockNoRoomError;
  * 	get_block()
  * 	get_data()
  * 	get_block_id()
+ * 	get_block_size()
  */
 class DbBlock {
 public:
 	/**
-	 * our blocks are 4kB
+	 * our blocks are 4kB unless their file was created with a bigger page size
 	 */ 
 	static const uint BLOCK_SZ = 4096;
 
+	/**
+	 * largest page size a file can have (offsets within a block are 16 bits)
+	 */
+	static const uint MAX_BLOCK_SZ = 65536;
+
+	/**
+	 * Is size a page size a file can be created with: a power of two from BLOCK_SZ to MAX_BLOCK_SZ?
+	 */
+	static bool is_valid_block_size(uint size) {
+		return size >= BLOCK_SZ && size <= MAX_BLOCK_SZ && (size & (size - 1)) == 0;
+	}
+
 	/**
 	 * ctor/dtor (subclasses should handle the big-5)
 	 */ 
@@ -122,13 +135,40 @@ public:
 	 */
 	virtual BlockID get_block_id() {return block_id;}
 
+	/**
+	 * Get the size of this block's memory (the page size of its file).
+	 * @returns  size in bytes
+	 */
+	virtual uint get_block_size() const {return (uint) block.get_size();}
+
 protected:
 	Dbt block;
 	BlockID block_id;
 };
 
 // convenience type alias
-typedef std::vector<BlockID> BlockIDs;  // FIXME: will need to turn this into an iterator at some point
+typedef std::vector<BlockID> BlockIDs;  // prefer DbFile::cursor() for scans
+
+/**
+ * @class DbBlockCursor - abstract base class for walking the blocks of a DbFile in order
+ *
+ * Returned by DbFile::cursor(). Blocks come back in BlockID order without
+ * materializing the list of ids up front.
+ * 	next()
+ */
+class DbBlockCursor {
+public:
+	// ctor/dtor -- subclasses should handle big-5
+	DbBlockCursor() {}
+	virtual ~DbBlockCursor() {}
+
+	/**
+	 * Advance to the next block in the file.
+	 * @returns  the next block (freed by caller), or nullptr when the file is exhausted;
+	 *           the block's memory is only valid until the following call to next()
+	 */
+	virtual DbBlock* next() = 0;
+};
 
 /**
  * @class DbFile - abstract base class which represents a disk-based collection of DbBlocks
@@ -140,6 +180,7 @@ typedef std::vector<BlockID> BlockIDs;  // FIXME: will need to turn this into an
  *	get(block_id)
  *	put(block)
  *	block_ids()
+ *	cursor()
  */
 class DbFile {
 public:
@@ -188,11 +229,17 @@ public:
 
 	/**
 	 * Get a list of all the valid BlockID's in the file
-	 * FIXME - not a good long-term approach, but we'll do this until we put in iterators
+	 * Scans should use cursor() instead; this allocates one entry per block.
 	 * @returns  a pointer to vector of BlockIDs (freed by caller)
 	 */ 
 	virtual BlockIDs* block_ids() const = 0;
 
+	/**
+	 * Get a cursor that walks every block in the file in BlockID order.
+	 * @returns  pointer to a new cursor (freed by caller)
+	 */
+	virtual DbBlockCursor* cursor() = 0;
+
 protected:
 	std::string name;  // filename (or part of it)
 };
@@ -261,6 +308,69 @@ typedef std::pair<BlockID, RecordID> Handle;
 typedef std::vector<Handle> Handles;  // FIXME: will need to turn this into an iterator at some point
 typedef std::map<Identifier, Value> ValueDict;
 typedef std::vector<ValueDict*> ValueDicts;
+typedef std::pair<Handle, Handle> Relocation;  // a row that moved: its handle before and after
+typedef std::vector<Relocation> Relocations;
+
+
+/**
+ * @class Predicate - one where-clause test of a column against constants
+ *
+ * 	a = 1, a <> 1, a < 1, a <= 1, a > 1, a >= 1, a BETWEEN 1 AND 9, a IN (1, 3, 5)
+ * Operands are kept in the order they appear (low then high for BETWEEN).
+ */
+class Predicate {
+public:
+	enum Op {
+		EQ,
+		NE,
+		LT,
+		LE,
+		GT,
+		GE,
+		BETWEEN,
+		IN
+	};
+
+	Predicate(Identifier column_name, Op op, const Value& operand);  // use for the comparisons
+	Predicate(Identifier column_name, const Value& low, const Value& high);  // use for BETWEEN
+	Predicate(Identifier column_name, const std::vector<Value>& operands);  // use for IN
+	virtual ~Predicate() {}
+
+	/**
+	 * Does the column value pass this test?
+	 * @param value  the row's value for column_name
+	 */
+	virtual bool matches(const Value& value) const;
+
+	/**
+	 * Tighten [low, high] (either of which is nullptr if unbounded) to cover only the
+	 * values this predicate can match; only EQ, LE, GE and BETWEEN are described
+	 * exactly by such a range. Narrowed bounds are newly allocated (freed by caller).
+	 * @returns  true if this predicate is exactly the range it narrowed to
+	 */
+	virtual bool narrow(Value* &low, Value* &high) const;
+
+	Identifier column_name;
+	Op op;
+	std::vector<Value> operands;
+};
+
+// where-clause predicates ANDed together
+typedef std::vector<Predicate> Conjunction;
+
+
+class DbBatchCursor;
+
+/**
+ * @struct VacuumProgress - how far a run of DbRelation::vacuum() steps has got
+ */
+struct VacuumProgress {
+	VacuumProgress() : next_block(1), rows_moved(0), blocks_freed(0) {}
+
+	BlockID next_block;  // next block to compact; past the end once emptying the last blocks
+	u_long rows_moved;
+	u_long blocks_freed;
+};
 
 
 /**
@@ -284,12 +394,17 @@ public:
  * 	close()
  * 	
  *	insert(row)
+ *	insert_batch(rows)
  *	update(handle, new_values)
  *	del(handle)
  *	select()
  *	select(where)
+ *	select(conjunction)
  *	project(handle)
  *	project(handle, column_names)
+ *	scan(column_names, handles)
+ *	batch_cursor(column_names)
+ *	vacuum(progress, blocks, moved)
  */
 class DbRelation {
 public:
@@ -334,6 +449,14 @@ public:
 	 */
 	virtual Handle insert(const ValueDict* row) = 0;
 
+	/**
+	 * Execute: INSERT INTO <table_name> ( <row_keys> ) VALUES ( <row_values> ), ...
+	 * Default implementation just inserts the rows one at a time.
+	 * @param rows  list of dictionaries keyed by column names
+	 * @returns     pointer to a list of handles to the new rows, in order (freed by caller)
+	 */
+	virtual Handles* insert_batch(const ValueDicts* rows);
+
 	/**
 	 * Conceptually, execute: UPDATE INTO <table_name> SET <new_valus> WHERE <handle>
 	 * where handle is sufficient to identify one specific record (e.g., returned
@@ -373,6 +496,24 @@ public:
 	 */
 	virtual Handles* select(Handles* current_selection, const ValueDict* where) = 0;
 
+	/**
+	 * Conceptually, execute: SELECT <handle> FROM <table_name> WHERE <where>
+	 * where the predicates may be comparisons, BETWEEN, or IN.
+	 * Default implementation is select() then a projection of each row.
+	 * @param where  where-clause predicates, ANDed together
+	 * @returns      a pointer to a list of handles for qualifying rows (freed by caller)
+	 */
+	virtual Handles* select(const Conjunction& where);
+
+	/**
+	 * Conceptually, execute: SELECT <handle> FROM <table_name> WHERE <where>
+	 * restricted to the rows in current_selection.
+	 * @param current_selection  restrict selection to be from these rows
+	 * @param where              where-clause predicates, ANDed together
+	 * @returns                  a pointer to a list of handles for qualifying rows (freed by caller)
+	 */
+	virtual Handles* select(Handles* current_selection, const Conjunction& where);
+
 
 	/**
 	 * Return a sequence of all values for handle (SELECT *).
@@ -404,6 +545,34 @@ public:
 	virtual ValueDicts* project(Handles *handles, const ColumnNames* column_names);
 	virtual ValueDicts* project(Handles *handles, const ValueDict* column_names);
 
+	/**
+	 * Conceptually, execute: SELECT <handle>, <column_names> FROM <table_name>
+	 * in one pass over the relation. Default implementation is select() then project().
+	 * @param column_names  list of column names to project
+	 * @param handles       handles of all the rows are appended here, in scan order
+	 * @returns             dictionary of values for each row, matching handles (freed by caller)
+	 */
+	virtual ValueDicts* scan(const ColumnNames* column_names, Handles* handles);
+
+	/**
+	 * Read the given columns of every row a ColumnBatch at a time.
+	 * Default implementation is select() then project() of each row into the batch.
+	 * @param column_names  list of column names to read, in batch column order
+	 * @returns             cursor over the relation (freed by caller)
+	 */
+	virtual DbBatchCursor* batch_cursor(const ColumnNames& column_names);
+
+	/**
+	 * Do one step of reclaiming the space deleted rows left behind. Rows may move, so their
+	 * indices must be told where they went before anything else looks at the relation.
+	 * Default implementation has nothing to reclaim.
+	 * @param progress  where the previous step left off (a new VacuumProgress to start); updated
+	 * @param blocks    about how many blocks the step may touch
+	 * @param moved     set to the rows the step moved, each with its final handle
+	 * @returns         true once there is nothing left to do
+	 */
+	virtual bool vacuum(VacuumProgress &progress, uint blocks, Relocations &moved);
+
 	/**
 	 * Accessor for column_names.
 	 * @returns column_names   list of column names for this relation, in order
@@ -429,6 +598,13 @@ public:
 	 */
 	virtual ColumnAttributes* get_column_attributes(const ColumnNames &select_column_names) const;
 
+	/**
+	 * Check that every predicate names a column of this relation and has operands of its type.
+	 * @param where  where-clause predicates
+	 * @returns      the columns the predicates use, each once (freed by caller)
+	 */
+	virtual ColumnNames* check(const Conjunction& where) const;
+
 	virtual Identifier get_table_name() const{
 		return table_name;
 	}
@@ -439,6 +615,27 @@ protected:
 	ColumnAttributes column_attributes;
 };
 
+/**
+ * @class DbIndexCursor - abstract base class for streaming the handles of an index scan
+ *
+ * Returned by DbIndex::range_cursor(). Handles come back in key order one at a
+ * time, so a scan can stop early without materializing the whole range.
+ * 	next(handle)
+ */
+class DbIndexCursor {
+public:
+	// ctor/dtor -- subclasses should handle big-5
+	DbIndexCursor() {}
+	virtual ~DbIndexCursor() {}
+
+	/**
+	 * Advance to the next index entry in the scan.
+	 * @param handle  set to the entry's record handle
+	 * @returns       false (leaving handle alone) once the scan is exhausted
+	 */
+	virtual bool next(Handle &handle) = 0;
+};
+
 class DbIndex {
 public:
 	/**
@@ -488,6 +685,16 @@ public:
         throw DbRelationError("range index query not supported");
     }
 
+	/**
+	 * Stream a range of search keys.
+	 * @param min_key  dictionary of min (inclusive) search key, or nullptr for no lower bound
+	 * @param max_key  dictionary of max (inclusive) search key, or nullptr for no upper bound
+	 * @returns        cursor over DbFile handles for records in range (freed by caller)
+	 */
+    virtual DbIndexCursor* range_cursor(ValueDict* min_key, ValueDict* max_key) const {
+        throw DbRelationError("range index query not supported");
+    }
+
 	/**
 	 * Insert the index entry for the given record.
 	 * @param record  handle (into relation) to the record to insert
@@ -495,6 +702,17 @@ public:
 	 */
     virtual void insert(Handle record) = 0;
 
+	/**
+	 * Insert the index entries for a batch of records.
+	 * Default implementation just inserts them one at a time.
+	 * @param records  handles (into relation) to the records to insert
+	 *                 (must be in the relation at time of insertion)
+	 */
+    virtual void insert_batch(const Handles* records) {
+        for (auto const& record: *records)
+            insert(record);
+    }
+
 	/**
 	 * Delete the index entry for the given record.
 	 * @param record  handle (into relation) to the record to remove
@@ -502,6 +720,23 @@ public:
 	 */
     virtual void del(Handle record) = 0;
 
+	/**
+	 * Point the index entry for a record that has moved (see DbRelation::vacuum) at its new handle.
+	 * @param from  handle the record had
+	 * @param to    handle it has now (where it must be at the time of the call)
+	 */
+    virtual void relocate(Handle from, Handle to) {
+        throw DbRelationError("index can't follow rows that move");
+    }
+
+	/**
+	 * Accessor for key_columns.
+	 * @returns  the columns making up the search key, in order
+	 */
+    virtual const ColumnNames& get_key_columns() const {
+        return key_columns;
+    }
+
 protected:
     DbRelation& relation;
     Identifier name;
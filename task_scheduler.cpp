@@ -0,0 +1,182 @@
+/**
+ * @file task_scheduler.cpp - implementation of TaskScheduler and TaskGroup
+ *
+ * @see "Seattle University, CPSC5300, Summer 2018"
+ */
+#include "task_scheduler.h"
+
+using namespace std;
+
+/**
+ * @class TaskScheduler - fixed set of worker threads sharing work by stealing
+ */
+
+thread_local TaskScheduler* TaskScheduler::current_scheduler = nullptr;
+thread_local uint TaskScheduler::current_queue = 0;
+
+TaskScheduler& TaskScheduler::instance() {
+	static TaskScheduler scheduler;
+	return scheduler;
+}
+
+TaskScheduler::TaskScheduler(uint workers) : queues(), threads(), sleep_lock(), wake(),
+		queued(0), stopping(false), executed(0), steals(0) {
+	start(workers);
+}
+
+TaskScheduler::~TaskScheduler() {
+	stop();
+}
+
+void TaskScheduler::set_workers(uint workers) {
+	stop();
+	start(workers);
+}
+
+void TaskScheduler::start(uint workers) {
+	if (workers == 0) {
+		uint hardware = thread::hardware_concurrency();
+		workers = hardware > 1 ? hardware - 1 : 0;
+	}
+	this->stopping = false;
+	for (uint i = 0; i <= workers; i++)
+		this->queues.push_back(new Queue());
+	for (uint i = 0; i < workers; i++)
+		this->threads.push_back(thread(&TaskScheduler::work, this, i));
+}
+
+// wake everybody up to quit, then wait for them to do it
+void TaskScheduler::stop() {
+	{
+		lock_guard<mutex> guard(this->sleep_lock);
+		this->stopping = true;
+	}
+	this->wake.notify_all();
+	for (auto& worker: this->threads)
+		worker.join();
+	this->threads.clear();
+	for (auto queue: this->queues)
+		delete queue;
+	this->queues.clear();
+}
+
+// the calling worker's own deque, or the shared one for threads outside the pool
+uint TaskScheduler::own_queue() const {
+	if (current_scheduler == this)
+		return current_queue;
+	return (uint) this->queues.size() - 1;
+}
+
+void TaskScheduler::submit(Task task) {
+	Queue *queue = this->queues[own_queue()];
+	{
+		lock_guard<mutex> guard(queue->lock);
+		this->queued++;
+		queue->tasks.push_back(task);
+	}
+	{
+		lock_guard<mutex> guard(this->sleep_lock);  // so a worker about to sleep can't miss this
+	}
+	this->wake.notify_one();
+}
+
+// pop the newest task off our own deque, or steal the oldest off someone else's; false if all are empty
+bool TaskScheduler::run_one() {
+	if (this->queued == 0)
+		return false;
+	uint self = own_queue();
+	uint n = (uint) this->queues.size();
+	Task task;
+	bool found = false;
+	for (uint i = 0; i < n && !found; i++) {
+		uint victim = (self + i) % n;
+		Queue *queue = this->queues[victim];
+		lock_guard<mutex> guard(queue->lock);
+		if (queue->tasks.empty())
+			continue;
+		if (i == 0) {
+			task = queue->tasks.back();
+			queue->tasks.pop_back();
+		} else {
+			task = queue->tasks.front();
+			queue->tasks.pop_front();
+			this->steals++;
+		}
+		this->queued--;
+		found = true;
+	}
+	if (!found)
+		return false;
+
+	exception_ptr error;
+	try {
+		task.run();
+	} catch (...) {
+		error = current_exception();
+	}
+	this->executed++;
+	task.group->finished(error);
+	return true;
+}
+
+// worker thread: run tasks until told to stop, sleeping while there are none
+void TaskScheduler::work(uint self) {
+	current_scheduler = this;
+	current_queue = self;
+	while (true) {
+		if (run_one())
+			continue;
+		unique_lock<mutex> guard(this->sleep_lock);
+		this->wake.wait(guard, [this]() { return this->stopping || this->queued > 0; });
+		if (this->stopping)
+			return;
+	}
+}
+
+/**
+ * @class TaskGroup - a batch of tasks to run on a TaskScheduler and wait for together
+ */
+
+TaskGroup::TaskGroup(TaskScheduler &scheduler) : scheduler(scheduler), pending(0), failure(), lock(), done() {
+}
+
+// never leave tasks running that refer to this group
+TaskGroup::~TaskGroup() {
+	try {
+		wait();
+	} catch (...) {
+	}
+}
+
+void TaskGroup::run(function<void()> task) {
+	this->pending++;
+	TaskScheduler::Task t;
+	t.run = task;
+	t.group = this;
+	this->scheduler.submit(t);
+}
+
+void TaskGroup::wait() {
+	while (this->pending > 0) {
+		if (this->scheduler.run_one())
+			continue;
+		// the rest are running on workers: sleep until the last of them is done
+		unique_lock<mutex> guard(this->lock);
+		this->done.wait(guard, [this]() { return this->pending == 0; });
+	}
+	lock_guard<mutex> guard(this->lock);
+	if (this->failure) {
+		exception_ptr error = this->failure;
+		this->failure = nullptr;
+		rethrow_exception(error);
+	}
+}
+
+// under the lock, so a waiter can't see pending reach zero and destroy the group before we're done with it
+void TaskGroup::finished(exception_ptr error) {
+	lock_guard<mutex> guard(this->lock);
+	if (error && !this->failure)
+		this->failure = error;
+	if (--this->pending == 0)
+		this->done.notify_all();
+}
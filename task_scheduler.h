@@ -0,0 +1,154 @@
+/**
+ * @file task_scheduler.h - work-stealing pool of worker threads.
+ * TaskScheduler
+ * TaskGroup
+ * parallel_sort
+ *
+ * @see "Seattle University, CPSC5300, Summer 2018"
+ */
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "storage_engine.h"
+
+class TaskGroup;  // forward declare
+
+/**
+ * @class TaskScheduler - fixed set of worker threads sharing work by stealing
+ *
+ * Each worker has its own deque of tasks: it pushes and pops at the back (so nested
+ * work stays hot in its cache) and, when that runs dry, steals from the front of
+ * the others'. Tasks submitted from outside the pool go into one more deque that
+ * every worker also steals from. Work is submitted through a TaskGroup, whose
+ * wait() runs tasks on the waiting thread too, so a pool of 0 workers still works
+ * (everything just runs on the caller).
+ * 	set_workers(workers)
+ * 	get_workers()
+ */
+class TaskScheduler {
+	friend class TaskGroup;
+public:
+	/**
+	 * The process-wide scheduler used by scans, index builds and sorts.
+	 */
+	static TaskScheduler& instance();
+
+	// ctor/dtor
+	TaskScheduler(uint workers=0);
+	virtual ~TaskScheduler();
+	TaskScheduler(const TaskScheduler& other) = delete;
+	TaskScheduler(TaskScheduler&& temp) = delete;
+	TaskScheduler& operator=(const TaskScheduler& other) = delete;
+	TaskScheduler& operator=(TaskScheduler&& temp) = delete;
+
+	/**
+	 * Restart the pool with a different number of worker threads. Must not be called
+	 * while any TaskGroup has work outstanding.
+	 * @param workers  number of threads; 0 for one fewer than the hardware threads
+	 *                 (the thread waiting on a TaskGroup makes up the difference)
+	 */
+	virtual void set_workers(uint workers);
+	uint get_workers() const { return (uint) threads.size(); }
+
+	// statistics
+	u_long get_executed() const { return executed; }
+	u_long get_steals() const { return steals; }
+
+protected:
+	struct Task {
+		std::function<void()> run;
+		TaskGroup *group;
+	};
+	struct Queue {
+		std::deque<Task> tasks;
+		std::mutex lock;
+	};
+
+	std::vector<Queue*> queues;  // one per worker, then one for threads outside the pool
+	std::vector<std::thread> threads;
+	std::mutex sleep_lock;
+	std::condition_variable wake;
+	std::atomic<u_long> queued;  // tasks sitting in any queue
+	bool stopping;
+	std::atomic<u_long> executed;
+	std::atomic<u_long> steals;
+
+	static thread_local TaskScheduler *current_scheduler;  // pool the calling thread works for, if any
+	static thread_local uint current_queue;                // and its queue there
+
+	virtual void start(uint workers);
+	virtual void stop();
+	virtual void submit(Task task);
+	virtual bool run_one();
+	virtual void work(uint self);
+	uint own_queue() const;
+};
+
+/**
+ * @class TaskGroup - a batch of tasks to run on a TaskScheduler and wait for together
+ *
+ * The waiting thread helps with whatever is queued; once nothing is left to run but the
+ * group still has tasks out on workers, it sleeps until the last of them finishes.
+ * 	run(task)
+ * 	wait()
+ */
+class TaskGroup {
+	friend class TaskScheduler;
+public:
+	TaskGroup(TaskScheduler &scheduler=TaskScheduler::instance());
+	virtual ~TaskGroup();
+	TaskGroup(const TaskGroup& other) = delete;
+	TaskGroup(TaskGroup&& temp) = delete;
+	TaskGroup& operator=(const TaskGroup& other) = delete;
+	TaskGroup& operator=(TaskGroup&& temp) = delete;
+
+	/**
+	 * Queue a task. It may start right away on a worker.
+	 * @param task  work to do; may itself run more tasks in this or another group
+	 */
+	virtual void run(std::function<void()> task);
+
+	/**
+	 * Run queued tasks on this thread until every task of the group is done.
+	 * @throws  the first exception any of the group's tasks threw
+	 */
+	virtual void wait();
+
+protected:
+	TaskScheduler &scheduler;
+	std::atomic<u_long> pending;
+	std::exception_ptr failure;
+	std::mutex lock;                // guards failure, and pending reaching zero
+	std::condition_variable done;   // signaled when it does
+
+	virtual void finished(std::exception_ptr error);
+};
+
+/**
+ * Sort a random-access range with the scheduler: halves are sorted as separate tasks
+ * (recursively, down to runs of grain elements) and merged back together.
+ * @param first, last  range to sort
+ * @param less         strict weak ordering, as for std::sort
+ * @param grain        runs this short or shorter are just std::sort-ed
+ */
+template <typename Iterator, typename Less>
+void parallel_sort(Iterator first, Iterator last, Less less, size_t grain=8192) {
+	if ((size_t)(last - first) <= grain) {
+		std::sort(first, last, less);
+		return;
+	}
+	Iterator middle = first + (last - first) / 2;
+	TaskGroup group;
+	group.run([=]() { parallel_sort(first, middle, less, grain); });
+	parallel_sort(middle, last, less, grain);
+	group.wait();
+	std::inplace_merge(first, middle, last, less);
+}
@@ -0,0 +1,123 @@
+/**
+ * @file transaction.cpp - implementation of TransactionManager
+ *
+ * @see "Seattle University, CPSC5300, Summer 2018"
+ */
+#include "transaction.h"
+#include "buffer_pool.h"
+#include "heap_storage.h"
+
+using namespace std;
+
+TransactionManager& TransactionManager::instance() {
+	static TransactionManager manager;
+	return manager;
+}
+
+TransactionManager::TransactionManager() : active(false), txn(nullptr), files(), files_lock(),
+		flush_lock(), flush_done(), flushing(false), committed(0), flushed(0), rollbacks(0), log_flushes(0) {
+}
+
+// a transaction still open at exit never committed
+TransactionManager::~TransactionManager() {
+	if (this->txn != nullptr)
+		this->txn->abort();
+}
+
+void TransactionManager::begin() {
+	if (this->active)
+		throw DbRelationError("a transaction is already in progress");
+	BufferPool::instance().checkpoint();
+	if (transactional())
+		_DB_ENV->txn_begin(nullptr, &this->txn, 0);
+	this->active = true;
+}
+
+u_long TransactionManager::commit() {
+	if (!this->active)
+		throw DbRelationError("no transaction in progress");
+	try {
+		BufferPool::instance().checkpoint();
+	} catch (...) {
+		rollback();
+		throw;
+	}
+	if (this->txn != nullptr)
+		this->txn->commit(DB_TXN_NOSYNC);  // make_durable() syncs the log for a whole group of these
+	this->txn = nullptr;
+	this->active = false;
+	{
+		lock_guard<mutex> guard(this->files_lock);
+		this->files.clear();
+	}
+	lock_guard<mutex> guard(this->flush_lock);
+	return ++this->committed;
+}
+
+void TransactionManager::rollback() {
+	if (!this->active)
+		throw DbRelationError("no transaction in progress");
+	BufferPool::instance().discard_dirty();
+	if (this->txn != nullptr)
+		this->txn->abort();
+	this->txn = nullptr;
+	this->active = false;
+	set<HeapFile*> changed;
+	{
+		lock_guard<mutex> guard(this->files_lock);
+		changed.swap(this->files);
+	}
+	for (auto file: changed)
+		file->refresh();  // blocks appended by the transaction are gone again
+	lock_guard<mutex> guard(this->flush_lock);
+	this->rollbacks++;
+}
+
+void TransactionManager::make_durable(u_long ticket) {
+	unique_lock<mutex> guard(this->flush_lock);
+	while (this->flushed < ticket) {
+		if (this->flushing) {
+			this->flush_done.wait(guard);
+			continue;
+		}
+		// lead a flush covering every commit so far, ours included
+		this->flushing = true;
+		u_long target = this->committed;
+		guard.unlock();
+		try {
+			flush_log();
+		} catch (...) {
+			guard.lock();
+			this->flushing = false;
+			this->flush_done.notify_all();
+			throw;
+		}
+		guard.lock();
+		this->flushing = false;
+		if (target > this->flushed)
+			this->flushed = target;
+		this->log_flushes++;
+		this->flush_done.notify_all();
+	}
+}
+
+void TransactionManager::touched(HeapFile *file) {
+	if (!this->active)
+		return;
+	lock_guard<mutex> guard(this->files_lock);
+	this->files.insert(file);
+}
+
+void TransactionManager::forget(HeapFile *file) {
+	lock_guard<mutex> guard(this->files_lock);
+	this->files.erase(file);
+}
+
+bool TransactionManager::transactional() {
+	return (HeapFile::environment_flags() & DB_INIT_TXN) != 0;
+}
+
+void TransactionManager::flush_log() {
+	if (transactional())
+		_DB_ENV->log_flush(nullptr);
+}
@@ -0,0 +1,131 @@
+/**
+ * @file transaction.h - BEGIN/COMMIT/ROLLBACK on top of Berkeley DB transactions.
+ * TransactionManager
+ *
+ * @see "Seattle University, CPSC5300, Summer 2018"
+ */
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include "db_cxx.h"
+#include "storage_engine.h"
+
+class HeapFile;  // forward declare
+
+/**
+ * @class TransactionManager - the one open transaction and the group commit of its log records
+ *
+ * Changes only reach Berkeley DB when the BufferPool writes a dirty frame back, so a
+ * transaction is the span during which every such write-back (and every read, so we never
+ * wait on our own page locks) goes through one DbTxn. commit() writes back everything still
+ * dirty inside the DbTxn and commits it without syncing the log; rollback() throws the dirty
+ * frames away and aborts the DbTxn, which undoes whatever was written back early, so after
+ * either one the pool holds only committed blocks again.
+ *
+ * Durability is group commit: make_durable() waits until the log is flushed past the caller's
+ * commit. Whichever committer finds no flush under way becomes the leader and flushes the log
+ * up to the latest commit at that moment; everybody who committed before that is released by
+ * the same fsync, and commits arriving during it are picked up by the next leader. Callers do
+ * this after letting go of the engine lock, so the next statement runs while the log syncs.
+ *
+ * There is at most one transaction at a time: the SQL front end runs statements one at a time
+ * and holds its engine lock from BEGIN to COMMIT. If the environment wasn't opened with
+ * DB_INIT_TXN there is no DbTxn; commit still writes back and rollback still discards what is
+ * in the pool, but neither is atomic on disk.
+ * 	begin()
+ * 	commit()
+ * 	rollback()
+ * 	make_durable(ticket)
+ */
+class TransactionManager {
+public:
+	/**
+	 * The process-wide transaction manager used by HeapFile and the SQL front end.
+	 */
+	static TransactionManager& instance();
+
+	// ctor/dtor
+	TransactionManager();
+	virtual ~TransactionManager();
+	TransactionManager(const TransactionManager& other) = delete;
+	TransactionManager(TransactionManager&& temp) = delete;
+	TransactionManager& operator=(const TransactionManager& other) = delete;
+	TransactionManager& operator=(TransactionManager&& temp) = delete;
+
+	/**
+	 * Start a transaction. Dirty frames left over from outside any transaction are written
+	 * back first, so the transaction can tell its own changes by their being dirty.
+	 * @throws  DbRelationError if one is already in progress
+	 */
+	virtual void begin();
+
+	/**
+	 * Write back the transaction's changes and commit it (not yet durable).
+	 * @returns  ticket to hand to make_durable()
+	 * @throws   DbRelationError if no transaction is in progress
+	 */
+	virtual u_long commit();
+
+	/**
+	 * Discard the transaction's changes and abort it.
+	 * @throws  DbRelationError if no transaction is in progress
+	 */
+	virtual void rollback();
+
+	/**
+	 * Wait until the commit that handed out ticket is on disk, flushing the log for it and
+	 * every other waiting commit if nobody else is already doing so.
+	 * @param ticket  what commit() returned
+	 */
+	virtual void make_durable(u_long ticket);
+
+	/**
+	 * Is a transaction in progress?
+	 */
+	bool in_transaction() const { return active; }
+
+	/**
+	 * The Berkeley DB transaction for reads and write-backs, or nullptr outside one
+	 * (or in an environment without transactions).
+	 */
+	DbTxn* current() const { return txn; }
+
+	/**
+	 * Note that the transaction changed file, so a rollback must recount its blocks.
+	 */
+	virtual void touched(HeapFile *file);
+
+	/**
+	 * Stop tracking file (used when the HeapFile handle goes away).
+	 */
+	virtual void forget(HeapFile *file);
+
+	/**
+	 * Was the environment opened with DB_INIT_TXN?
+	 */
+	static bool transactional();
+
+	// statistics
+	u_long get_commits() const { return committed; }
+	u_long get_rollbacks() const { return rollbacks; }
+	u_long get_log_flushes() const { return log_flushes; }
+
+protected:
+	std::atomic<bool> active;
+	DbTxn *txn;
+	std::set<HeapFile*> files;  // files the transaction appended to or changed
+	std::mutex files_lock;      // guards files
+
+	std::mutex flush_lock;      // guards the rest
+	std::condition_variable flush_done;
+	bool flushing;              // a leader is in log_flush right now
+	u_long committed;           // tickets handed out so far
+	u_long flushed;             // every ticket up to this one is durable
+	u_long rollbacks;
+	u_long log_flushes;
+
+	virtual void flush_log();
+};
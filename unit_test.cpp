@@ -5,8 +5,22 @@
  */
  
 #include "unit_test.h"
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 #include "db_cxx.h"
 #include "heap_storage.h"
+#include "EvalPlan.h"
+#include "filter_kernels.h"
+#include "hash_index.h"
+#include "task_scheduler.h"
+#include "sql_server.h"
+#include "transaction.h"
 
 using namespace std;
 
@@ -16,7 +30,7 @@ void test_slotted_page_when_empty()
 	std::cout << "test_slotted_page_when_empty..." << std::endl;
 	
 	std::unique_ptr<char[]> block_space(new char[DbBlock::BLOCK_SZ]);
-	Dbt block(block_space.get(), sizeof(block_space));
+	Dbt block(block_space.get(), DbBlock::BLOCK_SZ);
 	SlottedPage slotted_page(block, 1, true);
 	
 	std::unique_ptr<RecordIDs> record_ids(slotted_page.ids());
@@ -32,7 +46,7 @@ void test_slotted_page_add()
 	std::cout << "test_slotted_page_add..." << std::endl;
 	
 	std::unique_ptr<char[]> block_space(new char[DbBlock::BLOCK_SZ]);
-	Dbt block(block_space.get(), sizeof(block_space));
+	Dbt block(block_space.get(), DbBlock::BLOCK_SZ);
 	SlottedPage slotted_page(block, 1, true);
 	
 	Dbt record((char*) "a", 2);
@@ -49,7 +63,7 @@ void test_slotted_page_get()
 	std::cout << "test_slotted_page_get..." << std::endl;
 	
 	std::unique_ptr<char[]> block_space(new char[DbBlock::BLOCK_SZ]);
-	Dbt block(block_space.get(), sizeof(block_space));
+	Dbt block(block_space.get(), DbBlock::BLOCK_SZ);
 	SlottedPage slotted_page(block, 1, true);
 	
 	Dbt record((char*)"HelloWorld", 11);
@@ -69,7 +83,7 @@ void test_slotted_page_put()
 	std::cout << "test_slotted_page_put..." << std::endl;
 	
 	std::unique_ptr<char[]> block_space(new char[DbBlock::BLOCK_SZ]);
-	Dbt block(block_space.get(), sizeof(block_space));
+	Dbt block(block_space.get(), DbBlock::BLOCK_SZ);
 	SlottedPage slotted_page(block, 1, true);
 	
 	Dbt record((char*)"HelloWorld", 11);
@@ -93,7 +107,7 @@ void test_slotted_page_del()
 	std::cout << "test_slotted_page_del..." << std::endl;
 	
 	std::unique_ptr<char[]> block_space(new char[DbBlock::BLOCK_SZ]);
-	Dbt block(block_space.get(), sizeof(block_space));
+	Dbt block(block_space.get(), DbBlock::BLOCK_SZ);
 	SlottedPage slotted_page(block, 1, true);
 
 	
@@ -114,7 +128,7 @@ void test_slotted_page_get_block_id()
 	std::cout << "test_slotted_page_get_block_id..." << std::endl;
 	
 	std::unique_ptr<char[]> block_space(new char[DbBlock::BLOCK_SZ]);
-	Dbt block(block_space.get(), sizeof(block_space));
+	Dbt block(block_space.get(), DbBlock::BLOCK_SZ);
 	SlottedPage slotted_page(block, 1, true);
 	
 	if (slotted_page.get_block_id() != 1)
@@ -128,7 +142,7 @@ void test_slotted_page_get_data()
 	std::cout << "test_slotted_page_get_data..." << std::endl;
 	
 	std::unique_ptr<char[]> block_space(new char[DbBlock::BLOCK_SZ]);
-	Dbt block(block_space.get(), sizeof(block_space));
+	Dbt block(block_space.get(), DbBlock::BLOCK_SZ);
 	SlottedPage slotted_page(block, 1, true);
 	
 	if (slotted_page.get_data() != block_space.get())
@@ -142,7 +156,7 @@ void test_slotted_page_get_block()
 	std::cout << "test_slotted_page_get_block..." << std::endl;
 	
 	std::unique_ptr<char[]> block_space(new char[DbBlock::BLOCK_SZ]);
-	Dbt block(block_space.get(), sizeof(block_space));
+	Dbt block(block_space.get(), DbBlock::BLOCK_SZ);
 	SlottedPage slotted_page(block, 1, true);
 	
 	if (slotted_page.get_block()->get_data() != block_space.get())
@@ -156,7 +170,7 @@ void test_slotted_page_with_old_block()
 	std::cout << "test_slotted_page_with_old_block..." << std::endl;
 	
 	std::unique_ptr<char[]> block_space(new char[DbBlock::BLOCK_SZ]);
-	Dbt block(block_space.get(), sizeof(block_space));
+	Dbt block(block_space.get(), DbBlock::BLOCK_SZ);
 	SlottedPage slotted_page(block, 1, true);
 	
 	Dbt record((char*)"HelloWorld", 11);
@@ -177,7 +191,7 @@ void test_slotted_page_ids()
 	std::cout << "test_slotted_page_ids..." << std::endl;
 	
 	std::unique_ptr<char[]> block_space(new char[DbBlock::BLOCK_SZ]);
-	Dbt block(block_space.get(), sizeof(block_space));
+	Dbt block(block_space.get(), DbBlock::BLOCK_SZ);
 	SlottedPage slotted_page(block, 1, true);
 	
 	Dbt record((char*)"HelloWorld", 11);
@@ -197,6 +211,69 @@ void test_slotted_page_ids()
 	}
 }
 
+void test_slotted_page_holes()
+{
+	std::cout << "test_slotted_page_holes..." << std::endl;
+	
+	std::unique_ptr<char[]> block_space(new char[DbBlock::BLOCK_SZ]);
+	Dbt block(block_space.get(), DbBlock::BLOCK_SZ);
+	SlottedPage slotted_page(block, 1, true);
+	
+	std::string records[41];
+	for (RecordID id = 1; id <= 40; id++)
+	{
+		records[id] = std::string(90, (char)('A' + id % 26));
+		Dbt record((void*)records[id].c_str(), 90);
+		slotted_page.add(&record);
+	}
+	uint free = slotted_page.free_space();
+	for (RecordID id = 2; id <= 40; id += 2)
+	{
+		slotted_page.del(id);
+	}
+	if (slotted_page.free_space() != free + 20 * 90)
+	{
+		throw test_fail_error("slotted_page free_space() doesn't count the holes deletes left");
+	}
+	
+	SlottedPage reread(block, 1, false);
+	if (reread.free_space() != free + 20 * 90)
+	{
+		throw test_fail_error("slotted_page free_space() miscounted the holes of a block read back");
+	}
+	
+	// exactly as big as free_space(): only fits by closing up the holes
+	std::string big(slotted_page.free_space(), 'z');
+	Dbt big_record((void*)big.c_str(), (u_int32_t)big.size());
+	RecordID big_id = slotted_page.add(&big_record);
+	if (slotted_page.free_space() != 0)
+	{
+		throw test_fail_error("slotted_page add() left room after filling free_space()");
+	}
+	Dbt one((char*)"", 1);
+	try
+	{
+		slotted_page.add(&one);
+		throw test_fail_error("slotted_page add() took a record into a full block");
+	}
+	catch (DbBlockNoRoomError &e)
+	{
+	}
+	
+	// growing a record moves it, closing up the holes the big record leaves
+	slotted_page.del(big_id);
+	records[1] = std::string(300, '1');
+	slotted_page.put(1, Dbt((void*)records[1].c_str(), 300));
+	for (RecordID id = 1; id <= 40; id += 2)
+	{
+		std::unique_ptr<Dbt> dbt(slotted_page.get(id));
+		if (dbt == nullptr || std::string((char*)dbt->get_data(), dbt->get_size()) != records[id])
+		{
+			throw test_fail_error("slotted_page lost a record moving records around");
+		}
+	}
+}
+
 void test_slotted_page() throw (test_fail_error)
 {
 	test_slotted_page_when_empty();
@@ -208,6 +285,7 @@ void test_slotted_page() throw (test_fail_error)
 	test_slotted_page_ids();
 	test_slotted_page_get_block();
 	test_slotted_page_get_data();
+	test_slotted_page_holes();
 }
 
 void test_heap_file_create()
@@ -346,6 +424,148 @@ void test_heap_file_block_ids()
 	heap_file.drop();
 }
 
+void test_heap_file_cursor()
+{
+	std::cout << "test_heap_file_cursor..." << std::endl;
+	
+	HeapFile heap_file("heap_file_u");
+	heap_file.create();
+	heap_file.open();
+	
+	std::unique_ptr<SlottedPage> slotted_page(heap_file.get_new());
+	Dbt dbt((char*)"HelloWorld", 11);
+	slotted_page->add(&dbt);
+	heap_file.put(slotted_page.get());
+	std::unique_ptr<SlottedPage> slotted_page_2(heap_file.get_new());
+	
+	std::unique_ptr<HeapFileCursor> cursor(heap_file.cursor());
+	BlockID expected = 1;
+	for (SlottedPage *block = cursor->next(); block != nullptr; block = cursor->next())
+	{
+		std::unique_ptr<SlottedPage> page(block);
+		if (page->get_block_id() != expected)
+		{
+			throw test_fail_error("heap_file cursor() returned blocks out of order");
+		}
+		if (expected == 2)
+		{
+			std::unique_ptr<Dbt> record(page->get(1));
+			if (std::string((char*)record->get_data()) != "HelloWorld")
+			{
+				throw test_fail_error("heap_file cursor() returned wrong block contents");
+			}
+		}
+		expected++;
+	}
+	
+	if (expected != 4)
+	{
+		throw test_fail_error("heap_file cursor() did not visit every block");
+	}
+	
+	cursor.reset();
+	heap_file.drop();
+}
+
+void test_heap_file_cursor_in_transaction()
+{
+	std::cout << "test_heap_file_cursor_in_transaction..." << std::endl;
+
+	HeapFile heap_file("heap_file_txn");
+	heap_file.create();
+	heap_file.open();
+	TransactionManager &manager = TransactionManager::instance();
+	manager.begin();
+	for (int i = 1; i <= 5; i++)
+	{
+		std::unique_ptr<SlottedPage> page(i == 1 ? heap_file.get(1) : heap_file.get_new());
+		std::string text = "block " + std::to_string(i);
+		Dbt dbt((char*)text.c_str(), (u_int32_t)text.size() + 1);
+		page->add(&dbt);
+		heap_file.put(page.get());
+	}
+	BufferPool::instance().checkpoint();  // on disk, inside the transaction
+
+	// a write-back while the cursor sits on a page must not wait on the cursor's lock
+	std::unique_ptr<HeapFileCursor> cursor(heap_file.cursor());
+	bool transactional = (HeapFile::environment_flags() & DB_INIT_TXN) != 0;
+	if (transactional && !cursor->is_sequential())
+	{
+		manager.rollback();
+		throw test_fail_error("heap_file cursor() did not read sequentially inside a transaction");
+	}
+	BlockID expected = 1;
+	for (SlottedPage *block = cursor->next(); block != nullptr; block = cursor->next())
+	{
+		std::unique_ptr<SlottedPage> page(block);
+		std::unique_ptr<Dbt> record(page->get(1));
+		if (page->get_block_id() != expected ||
+			std::string((char*)record->get_data()) != "block " + std::to_string(expected))
+		{
+			cursor.reset();
+			manager.rollback();
+			throw test_fail_error("heap_file cursor() in a transaction returned the wrong block");
+		}
+		std::unique_ptr<SlottedPage> written(heap_file.get(expected));
+		Dbt dbt((char*)"more", 5);
+		written->add(&dbt);
+		heap_file.put(written.get());
+		BufferPool::instance().checkpoint();
+		expected++;
+	}
+	cursor.reset();
+	manager.make_durable(manager.commit());
+
+	if (expected != 6)
+	{
+		throw test_fail_error("heap_file cursor() in a transaction did not visit every block");
+	}
+	heap_file.drop();
+}
+
+void test_heap_file_buffer_pool()
+{
+	std::cout << "test_heap_file_buffer_pool..." << std::endl;
+	
+	BufferPool &pool = BufferPool::instance();
+	HeapFile heap_file("heap_file_u");
+	heap_file.create();
+	
+	std::unique_ptr<SlottedPage> slotted_page(heap_file.get_new());
+	Dbt dbt((char*)"HelloWorld", 11);
+	slotted_page->add(&dbt);
+	heap_file.put(slotted_page.get());
+	slotted_page.reset();
+	
+	u_long hits = pool.get_hits();
+	u_long writes = pool.get_writes();
+	
+	std::unique_ptr<SlottedPage> cached(heap_file.get(2));
+	std::unique_ptr<Dbt> record(cached->get(1));
+	
+	if (pool.get_hits() != hits + 1 || std::string((char*)record->get_data()) != "HelloWorld")
+	{
+		throw test_fail_error("buffer pool should serve a block that was just put");
+	}
+	
+	if (pool.get_writes() != writes)
+	{
+		throw test_fail_error("heap_file put() should not write through the buffer pool");
+	}
+	
+	record.reset();
+	cached.reset();
+	heap_file.close();
+	
+	// blocks 1 and 2 were both only ever in the pool
+	if (pool.get_writes() != writes + 2)
+	{
+		throw test_fail_error("heap_file close() should write back the dirty blocks");
+	}
+	
+	heap_file.drop();
+}
+
 void test_heap_file() throw (test_fail_error)
 {	
 	test_heap_file_create();
@@ -355,6 +575,9 @@ void test_heap_file() throw (test_fail_error)
 	test_heap_file_get_new();
 	test_heap_file_get_put();
 	test_heap_file_block_ids();
+	test_heap_file_cursor();
+	test_heap_file_cursor_in_transaction();
+	test_heap_file_buffer_pool();
 }
 
 void test_heap_table_create(ColumnNames &column_names, ColumnAttributes& column_attributes)
@@ -521,6 +744,167 @@ void test_heap_table_project(ColumnNames &column_names, ColumnAttributes& column
 	heap_table.drop();
 }
 
+void test_heap_table_insert_batch(ColumnNames &column_names, ColumnAttributes& column_attributes)
+{
+	std::cout << "test_heap_table_insert_batch..." << std::endl;
+	
+	HeapTable heap_table("heap_table_u", column_names, column_attributes);
+	heap_table.create();
+	
+	// enough rows to spill over several blocks
+	ValueDicts rows;
+	for (int i = 0; i < 1000; i++)
+	{
+		ValueDict *row = new ValueDict();
+		(*row)["a"] = Value("row" + std::to_string(i));
+		(*row)["b"] = Value(i);
+		rows.push_back(row);
+	}
+	
+	BufferPool &pool = BufferPool::instance();
+	u_long writes = pool.get_writes();
+	
+	std::unique_ptr<Handles> handles(heap_table.insert_batch(&rows));
+	for (auto row : rows)
+		delete row;
+	
+	if (handles->size() != 1000 || handles->back().first < 3)
+	{
+		heap_table.drop();
+		throw test_fail_error("heap_table insert_batch() should return a handle per row across several blocks");
+	}
+	
+	if (pool.get_writes() != writes)
+	{
+		heap_table.drop();
+		throw test_fail_error("heap_table insert_batch() should leave its blocks in the buffer pool");
+	}
+	
+	std::unique_ptr<Handles> selected(heap_table.select());
+	std::unique_ptr<ValueDict> last(heap_table.project(selected->back()));
+	
+	if (selected->size() != 1000 || last->at("a").s != "row999" || last->at("b").n != 999)
+	{
+		heap_table.drop();
+		throw test_fail_error("heap_table insert_batch() rows do not read back");
+	}
+	
+	heap_table.drop();
+}
+
+void test_heap_table_select_conjunction()
+{
+	std::cout << "test_heap_table_select_conjunction..." << std::endl;
+	
+	// TEXT first, so the later columns have no fixed offset
+	ColumnNames column_names;
+	ColumnAttributes column_attributes;
+	column_names.push_back("name");
+	column_names.push_back("n");
+	column_names.push_back("tag");
+	column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+	column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+	column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+	
+	HeapTable heap_table("heap_table_c", column_names, column_attributes);
+	heap_table.create();
+	
+	for (int i = 0; i < 300; i++)
+	{
+		ValueDict row;
+		row["name"] = Value(std::string(i % 7, 'x'));
+		row["n"] = Value(i - 150);
+		row["tag"] = Value(i % 3 == 0 ? "ab" : (i % 3 == 1 ? "abc" : "b"));
+		heap_table.insert(&row);
+	}
+	
+	// n in [-10, 10], tag >= "abc" ("abc" or "b"): 21 rows, minus the 7 with i % 3 == 0
+	Conjunction where;
+	where.push_back(Predicate("n", Value(-10), Value(10)));
+	where.push_back(Predicate("tag", Predicate::GE, Value("abc")));
+	std::unique_ptr<Handles> handles(heap_table.select(where));
+	
+	std::vector<Value> names;
+	names.push_back(Value(""));
+	names.push_back(Value("xxxxxx"));
+	Conjunction in_where;
+	in_where.push_back(Predicate("name", names));
+	in_where.push_back(Predicate("n", Predicate::LT, Value(0)));
+	std::unique_ptr<Handles> in_handles(heap_table.select(in_where));
+	
+	ValueDict equal;
+	equal["tag"] = Value("b");
+	equal["n"] = Value(-148);
+	std::unique_ptr<Handles> equal_handles(heap_table.select(&equal));
+	std::unique_ptr<Handles> refined(heap_table.select(equal_handles.get(), where));
+	
+	heap_table.drop();
+	
+	if (handles->size() != 14)
+	{
+		throw test_fail_error("heap_table select(conjunction) with BETWEEN and >= on TEXT failed");
+	}
+	// i in [0, 150) with i % 7 == 0 or 6
+	if (in_handles->size() != 43)
+	{
+		throw test_fail_error("heap_table select(conjunction) with IN failed");
+	}
+	if (equal_handles->size() != 1 || !refined->empty())
+	{
+		throw test_fail_error("heap_table select(where) failed");
+	}
+}
+
+void test_heap_table_parallel_scan()
+{
+	std::cout << "test_heap_table_parallel_scan..." << std::endl;
+	
+	ColumnNames column_names;
+	ColumnAttributes column_attributes;
+	column_names.push_back("a");
+	column_names.push_back("b");
+	column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+	column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+	
+	HeapTable heap_table("heap_table_p", column_names, column_attributes);
+	heap_table.create();
+	
+	// ~20 rows a block, so well over PARALLEL_MIN_BLOCKS
+	ValueDicts rows;
+	for (int i = 0; i < 3000; i++)
+	{
+		ValueDict* row = new ValueDict();
+		(*row)["a"] = Value(i % 10);
+		(*row)["b"] = Value(std::string(150 + i % 50, 'p'));
+		rows.push_back(row);
+	}
+	delete heap_table.insert_batch(&rows);
+	for (auto row: rows)
+		delete row;
+	
+	Conjunction where;
+	where.push_back(Predicate("a", Predicate::EQ, Value(3)));
+	uint threads = HeapTable::get_scan_threads();
+	HeapTable::set_scan_threads(1);
+	std::unique_ptr<Handles> serial_all(heap_table.select());
+	std::unique_ptr<Handles> serial(heap_table.select(where));
+	HeapTable::set_scan_threads(4);
+	std::unique_ptr<Handles> parallel_all(heap_table.select());
+	std::unique_ptr<Handles> parallel(heap_table.select(where));
+	HeapTable::set_scan_threads(threads);
+	
+	heap_table.drop();
+	
+	if (serial_all->size() != 3000 || *parallel_all != *serial_all)
+	{
+		throw test_fail_error("heap_table parallel select() differs from a serial one");
+	}
+	if (serial->size() != 300 || *parallel != *serial)
+	{
+		throw test_fail_error("heap_table parallel select(where) differs from a serial one");
+	}
+}
+
 void test_heap_table() throw (test_fail_error)
 {
 	ColumnNames column_names;
@@ -539,6 +923,9 @@ void test_heap_table() throw (test_fail_error)
 	test_heap_table_insert(column_names, column_attributes);
 	test_heap_table_select(column_names, column_attributes);
 	test_heap_table_project(column_names, column_attributes);
+	test_heap_table_insert_batch(column_names, column_attributes);
+	test_heap_table_select_conjunction();
+	test_heap_table_parallel_scan();
 }
 
 /**
@@ -669,13 +1056,1791 @@ bool test_btree() {
 	return result;
 }
 
+/**
+ * Test for BTree bulk load: a sparse fill factor gives a three-level tree which
+ * must still find every key after it is closed and reopened, and take inserts.
+ */
+bool test_btree_bulk_load() {
+	cout << "test_btree_bulk_load..." << endl;
+
+	ColumnNames col_names;
+	col_names.push_back("a");
+	col_names.push_back("b");
+
+	ColumnAttributes col_att;
+	col_att.push_back(ColumnAttribute(ColumnAttribute::INT));
+	col_att.push_back(ColumnAttribute(ColumnAttribute::INT));
+
+	HeapTable table("_test_btree_bulk_cpp", col_names, col_att);
+	table.create();
+
+	// insert out of key order so the loader has to sort
+	for (int i = 0; i < 1000; i++) {
+		ValueDict row;
+		row["a"] = (i * 7919) % 1000;
+		row["b"] = i;
+		table.insert(&row);
+	}
+
+	ColumnNames idx_col;
+	idx_col.push_back("a");
+	BTreeIndex idx(table, "bulk_index", idx_col, true);
+	idx.set_fill_percent(10);
+	idx.create();
+	idx.close();
+	idx.open();
+
+	ValueDict extra;
+	extra["a"] = 5000;
+	extra["b"] = 5000;
+	idx.insert(table.insert(&extra));
+
+	bool result = true;
+	ValueDict key;
+	for (int a = 0; a < 1000 && result; a++) {
+		key["a"] = a;
+		std::unique_ptr<Handles> handles(idx.lookup(&key));
+		if (handles->size() != 1) {
+			cout << "bulk loaded key " << a << " not found." << endl;
+			result = false;
+			break;
+		}
+		std::unique_ptr<ValueDict> row(table.project(handles->front()));
+		if (row->at("a").n != a)
+			result = false;
+	}
+	key["a"] = 5000;
+	std::unique_ptr<Handles> handles(idx.lookup(&key));
+	if (handles->size() != 1) {
+		cout << "key inserted after bulk load not found." << endl;
+		result = false;
+	}
+
+	idx.drop();
+	table.drop();
+	return result;
+}
+
+/**
+ * Test for BTree range scans over an index built by individual inserts
+ * (so the leaf chain comes from splits).
+ */
+bool test_btree_range() {
+	cout << "test_btree_range..." << endl;
+
+	ColumnNames col_names;
+	col_names.push_back("a");
+
+	ColumnAttributes col_att;
+	col_att.push_back(ColumnAttribute(ColumnAttribute::INT));
+
+	HeapTable table("_test_btree_range_cpp", col_names, col_att);
+	table.create();
+
+	ColumnNames idx_col;
+	idx_col.push_back("a");
+	BTreeIndex idx(table, "range_index", idx_col, true);
+	idx.create();
+
+	for (int i = 0; i < 1000; i++) {
+		ValueDict row;
+		row["a"] = (i * 7919) % 1000;
+		idx.insert(table.insert(&row));
+	}
+
+	bool result = true;
+	ValueDict min_key, max_key;
+	min_key["a"] = 100;
+	max_key["a"] = 599;
+	std::unique_ptr<Handles> handles(idx.range(&min_key, &max_key));
+	if (handles->size() != 500) {
+		cout << "range returned " << handles->size() << " rows, expected 500." << endl;
+		result = false;
+	}
+	int expected = 100;
+	for (auto const& handle : *handles) {
+		std::unique_ptr<ValueDict> row(table.project(handle));
+		if (row->at("a").n != expected++) {
+			cout << "range rows out of order." << endl;
+			result = false;
+			break;
+		}
+	}
+
+	// open-ended bounds through the streaming interface
+	std::unique_ptr<DbIndexCursor> below(idx.range_cursor(nullptr, &min_key));
+	std::unique_ptr<DbIndexCursor> above(idx.range_cursor(&max_key, nullptr));
+	Handle handle;
+	int count = 0;
+	while (below->next(handle))
+		count++;
+	if (count != 101)
+		result = false;
+	count = 0;
+	while (above->next(handle))
+		count++;
+	if (count != 401)
+		result = false;
+	below.reset();
+	above.reset();
+
+	idx.drop();
+	table.drop();
+	return result;
+}
+
+/**
+ * Test for range predicates, both on a table scan and pushed down to a BTree range scan
+ */
+bool test_predicates() {
+	cout << "test_predicates..." << endl;
+
+	ColumnNames col_names;
+	col_names.push_back("a");
+	col_names.push_back("b");
+
+	ColumnAttributes col_att;
+	col_att.push_back(ColumnAttribute(ColumnAttribute::INT));
+	col_att.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+
+	HeapTable table("_test_predicates_cpp", col_names, col_att);
+	table.create();
+	for (int i = 0; i < 100; i++) {
+		ValueDict row;
+		row["a"] = i;
+		row["b"] = Value(i % 2 == 0 ? "even" : "odd");
+		table.insert(&row);
+	}
+
+	bool result = true;
+	Conjunction where;
+	where.push_back(Predicate("a", Value(10), Value(29)));             // 20 rows
+	where.push_back(Predicate("a", Predicate::NE, Value(15)));         // 19
+	where.push_back(Predicate("b", Predicate::EQ, Value("even")));     // 10
+	std::unique_ptr<Handles> handles(table.select(where));
+	if (handles->size() != 10) {
+		cout << "table select with BETWEEN, <>, = returned " << handles->size() << " rows." << endl;
+		result = false;
+	}
+
+	std::vector<Value> in_list;
+	in_list.push_back(Value(3));
+	in_list.push_back(Value(50));
+	in_list.push_back(Value(500));
+	Conjunction in_where;
+	in_where.push_back(Predicate("a", in_list));
+	in_where.push_back(Predicate("a", Predicate::LT, Value(50)));
+	std::unique_ptr<Handles> in_handles(table.select(in_where));
+	if (in_handles->size() != 1)
+		result = false;
+
+	try {
+		Conjunction bad;
+		bad.push_back(Predicate("a", Predicate::GT, Value("x")));
+		delete table.select(bad);
+		cout << "comparing an INT column to TEXT should fail." << endl;
+		result = false;
+	} catch (DbRelationError &e) {}
+
+	ColumnNames idx_col;
+	idx_col.push_back("a");
+	BTreeIndex idx(table, "predicates_index", idx_col, true);
+	idx.create();
+
+	// a > 90 AND a <= 95 AND b = "odd" -> range [90, 95] with a residual select
+	Conjunction ranged;
+	ranged.push_back(Predicate("a", Predicate::GT, Value(90)));
+	ranged.push_back(Predicate("a", Predicate::LE, Value(95)));
+	ranged.push_back(Predicate("b", Predicate::EQ, Value("odd")));
+	EvalPlan *plan = EvalPlan::index_scan(idx, table, ranged);
+	if (plan == nullptr) {
+		cout << "index_scan should use the index." << endl;
+		result = false;
+	} else {
+		plan = new EvalPlan(EvalPlan::ProjectAll, plan);
+		std::unique_ptr<ValueDicts> rows(plan->evaluate());
+		if (rows->size() != 3 || rows->at(0)->at("a").n != 91 || rows->at(2)->at("a").n != 95)
+			result = false;
+		for (auto row : *rows)
+			delete row;
+		delete plan;
+	}
+
+	// projecting away the column the residual select tests: the rows carry just what was asked for
+	plan = EvalPlan::index_scan(idx, table, ranged);
+	if (plan != nullptr) {
+		ColumnNames *just_a = new ColumnNames();
+		just_a->push_back("a");
+		plan = new EvalPlan(just_a, plan);
+		std::unique_ptr<ValueDicts> rows(plan->evaluate());
+		if (rows->size() != 3 || rows->at(1)->size() != 1 || rows->at(1)->at("a").n != 93) {
+			cout << "projecting a ranged select through the index went wrong" << endl;
+			result = false;
+		}
+		for (auto row : *rows)
+			delete row;
+		delete plan;
+	}
+
+	Conjunction unranged;
+	unranged.push_back(Predicate("b", Predicate::EQ, Value("odd")));
+	if (EvalPlan::index_scan(idx, table, unranged) != nullptr)
+		result = false;
+
+	idx.drop();
+	table.drop();
+	return result;
+}
+
+/**
+ * Test that optimize() answers a Select through a BTree index from the catalog
+ */
+bool test_optimize() {
+	cout << "test_optimize..." << endl;
+
+	initialize_schema_tables();
+	Tables &tables = *new Tables();  // registers itself in the table cache, so it has to outlive the test
+	Columns columns;
+	Indices indices;
+
+	ValueDict catalog_row;
+	catalog_row["table_name"] = Value("_test_optimize");
+	Handle table_handle = tables.insert(&catalog_row);
+	Handles column_handles;
+	catalog_row["column_name"] = Value("a");
+	catalog_row["data_type"] = Value("INT");
+	column_handles.push_back(columns.insert(&catalog_row));
+	catalog_row["column_name"] = Value("b");
+	column_handles.push_back(columns.insert(&catalog_row));
+
+	DbRelation& table = Tables::get_table("_test_optimize");
+	table.create();
+	for (int i = 0; i < 200; i++) {
+		ValueDict row;
+		row["a"] = i;
+		row["b"] = i % 10;
+		table.insert(&row);
+	}
+
+	catalog_row.clear();
+	catalog_row["table_name"] = Value("_test_optimize");
+	catalog_row["index_name"] = Value("optimize_index");
+	catalog_row["seq_in_index"] = Value(1);
+	catalog_row["column_name"] = Value("a");
+	catalog_row["index_type"] = Value("BTREE");
+	catalog_row["is_unique"] = Value(1);
+	Handle index_handle = indices.insert(&catalog_row);
+	DbIndex& index = indices.get_index("_test_optimize", "optimize_index");
+	index.create();
+
+	// this row is not in the index, so only a table scan can see it
+	ValueDict unindexed;
+	unindexed["a"] = 500;
+	unindexed["b"] = 0;
+	table.insert(&unindexed);
+
+	bool result = true;
+	Conjunction *where = new Conjunction();
+	where->push_back(Predicate("a", Predicate::GE, Value(150)));
+	where->push_back(Predicate("b", Predicate::EQ, Value(0)));
+	EvalPlan *plan = new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(where, new EvalPlan(table)));
+
+	EvalPlan *unoptimized = plan->optimize();
+	std::unique_ptr<ValueDicts> scanned(unoptimized->evaluate());
+	EvalPlan *optimized = plan->optimize(&indices);
+	std::unique_ptr<ValueDicts> looked_up(optimized->evaluate());
+	if (scanned->size() != 6 || looked_up->size() != 5) {
+		cout << "optimize() did not use the index: " << scanned->size() << " vs " << looked_up->size() << endl;
+		result = false;
+	}
+	for (auto row : *scanned)
+		delete row;
+	for (auto row : *looked_up)
+		delete row;
+	delete unoptimized;
+	delete optimized;
+	delete plan;
+
+	// equality on the key is a lookup
+	Conjunction *point = new Conjunction();
+	point->push_back(Predicate("a", Predicate::EQ, Value(42)));
+	plan = new EvalPlan(EvalPlan::ProjectAll, new EvalPlan(point, new EvalPlan(table)));
+	optimized = plan->optimize(&indices);
+	std::unique_ptr<ValueDicts> point_rows(optimized->evaluate());
+	if (point_rows->size() != 1 || point_rows->at(0)->at("b").n != 2)
+		result = false;
+	for (auto row : *point_rows)
+		delete row;
+	delete optimized;
+	delete plan;
+
+	index.drop();
+	indices.del(index_handle);
+	table.drop();
+	for (auto const& handle : column_handles)
+		columns.del(handle);
+	tables.del(table_handle);
+	return result;
+}
+
+/**
+ * Test that evaluate() runs Selects over a TableScan a ColumnBatch at a time
+ */
+bool test_column_batch() {
+	cout << "test_column_batch..." << endl;
+
+	ColumnNames col_names;
+	col_names.push_back("a");
+	col_names.push_back("b");
+	col_names.push_back("c");
+	ColumnAttributes col_att;
+	col_att.push_back(ColumnAttribute(ColumnAttribute::INT));
+	col_att.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+	col_att.push_back(ColumnAttribute(ColumnAttribute::BOOLEAN));
+
+	HeapTable table("_test_column_batch_cpp", col_names, col_att);
+	table.create();
+	ValueDicts rows;
+	for (int i = 0; i < 3000; i++) {
+		ValueDict *row = new ValueDict();
+		(*row)["a"] = Value(i);
+		(*row)["b"] = Value("x" + std::to_string(i % 5));
+		(*row)["c"] = Value(i % 2 == 0);
+		rows.push_back(row);
+	}
+	delete table.insert_batch(&rows);
+	for (auto row : rows)
+		delete row;
+
+	bool result = true;
+
+	// the table's own cursor and the generic one should both see every row, three batches' worth
+	ColumnNames read;
+	read.push_back("b");
+	read.push_back("a");
+	std::unique_ptr<ColumnAttributes> read_att(table.get_column_attributes(read));
+	ColumnBatch heap_batch(read, *read_att);
+	ColumnBatch generic_batch(read, *read_att);
+	std::unique_ptr<DbBatchCursor> heap_cursor(table.batch_cursor(read));
+	std::unique_ptr<DbBatchCursor> generic_cursor(table.DbRelation::batch_cursor(read));
+	uint batches = 0, count = 0;
+	while (heap_cursor->next(heap_batch)) {
+		if (!generic_cursor->next(generic_batch) || generic_batch.size() != heap_batch.size() ||
+		    generic_batch.get_handles() != heap_batch.get_handles())
+			result = false;
+		for (uint row = 0; row < heap_batch.size(); row++, count++)
+			if (heap_batch.get(1, row).n != (int) count || heap_batch.get(0, row).s != "x" + std::to_string(count % 5))
+				result = false;
+		batches++;
+	}
+	if (batches != 3 || count != 3000 || generic_cursor->next(generic_batch)) {
+		cout << "batch cursors read " << count << " rows in " << batches << " batches." << endl;
+		result = false;
+	}
+
+	// SELECT b, a FROM t WHERE b IN ("x1", "x3") AND a BETWEEN 500 AND 2499 AND c = true
+	std::vector<Value> in_list;
+	in_list.push_back(Value("x1"));
+	in_list.push_back(Value("x3"));
+	Conjunction *inner = new Conjunction();
+	inner->push_back(Predicate("b", in_list));
+	Conjunction *outer = new Conjunction();
+	outer->push_back(Predicate("a", Value(500), Value(2499)));
+	Value yes(1);
+	yes.data_type = ColumnAttribute::BOOLEAN;
+	outer->push_back(Predicate("c", Predicate::EQ, yes));
+	EvalPlan *plan = new EvalPlan(inner, new EvalPlan(table));
+	plan = new EvalPlan(outer, plan);
+	plan = new EvalPlan(new ColumnNames(read), plan);
+	std::unique_ptr<ValueDicts> selected(plan->evaluate());
+	if (selected->size() != 400 || selected->at(0)->at("a").n != 506 || selected->at(0)->at("b").s != "x1" ||
+	    selected->at(399)->at("a").n != 2498 || selected->at(0)->count("c") != 0) {
+		cout << "batched evaluate returned " << selected->size() << " rows." << endl;
+		result = false;
+	}
+	for (auto row : *selected)
+		delete row;
+	delete plan;
+
+	// filtering on a TEXT column with <
+	Conjunction less;
+	less.push_back(Predicate("b", Predicate::LT, Value("x2")));
+	heap_cursor.reset(table.batch_cursor(read));
+	count = 0;
+	while (heap_cursor->next(heap_batch)) {
+		heap_batch.filter(less);
+		count += heap_batch.size();
+	}
+	if (count != 1200)
+		result = false;
+
+	table.drop();
+	return result;
+}
+
+/**
+ * Test every FilterKernels instruction set against a plain loop
+ */
+bool test_filter_kernels() {
+	cout << "test_filter_kernels..." << endl;
+
+	const uint n = 1000;  // not a multiple of any register width, so the scalar tail runs too
+	std::vector<int32_t> ints(n);
+	std::vector<uint8_t> bytes(n);
+	for (uint i = 0; i < n; i++) {
+		ints[i] = (int32_t)((i * 7919) % 41) - 20;
+		bytes[i] = (uint8_t)((i * 31) % 7 == 0 ? 0 : (i % 3 == 0 ? 1 : 200 + i % 50));
+	}
+
+	Predicate::Op ops[] = {Predicate::EQ, Predicate::NE, Predicate::LT, Predicate::LE, Predicate::GT,
+	                       Predicate::GE, Predicate::BETWEEN, Predicate::IN};
+	std::vector<int32_t> int_operands[] = {{-3}, {0}, {5}, {-20}, {19}, {2}, {-4, 11}, {-20, 3, 7, 19}};
+	std::vector<uint8_t> byte_operands[] = {{1}, {0}, {200}, {1}, {0}, {220}, {1, 230}, {0, 249}};
+
+	bool result = true;
+	FilterKernels::Isa best = FilterKernels::detect_isa();
+	for (int isa = FilterKernels::SCALAR; isa <= best; isa++) {
+		FilterKernels::set_isa((FilterKernels::Isa) isa);
+		for (uint op = 0; op < sizeof(ops) / sizeof(ops[0]); op++) {
+			std::vector<uint8_t> int_keep(n, 1), byte_keep(n, 1);
+			int_keep[3] = byte_keep[3] = 0;  // already dropped rows stay dropped
+			FilterKernels::filter(ops[op], ints.data(), n, int_operands[op], int_keep.data());
+			FilterKernels::filter(ops[op], bytes.data(), n, byte_operands[op], byte_keep.data());
+
+			std::vector<Value> int_values, byte_values;
+			for (auto x : int_operands[op])
+				int_values.push_back(Value(x));
+			for (auto x : byte_operands[op])
+				byte_values.push_back(Value(x));
+			Predicate int_predicate = ops[op] == Predicate::IN ? Predicate("a", int_values) :
+			                          ops[op] == Predicate::BETWEEN ? Predicate("a", int_values[0], int_values[1]) :
+			                          Predicate("a", ops[op], int_values[0]);
+			Predicate byte_predicate = ops[op] == Predicate::IN ? Predicate("a", byte_values) :
+			                           ops[op] == Predicate::BETWEEN ? Predicate("a", byte_values[0], byte_values[1]) :
+			                           Predicate("a", ops[op], byte_values[0]);
+			for (uint i = 0; i < n; i++) {
+				bool int_want = i != 3 && int_predicate.matches(Value(ints[i]));
+				bool byte_want = i != 3 && byte_predicate.matches(Value(bytes[i]));
+				if (int_keep[i] != int_want || byte_keep[i] != byte_want) {
+					cout << "filter kernel " << isa << " op " << op << " wrong at row " << i << endl;
+					result = false;
+					break;
+				}
+			}
+		}
+	}
+	FilterKernels::set_isa(best);
+	return result;
+}
+
+/**
+ * Test TaskScheduler with nested task groups, a failing task, and parallel_sort
+ */
+bool test_task_scheduler() {
+	cout << "test_task_scheduler..." << endl;
+
+	bool result = true;
+	TaskScheduler scheduler(3);
+	std::atomic<int> count(0);
+	{
+		TaskGroup outer(scheduler);
+		for (int i = 0; i < 100; i++)
+			outer.run([&]() {
+				TaskGroup inner(scheduler);
+				for (int j = 0; j < 10; j++)
+					inner.run([&]() { count++; });
+				inner.wait();
+			});
+		outer.wait();
+	}
+	if (count != 1000 || scheduler.get_executed() != 1100) {
+		cout << "task groups ran " << count << " tasks." << endl;
+		result = false;
+	}
+
+	TaskGroup failing(scheduler);
+	for (int i = 0; i < 10; i++)
+		failing.run([i]() {
+			if (i == 7)
+				throw DbRelationError("task 7");
+		});
+	try {
+		failing.wait();
+		cout << "a task's exception should come out of wait()." << endl;
+		result = false;
+	} catch (DbRelationError &e) {}
+
+	// waiting on a task that's out on a worker sleeps rather than spinning
+	TaskGroup slow(scheduler);
+	std::atomic<bool> started(false);
+	slow.run([&]() {
+		started = true;
+		std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	});
+	while (!started)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	timespec before, after;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &before);
+	slow.wait();
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &after);
+	double busy_ms = (after.tv_sec - before.tv_sec) * 1e3 + (after.tv_nsec - before.tv_nsec) / 1e6;
+	if (busy_ms > 50) {
+		cout << "wait() spent " << busy_ms << " ms of CPU waiting on a sleeping task." << endl;
+		result = false;
+	}
+
+	std::vector<int> values;
+	for (int i = 0; i < 100000; i++)
+		values.push_back((i * 7919) % 100003);
+	std::vector<int> sorted(values);
+	std::sort(sorted.begin(), sorted.end());
+	parallel_sort(values.begin(), values.end(), [](int a, int b) { return a < b; }, 1000);
+	if (values != sorted)
+		result = false;
+	return result;
+}
+
+/**
+ * Test SQLServer sessions over its socket
+ */
+bool test_sql_server() {
+	cout << "test_sql_server..." << endl;
+
+	std::string path = "/tmp/_test_sql_server_" + std::to_string(getpid()) + ".sock";
+	SQLServer server(path, 1);
+	server.listen();
+	std::thread serving([&]() { server.serve(); });
+
+	auto connect_to_server = [&]() {
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		sockaddr_un address;
+		memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+		if (connect(fd, (sockaddr*) &address, sizeof(address)) != 0) {
+			close(fd);
+			return -1;
+		}
+		return fd;
+	};
+
+	std::atomic<int> answered(0);
+	auto client = [&](int id) {
+		int fd = connect_to_server();
+		if (fd >= 0) {
+			for (int i = 0; i < 5; i++) {
+				std::string request = "not sql " + std::to_string(id) + " " + std::to_string(i), response;
+				if (SQLServer::write_message(fd, request) && SQLServer::read_message(fd, response) &&
+				    response.find("Invalid SQL: " + request) == 0)
+					answered++;
+			}
+			SQLServer::write_message(fd, "quit");
+			close(fd);
+		}
+	};
+	std::vector<std::thread> clients;
+	for (int id = 0; id < 4; id++)
+		clients.push_back(std::thread(client, id));
+	for (auto& c : clients)
+		c.join();
+
+	// a row too wide for any page is an error for that request only; the session carries on
+	bool survived = false;
+	int fd = connect_to_server();
+	if (fd >= 0) {
+		std::string response;
+		std::string wide(DbBlock::BLOCK_SZ - 6, 'x');
+		survived = SQLServer::write_message(fd, "CREATE TABLE _test_sql_server_wide (a TEXT)") &&
+				   SQLServer::read_message(fd, response) &&
+				   SQLServer::write_message(fd, "INSERT INTO _test_sql_server_wide VALUES ('" + wide + "')") &&
+				   SQLServer::read_message(fd, response) && response.find("Error: ") != std::string::npos &&
+				   SQLServer::write_message(fd, "DROP TABLE _test_sql_server_wide") &&
+				   SQLServer::read_message(fd, response) && response.find("dropped _test_sql_server_wide") != std::string::npos;
+		SQLServer::write_message(fd, "quit");
+		close(fd);
+	}
+
+	// a client idling inside a transaction holds up the others only until its time runs out
+	bool timed_out = false;
+	int idle_fd = connect_to_server();
+	fd = connect_to_server();
+	if (idle_fd >= 0 && fd >= 0) {
+		std::string response;
+		timed_out = SQLServer::write_message(idle_fd, "BEGIN") &&
+					SQLServer::read_message(idle_fd, response) &&
+					SQLServer::write_message(fd, "CREATE TABLE _test_sql_server_idle (a INT)") &&
+					SQLServer::read_message(fd, response) && response.find("created _test_sql_server_idle") != std::string::npos &&
+					SQLServer::write_message(idle_fd, "COMMIT") &&
+					SQLServer::read_message(idle_fd, response) && response.find("transaction rolled back") != std::string::npos &&
+					SQLServer::write_message(fd, "DROP TABLE _test_sql_server_idle") &&
+					SQLServer::read_message(fd, response) && response.find("dropped _test_sql_server_idle") != std::string::npos;
+	}
+	for (int client_fd : {idle_fd, fd}) {
+		if (client_fd >= 0) {
+			SQLServer::write_message(client_fd, "quit");
+			close(client_fd);
+		}
+	}
+
+	server.stop();
+	serving.join();
+	if (answered != 20) {
+		cout << "server answered " << answered << " of 20 requests." << endl;
+		return false;
+	}
+	if (!survived) {
+		cout << "a session did not carry on after a failed request." << endl;
+		return false;
+	}
+	if (!timed_out) {
+		cout << "an idle transaction was not rolled back in time for another session." << endl;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Test that threads can share the table cache and read the same table at once
+ */
+bool test_concurrent_catalog() {
+	cout << "test_concurrent_catalog..." << endl;
+
+	initialize_schema_tables();
+	Tables &tables = *new Tables();  // registers itself in the table cache, so it has to outlive the test
+	Columns columns;
+
+	ValueDict catalog_row;
+	catalog_row["table_name"] = Value("_test_concurrent");
+	Handle table_handle = tables.insert(&catalog_row);
+	catalog_row["column_name"] = Value("a");
+	catalog_row["data_type"] = Value("INT");
+	Handle column_handle = columns.insert(&catalog_row);
+
+	DbRelation& table = Tables::get_table("_test_concurrent");
+	table.create();
+	for (int i = 0; i < 500; i++) {
+		ValueDict row;
+		row["a"] = i;
+		table.insert(&row);
+	}
+	std::unique_ptr<Handles> handles(table.select());
+
+	std::atomic<int> mismatches(0);
+	std::atomic<long> total(0);
+	std::vector<std::thread> readers;
+	for (int t = 0; t < 8; t++)
+		readers.push_back(std::thread([&]() {
+			for (int i = 0; i < 20; i++)
+				if (&Tables::get_table("_test_concurrent") != &table)
+					mismatches++;
+			long sum = 0;
+			for (auto const& handle : *handles) {
+				std::unique_ptr<ValueDict> row(table.project(handle));
+				sum += row->at("a").n;
+			}
+			total += sum;
+		}));
+	for (auto& reader : readers)
+		reader.join();
+
+	table.drop();
+	columns.del(column_handle);
+	tables.del(table_handle);
+	if (mismatches != 0 || total != 8L * (499 * 500 / 2)) {
+		cout << "concurrent readers saw " << mismatches << " different tables and a total of " << total << endl;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Test that rollback undoes a transaction's inserts, commit keeps them, and waiting
+ * commits share one log flush; then BEGIN/COMMIT/ROLLBACK through an SQLSession
+ */
+bool test_transactions() {
+	cout << "test_transactions..." << endl;
+
+	ColumnNames col_names;
+	col_names.push_back("a");
+	ColumnAttributes col_att;
+	col_att.push_back(ColumnAttribute(ColumnAttribute::INT));
+	HeapTable table("_test_transactions", col_names, col_att);
+	table.create();
+	for (int i = 0; i < 10; i++) {
+		ValueDict row;
+		row["a"] = i;
+		table.insert(&row);
+	}
+
+	TransactionManager &manager = TransactionManager::instance();
+	bool result = true;
+	auto count = [&]() {
+		std::unique_ptr<Handles> handles(table.select());
+		return handles->size();
+	};
+
+	// rolled back: more than a block's worth, so some inserts go into blocks appended by the transaction
+	manager.begin();
+	for (int i = 0; i < 2000; i++) {
+		ValueDict row;
+		row["a"] = 100 + i;
+		table.insert(&row);
+	}
+	manager.rollback();
+	if (count() != 10) {
+		cout << "rollback left " << count() << " rows" << endl;
+		result = false;
+	}
+	ValueDict after;
+	after["a"] = 10;
+	table.insert(&after);  // goes where the table really ends, not after the undone blocks
+	if (count() != 11) {
+		cout << "insert after rollback left " << count() << " rows" << endl;
+		result = false;
+	}
+
+	// committed
+	manager.begin();
+	for (int i = 0; i < 5; i++) {
+		ValueDict row;
+		row["a"] = 200 + i;
+		table.insert(&row);
+	}
+	manager.make_durable(manager.commit());
+	if (count() != 16 || manager.in_transaction()) {
+		cout << "commit left " << count() << " rows" << endl;
+		result = false;
+	}
+
+	// group commit: eight commits waiting together are made durable by one flush
+	std::vector<u_long> tickets;
+	for (int i = 0; i < 8; i++) {
+		manager.begin();
+		tickets.push_back(manager.commit());
+	}
+	u_long flushes = manager.get_log_flushes();
+	std::vector<std::thread> committers;
+	for (auto ticket: tickets)
+		committers.push_back(std::thread([&manager, ticket]() { manager.make_durable(ticket); }));
+	for (auto& committer: committers)
+		committer.join();
+	if (manager.get_log_flushes() != flushes + 1) {
+		cout << "eight waiting commits took " << manager.get_log_flushes() - flushes << " log flushes" << endl;
+		result = false;
+	}
+
+	// transaction commands in a session
+	{
+		SQLSession session;
+		std::ostringstream out;
+		session.run("commit", out);
+		if (out.str() != "COMMIT\nError: no transaction in progress\n") {
+			cout << "COMMIT outside a transaction printed: " << out.str();
+			result = false;
+		}
+		session.run("BEGIN TRANSACTION;", out);
+		if (!session.in_transaction() || !manager.in_transaction()) {
+			cout << "BEGIN did not start a transaction" << endl;
+			result = false;
+		}
+		ValueDict row;
+		row["a"] = 300;
+		table.insert(&row);
+		session.run("rollback", out);
+		if (session.in_transaction() || manager.in_transaction() || count() != 16) {
+			cout << "ROLLBACK left " << count() << " rows" << endl;
+			result = false;
+		}
+		session.run("begin; end", out);
+		if (session.in_transaction()) {
+			cout << "BEGIN; END left the transaction open" << endl;
+			result = false;
+		}
+		session.run("BEGIN", out);
+		table.insert(&row);
+	}  // hanging up rolls back
+	if (manager.in_transaction() || count() != 16) {
+		cout << "hanging up left " << count() << " rows" << endl;
+		result = false;
+	}
+	table.drop();
+
+	// nothing after a failed statement goes in without it: the session refuses statements until COMMIT or ROLLBACK
+	{
+		SQLSession session;
+		std::ostringstream out;
+		session.run("CREATE TABLE _test_aborted (a INT); CREATE TABLE _test_aborted_other (a INT)", out);
+		auto rows = [&]() {
+			std::unique_ptr<Handles> handles(Tables::get_table("_test_aborted").select());
+			return handles->size();
+		};
+		session.run("BEGIN; INSERT INTO _test_aborted_other VALUES (1, 2); INSERT INTO _test_aborted VALUES (3); COMMIT", out);
+		if (session.in_transaction() || manager.in_transaction() || rows() != 0 ||
+			out.str().find("statements are ignored until COMMIT or ROLLBACK") == std::string::npos) {
+			cout << "a failed transaction left " << rows() << " rows and printed: " << out.str();
+			result = false;
+		}
+		session.run("BEGIN; INSERT INTO _test_aborted_other VALUES (1, 2)", out);
+		session.run("INSERT INTO _test_aborted VALUES (4)", out);
+		if (!session.is_aborted() || rows() != 0) {
+			cout << "an aborted transaction took a later request's insert" << endl;
+			result = false;
+		}
+		session.run("ROLLBACK; INSERT INTO _test_aborted VALUES (5)", out);
+		if (session.in_transaction() || rows() != 1) {
+			cout << "after ROLLBACK of an aborted transaction, " << rows() << " rows" << endl;
+			result = false;
+		}
+		// an aborted session has let go of the engine, so ending it must leave another session's transaction alone
+		{
+			SQLSession other;
+			std::ostringstream other_out;
+			session.run("BEGIN; INSERT INTO _test_aborted_other VALUES (1, 2)", out);
+			other.run("BEGIN; INSERT INTO _test_aborted VALUES (6)", other_out);
+			session.run("ROLLBACK", out);
+			session.fail();
+			session.hang_up();
+			other.run("COMMIT", other_out);
+			if (session.in_transaction() || other.in_transaction() || manager.in_transaction() || rows() != 2 ||
+				other_out.str().find("transaction committed") == std::string::npos) {
+				cout << "ending an aborted transaction undid another session's: " << rows() << " rows, "
+					<< other_out.str();
+				result = false;
+			}
+		}
+		session.run("DROP TABLE _test_aborted; DROP TABLE _test_aborted_other", out);
+	}
+	return result;
+}
+
+/**
+ * Test tables and indices on pages bigger than 4 KB: rows too wide for 4 KB pages, a
+ * 64 KB slotted page filled to the last byte, a B-tree on 16 KB pages, and the catalog
+ */
+bool test_page_sizes() {
+	cout << "test_page_sizes..." << endl;
+	bool result = true;
+
+	// 64 KB slotted page: offsets right up to 0xFFFF
+	char *page_memory = new char[DbBlock::MAX_BLOCK_SZ];
+	Dbt page_data(page_memory, DbBlock::MAX_BLOCK_SZ);
+	{
+		SlottedPage page(page_data, 1, true);
+		std::string big(30000, 'x');
+		Dbt record((void*) big.c_str(), (u_int32_t) big.size());
+		RecordID first = page.add(&record);
+		RecordID second = page.add(&record);
+		std::unique_ptr<Dbt> got(page.get(first));
+		if (page.get_block_size() != DbBlock::MAX_BLOCK_SZ || second != 2 || got->get_size() != 30000 ||
+			memcmp(got->get_data(), big.c_str(), big.size()) != 0) {
+			cout << "64 KB slotted page lost a record" << endl;
+			result = false;
+		}
+		try {
+			page.add(&record);
+			cout << "64 KB slotted page took a record it has no room for" << endl;
+			result = false;
+		} catch (DbBlockNoRoomError &e) {
+		}
+	}
+	{
+		// the largest record a page can take, and one a byte too big: 65536 bytes must not wrap around to 0
+		SlottedPage page(page_data, 1, true);
+		std::string biggest(SlottedPage::max_record_size(DbBlock::MAX_BLOCK_SZ), 'y');
+		Dbt record((void*) biggest.c_str(), (u_int32_t) biggest.size());
+		std::string whole(DbBlock::MAX_BLOCK_SZ, 'z');
+		Dbt too_big((void*) whole.c_str(), (u_int32_t) whole.size());
+		try {
+			page.add(&too_big);
+			cout << "64 KB slotted page took a 64 KB record" << endl;
+			result = false;
+		} catch (DbBlockNoRoomError &e) {
+		}
+		RecordID id = page.add(&record);
+		std::unique_ptr<Dbt> got(page.get(id));
+		if (got->get_size() != biggest.size() || page.free_space() != 0) {
+			cout << "64 KB slotted page kept " << got->get_size() << " bytes of its largest record" << endl;
+			result = false;
+		}
+		try {
+			page.put(id, too_big);
+			cout << "64 KB slotted page put a 64 KB record" << endl;
+			result = false;
+		} catch (DbBlockNoRoomError &e) {
+		}
+	}
+	delete[] page_memory;
+
+	// rows wider than 4 KB need a bigger page size
+	ColumnNames col_names;
+	col_names.push_back("a");
+	col_names.push_back("b");
+	ColumnAttributes col_att;
+	col_att.push_back(ColumnAttribute(ColumnAttribute::INT));
+	col_att.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+	ValueDict wide;
+	wide["a"] = 0;
+	wide["b"] = Value(std::string(6000, 'w'));
+	{
+		HeapTable small("_test_page_sizes_4k", col_names, col_att);
+		small.create();
+		try {
+			small.insert(&wide);
+			cout << "6000-byte row went into a 4 KB page" << endl;
+			result = false;
+		} catch (DbRelationError &e) {
+		}
+		// fits in the block, but not with the page and record headers
+		ValueDict almost;
+		almost["a"] = 0;
+		almost["b"] = Value(std::string(DbBlock::BLOCK_SZ - 6, 'w'));
+		try {
+			small.insert(&almost);
+			cout << "row as big as a 4 KB page went into it" << endl;
+			result = false;
+		} catch (DbRelationError &e) {
+		}
+		small.drop();
+	}
+	{
+		HeapTable big("_test_page_sizes_16k", col_names, col_att, 16384);
+		big.create();
+		for (int i = 0; i < 100; i++) {
+			wide["a"] = i;
+			big.insert(&wide);
+		}
+		big.close();
+	}
+	{
+		HeapTable big("_test_page_sizes_16k", col_names, col_att, 16384);
+		big.open();
+		std::unique_ptr<Handles> handles(big.select());
+		long sum = 0;
+		for (auto const& handle: *handles) {
+			std::unique_ptr<ValueDict> row(big.project(handle));
+			if (row->at("b").s.size() != 6000)
+				result = false;
+			sum += row->at("a").n;
+		}
+		if (handles->size() != 100 || sum != 99 * 100 / 2 || handles->back().first != 50) {
+			cout << "16 KB table came back with " << handles->size() << " rows in " << handles->back().first << " blocks" << endl;
+			result = false;
+		}
+
+		// index on the same table with 16 KB nodes
+		ColumnNames idx_col;
+		idx_col.push_back("a");
+		BTreeIndex idx(big, "big_index", idx_col, true, 16384);
+		idx.create();
+		ValueDict key;
+		for (int a = 0; a < 100; a++) {
+			key["a"] = a;
+			std::unique_ptr<Handles> found(idx.lookup(&key));
+			if (found->size() != 1) {
+				cout << "key " << a << " not found in 16 KB index" << endl;
+				result = false;
+				break;
+			}
+		}
+		idx.drop();
+		big.drop();
+	}
+
+	// catalog records the page size, and refuses ones we can't use
+	initialize_schema_tables();
+	Tables &tables = *new Tables();  // registers itself in the table cache, so it has to outlive the test
+	ValueDict catalog_row;
+	catalog_row["table_name"] = Value("_test_page_sizes");
+	catalog_row["page_size"] = Value(32768);
+	Handle handle = tables.insert(&catalog_row);
+	if (Tables::get_page_size("_test_page_sizes") != 32768) {
+		cout << "catalog has page size " << Tables::get_page_size("_test_page_sizes") << endl;
+		result = false;
+	}
+	tables.del(handle);
+	catalog_row["page_size"] = Value(5000);
+	try {
+		tables.del(tables.insert(&catalog_row));
+		cout << "catalog took a 5000-byte page size" << endl;
+		result = false;
+	} catch (DbRelationError &e) {
+	}
+
+	// catalog rows written before page sizes were recorded end early: their tables and indices are on the default
+	auto add_old_row = [](DbRelation& catalog, const ColumnNames& old_names, const ColumnAttributes& old_attributes,
+						  const ValueDict& row) {
+		catalog.close();  // so it sees the row when it opens again
+		HeapTable old(catalog.get_table_name(), old_names, old_attributes);
+		old.open();
+		Handle handle = old.insert(&row);
+		old.close();
+		return handle;
+	};
+	ColumnNames old_names;
+	ColumnAttributes old_attributes;
+	old_names.push_back("table_name");
+	old_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+	ValueDict old_row;
+	old_row["table_name"] = Value("_test_page_sizes_old");
+	DbRelation& tables_table = Tables::get_table(Tables::TABLE_NAME);
+	handle = add_old_row(tables_table, old_names, old_attributes, old_row);
+	std::unique_ptr<ValueDict> old_table(tables_table.project(handle));
+	if (Tables::get_page_size("_test_page_sizes_old") != DbBlock::BLOCK_SZ || old_table->at("page_size").n != DbBlock::BLOCK_SZ) {
+		cout << "catalog row without a page size has page size " << Tables::get_page_size("_test_page_sizes_old") << endl;
+		result = false;
+	}
+	tables_table.del(handle);
+
+	Indices indices;
+	old_names.push_back("index_name");
+	old_names.push_back("seq_in_index");
+	old_names.push_back("column_name");
+	old_names.push_back("index_type");
+	old_names.push_back("is_unique");
+	old_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+	old_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+	old_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+	old_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+	old_attributes.push_back(ColumnAttribute(ColumnAttribute::BOOLEAN));
+	old_row["index_name"] = Value("old_index");
+	old_row["seq_in_index"] = Value(1);
+	old_row["column_name"] = Value("a");
+	old_row["index_type"] = Value("BTREE");
+	old_row["is_unique"] = Value(1);
+	handle = add_old_row(indices, old_names, old_attributes, old_row);
+	ColumnNames index_columns;
+	bool is_hash = true, is_unique = false;
+	uint index_page_size = 0;
+	indices.get_columns("_test_page_sizes_old", "old_index", index_columns, is_hash, is_unique, index_page_size);
+	if (index_columns.size() != 1 || is_hash || !is_unique || index_page_size != DbBlock::BLOCK_SZ) {
+		cout << "index catalog row without a page size has page size " << index_page_size << endl;
+		result = false;
+	}
+	indices.del(handle);
+	return result;
+}
+
+/**
+ * Test that inserts go into space freed by deletes, in a queue-like table and in one
+ * whose free-space map has to be rebuilt from its blocks
+ */
+bool test_free_space_map() {
+	cout << "test_free_space_map..." << endl;
+	bool result = true;
+
+	ColumnNames col_names;
+	col_names.push_back("a");
+	col_names.push_back("b");
+	ColumnAttributes col_att;
+	col_att.push_back(ColumnAttribute(ColumnAttribute::INT));
+	col_att.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+	ValueDict row;
+	row["b"] = Value(std::string(100, 'q'));
+
+	// queue: keep adding at the back and taking off the front
+	std::deque<Handle> queue;
+	BlockID most_blocks = 0, first_round_blocks = 0;
+	{
+		HeapTable table("_test_free_space_map", col_names, col_att);
+		table.create();
+		for (int round = 0; round < 20; round++) {
+			for (int i = 0; i < 300; i++) {
+				row["a"] = round * 1000 + i;
+				Handle handle = table.insert(&row);
+				most_blocks = std::max(most_blocks, handle.first);
+				queue.push_back(handle);
+			}
+			if (round == 0)
+				first_round_blocks = most_blocks;
+			while (queue.size() > 300) {
+				table.del(queue.front());
+				queue.pop_front();
+			}
+		}
+		std::unique_ptr<Handles> handles(table.select());
+		if (handles->size() != 300 || most_blocks > 3 * first_round_blocks) {  // 600 rows live at the peak, not 6000
+			cout << "queue of 300 rows spread over " << most_blocks << " blocks (first round took "
+				 << first_round_blocks << ")" << endl;
+			result = false;
+		}
+
+		// batches fill holes too
+		for (int i = 0; i < 100; i++)
+			table.del(queue[i]);
+		ValueDicts rows;
+		for (int i = 0; i < 100; i++)
+			rows.push_back(&row);
+		std::unique_ptr<Handles> batch(table.insert_batch(&rows));
+		for (auto const& handle: *batch)
+			if (handle.first > most_blocks) {
+				cout << "batch insert went to block " << handle.first << " past " << most_blocks << endl;
+				result = false;
+				break;
+			}
+		table.close();
+	}
+
+	// lose the map: opening the table builds it again from the blocks
+	{
+		HeapFile map("_test_free_space_map.fsm");
+		map.open();
+		map.drop();
+	}
+	{
+		HeapTable table("_test_free_space_map", col_names, col_att);
+		table.open();
+		std::unique_ptr<Handles> handles(table.select());
+		for (int i = 0; i < 100; i++)
+			table.del(handles->at(i));
+		for (int i = 0; i < 100; i++) {
+			Handle handle = table.insert(&row);
+			if (handle.first > most_blocks) {
+				cout << "insert after rebuilding the map went to block " << handle.first << " past " << most_blocks << endl;
+				result = false;
+				break;
+			}
+		}
+		table.drop();
+	}
+	return result;
+}
+
+/**
+ * Test that VACUUM shrinks a table with many deleted rows, step by step, without losing a row
+ * or leaving an index pointing where a row used to be
+ */
+bool test_vacuum() {
+	cout << "test_vacuum..." << endl;
+	bool result = true;
+
+	ColumnNames col_names;
+	col_names.push_back("a");
+	col_names.push_back("b");
+	ColumnAttributes col_att;
+	col_att.push_back(ColumnAttribute(ColumnAttribute::INT));
+	col_att.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+	ColumnNames idx_col;
+	idx_col.push_back("a");
+	ValueDict row;
+	row["b"] = Value(std::string(100, 'v'));
+
+	HeapTable table("_test_vacuum", col_names, col_att);
+	table.create();
+	Handles inserted;
+	for (int i = 0; i < 1200; i++) {
+		row["a"] = i;
+		inserted.push_back(table.insert(&row));
+	}
+	BlockID blocks_before = inserted.back().first;
+	for (int i = 0; i < 1200; i++)
+		if (i % 3 != 0 || i >= 900)
+			table.del(inserted[i]);  // 300 rows left, scattered over the first three quarters
+	BTreeIndex idx(table, "_test_vacuum_index", idx_col, true);
+	idx.create();
+
+	VacuumProgress progress;
+	Relocations moved;
+	uint steps = 0;
+	bool done = false;
+	while (!done && steps < 1000) {
+		done = table.vacuum(progress, 4, moved);
+		for (auto const& relocation: moved)
+			idx.relocate(relocation.first, relocation.second);
+		steps++;
+	}
+	std::unique_ptr<Handles> handles(table.select());
+	BlockID blocks_after = 0;
+	long sum = 0;
+	for (auto const& handle: *handles) {
+		blocks_after = std::max(blocks_after, handle.first);
+		std::unique_ptr<ValueDict> got(table.project(handle));
+		sum += got->at("a").n;
+	}
+	if (!done || steps < 2 || handles->size() != 300 || sum != 3 * (299 * 300 / 2) ||
+		blocks_after > blocks_before / 3 || progress.blocks_freed == 0 || progress.rows_moved == 0) {
+		cout << "vacuum took " << steps << " steps from " << blocks_before << " blocks to " << blocks_after
+			 << " with " << handles->size() << " rows (sum " << sum << "), moved " << progress.rows_moved
+			 << ", freed " << progress.blocks_freed << endl;
+		result = false;
+	}
+	ValueDict key;
+	for (int a = 0; a < 900; a += 3) {
+		key["a"] = a;
+		std::unique_ptr<Handles> found(idx.lookup(&key));
+		std::unique_ptr<ValueDict> got(found->size() == 1 ? table.project(found->front()) : nullptr);
+		if (got == nullptr || got->at("a").n != a) {
+			cout << "index lost track of row " << a << endl;
+			result = false;
+			break;
+		}
+	}
+
+	// nothing left to do the second time; the shorter file is what comes back from disk
+	VacuumProgress again;
+	while (!table.vacuum(again, 4, moved))
+		;
+	table.close();
+	table.open();
+	row["a"] = 5000;
+	Handle handle = table.insert(&row);
+	std::unique_ptr<Handles> reopened(table.select());
+	if (again.rows_moved != 0 || again.blocks_freed != 0 || reopened->size() != 301 || handle.first > blocks_after + 1) {
+		cout << "second vacuum moved " << again.rows_moved << ", insert after it went to block " << handle.first << endl;
+		result = false;
+	}
+	idx.drop();
+	table.drop();
+
+	// the SQL front end refuses tables it can't vacuum
+	initialize_schema_tables();
+	SQLSession session;
+	std::ostringstream out;
+	session.run("VACUUM _test_vacuum_no_such_table", out);
+	session.run("VACUUM _tables", out);
+	std::string said = out.str();
+	if (said.find("unknown table") == std::string::npos || said.find("schema table") == std::string::npos) {
+		cout << "VACUUM said: " << said << endl;
+		result = false;
+	}
+	return result;
+}
+
+/**
+ * Test a B-tree with duplicate keys: a few keys with long posting lists (out in overflow
+ * chains) among many with one row each, as bulk loaded, inserted into, moved by VACUUM,
+ * scanned, and reopened
+ */
+bool test_btree_postings() {
+	cout << "test_btree_postings..." << endl;
+	bool result = true;
+
+	ColumnNames col_names;
+	col_names.push_back("status");
+	col_names.push_back("n");
+	ColumnAttributes col_att;
+	col_att.push_back(ColumnAttribute(ColumnAttribute::INT));
+	col_att.push_back(ColumnAttribute(ColumnAttribute::INT));
+	HeapTable table("_test_btree_postings", col_names, col_att);
+	table.create();
+	Handles inserted;
+	ValueDict row;
+	for (int i = 0; i < 6000; i++) {
+		row["status"] = Value(i < 5000 ? i % 3 : i);
+		row["n"] = Value(i);
+		inserted.push_back(table.insert(&row));
+	}
+	for (int i = 0; i < 5000; i += 4)
+		table.del(inserted[i]);
+	ColumnNames idx_col;
+	idx_col.push_back("status");
+
+	// every key's lookup has just the rows with that key, in handle order
+	auto check = [&](BTreeIndex& idx, const char* when) {
+		std::map<int, Handles> expected;
+		std::unique_ptr<Handles> handles(table.select());
+		for (auto const& handle: *handles) {
+			std::unique_ptr<ValueDict> got(table.project(handle, &idx_col));
+			expected[got->at("status").n].push_back(handle);
+		}
+		ValueDict key;
+		for (auto& entry: expected) {
+			std::sort(entry.second.begin(), entry.second.end());
+			key["status"] = Value(entry.first);
+			std::unique_ptr<Handles> found(idx.lookup(&key));
+			if (*found != entry.second) {
+				cout << when << ", lookup of " << entry.first << " found " << found->size() << " rows, not "
+					 << entry.second.size() << endl;
+				return false;
+			}
+		}
+		std::unique_ptr<DbIndexCursor> cursor(idx.range_cursor(nullptr, nullptr));
+		Handle handle;
+		u_long scanned = 0;
+		while (cursor->next(handle))
+			scanned++;
+		if (scanned != handles->size()) {
+			cout << when << ", range scan found " << scanned << " rows, not " << handles->size() << endl;
+			return false;
+		}
+		return true;
+	};
+
+	BTreeIndex unique_idx(table, "_test_btree_postings_unique", idx_col, true);
+	try {
+		unique_idx.create();
+		cout << "unique B-tree took duplicate keys" << endl;
+		result = false;
+		unique_idx.drop();
+	} catch (DbRelationError &e) {
+	}
+
+	BTreeIndex idx(table, "_test_btree_postings_index", idx_col, false);
+	idx.create();
+	if (!check(idx, "after create"))
+		result = false;
+
+	// new rows partly go into the space deleted rows left, partly on the end
+	for (int i = 6000; i < 8000; i++) {
+		row["status"] = Value(i < 7990 ? i % 3 : 10);
+		row["n"] = Value(i);
+		idx.insert(table.insert(&row));
+	}
+	if (!check(idx, "after inserts"))
+		result = false;
+
+	for (int i = 0; i < 2000; i++)
+		if (i % 4 == 2)
+			table.del(inserted[i]);
+	BTreeIndex rebuilt(table, "_test_btree_postings_rebuilt", idx_col, false);
+	rebuilt.create();
+	VacuumProgress progress;
+	Relocations moved;
+	bool done = false;
+	while (!done) {
+		done = table.vacuum(progress, 8, moved);
+		for (auto const& relocation: moved)
+			rebuilt.relocate(relocation.first, relocation.second);
+	}
+	if (progress.rows_moved == 0 || !check(rebuilt, "after vacuum"))
+		result = false;
+	rebuilt.close();
+
+	BTreeIndex reopened(table, "_test_btree_postings_rebuilt", idx_col, false);
+	reopened.open();
+	if (!check(reopened, "reopened"))
+		result = false;
+	reopened.drop();
+	idx.drop();
+	table.drop();
+	return result;
+}
+
+/**
+ * Test deleting from B-trees: a unique one that shrinks from three levels to one as nearly
+ * every row goes (in scattered order) and takes them all back, and one with long posting
+ * lists that leaves its merging to a rebalance every so many deletes
+ */
+bool test_btree_delete() {
+	cout << "test_btree_delete..." << endl;
+	bool result = true;
+
+	ColumnNames col_names;
+	col_names.push_back("name");
+	col_names.push_back("g");
+	ColumnAttributes col_att;
+	col_att.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+	col_att.push_back(ColumnAttribute(ColumnAttribute::INT));
+	HeapTable table("_test_btree_delete", col_names, col_att);
+	table.create();
+	const int N = 5000;
+	auto name = [](int i) {
+		std::string digits = std::to_string(i);
+		return std::string(60 - digits.size(), 'k') + digits;
+	};
+	Handles handles(N);
+	ValueDict row;
+	for (int i = 0; i < N; i++) {
+		row["name"] = Value(name(i));
+		row["g"] = Value(i % 4);
+		handles[i] = table.insert(&row);
+	}
+	ColumnNames name_col;
+	name_col.push_back("name");
+	ColumnNames g_col;
+	g_col.push_back("g");
+	BTreeIndex idx(table, "_test_btree_delete_name", name_col, true);
+	idx.create();
+	BTreeIndex groups(table, "_test_btree_delete_g", g_col, false);
+	groups.create();
+	groups.set_deferred_merge(500);
+	uint height = idx.get_height();
+
+	// every row is found, or not, as it should be, and a range scan finds them all in order
+	std::vector<bool> present(N, true);
+	auto check = [&](const char* when) {
+		ValueDict key;
+		u_long count = 0;
+		for (int i = 0; i < N; i++) {
+			key["name"] = Value(name(i));
+			std::unique_ptr<Handles> found(idx.lookup(&key));
+			if (found->size() != (present[i] ? 1u : 0u) || (present[i] && found->front() != handles[i])) {
+				cout << when << ", lookup of " << i << " found " << found->size() << " rows" << endl;
+				return false;
+			}
+			count += present[i];
+		}
+		std::unique_ptr<DbIndexCursor> cursor(idx.range_cursor(nullptr, nullptr));
+		Handle handle;
+		std::string previous;
+		u_long scanned = 0;
+		while (cursor->next(handle)) {
+			std::unique_ptr<ValueDict> got(table.project(handle, &name_col));
+			if (scanned > 0 && !(previous < got->at("name").s))
+				break;
+			previous = got->at("name").s;
+			scanned++;
+		}
+		if (scanned != count) {
+			cout << when << ", range scan found " << scanned << " of " << count << " rows in order" << endl;
+			return false;
+		}
+		return true;
+	};
+
+	int deleted = 0;
+	for (int j = 0; j < N - 10; j++) {
+		int i = (int) ((j * 7919L) % N);  // 7919 is prime, so this gets to every row once
+		idx.del(handles[i]);
+		groups.del(handles[i]);
+		table.del(handles[i]);
+		present[i] = false;
+		if (++deleted % 1000 == 0 && !check("deleting"))
+			return false;
+	}
+	if (height < 3 || idx.get_height() != 1 || !check("after deletes")) {
+		cout << "height went from " << height << " to " << idx.get_height() << endl;
+		result = false;
+	}
+
+	ValueDict key;
+	for (int g = 0; g < 4; g++) {
+		u_long expected = 0;
+		for (int i = g; i < N; i += 4)
+			expected += present[i];
+		key["g"] = Value(g);
+		std::unique_ptr<Handles> found(groups.lookup(&key));
+		if (found->size() != expected) {
+			cout << "group " << g << " has " << found->size() << " rows, not " << expected << endl;
+			result = false;
+		}
+	}
+
+	// put them all back, in the blocks the deletes freed
+	for (int i = 0; i < N; i++)
+		if (!present[i]) {
+			row["name"] = Value(name(i));
+			row["g"] = Value(i % 4);
+			handles[i] = table.insert(&row);
+			idx.insert(handles[i]);
+			present[i] = true;
+		}
+	if (idx.get_height() < 2 || !check("after putting them back"))
+		result = false;
+	row["name"] = Value("not indexed");
+	Handle unindexed = table.insert(&row);
+	try {
+		idx.del(unindexed);
+		cout << "deleted a row that isn't there" << endl;
+		result = false;
+	} catch (DbRelationError &e) {
+	}
+
+	groups.drop();
+	idx.drop();
+	table.drop();
+	return result;
+}
+
+/**
+ * Test inserting a batch of rows (keys out of order, some repeated) into a B-tree and a hash
+ * index at once, as SQLExec::insert does
+ */
+bool test_index_insert_batch() {
+	cout << "test_index_insert_batch..." << endl;
+	bool result = true;
+
+	ColumnNames col_names;
+	col_names.push_back("k");
+	ColumnAttributes col_att;
+	col_att.push_back(ColumnAttribute(ColumnAttribute::INT));
+	HeapTable table("_test_index_insert_batch", col_names, col_att);
+	table.create();
+	ColumnNames idx_col;
+	idx_col.push_back("k");
+	BTreeIndex btree(table, "_test_index_insert_batch_btree", idx_col, false);
+	btree.create();
+	HashIndex hash(table, "_test_index_insert_batch_hash", idx_col, false);
+	hash.create();
+
+	const int N = 3000;
+	ValueDicts rows;
+	for (int i = 0; i < N; i++) {
+		ValueDict* row = new ValueDict;
+		(*row)["k"] = Value((int) ((i * 7919L) % (N / 2)));  // every key twice, scattered
+		rows.push_back(row);
+	}
+	std::unique_ptr<Handles> handles(table.insert_batch(&rows));
+	for (auto row: rows)
+		delete row;
+	btree.insert_batch(handles.get());
+	hash.insert_batch(handles.get());
+
+	ValueDict key;
+	for (int k = 0; k < N / 2 && result; k++) {
+		key["k"] = Value(k);
+		std::unique_ptr<Handles> from_btree(btree.lookup(&key));
+		std::unique_ptr<Handles> from_hash(hash.lookup(&key));
+		std::sort(from_hash->begin(), from_hash->end());
+		if (from_btree->size() != 2 || *from_btree != *from_hash) {
+			cout << "key " << k << ": B-tree found " << from_btree->size() << " rows, hash index "
+				 << from_hash->size() << endl;
+			result = false;
+		}
+	}
+	if (hash.get_entry_count() != (uint) N || btree.get_height() < 2)
+		result = false;
+
+	hash.drop();
+	btree.drop();
+	table.drop();
+	return result;
+}
+
+/**
+ * Test B-tree searches where interior nodes' key prefixes decide and where they tie: negative
+ * and positive ints, and text that shares long prefixes, is shorter than a prefix, or has
+ * bytes past 127, in sparsely packed (so several levels deep) trees
+ */
+bool test_btree_key_prefixes() {
+	cout << "test_btree_key_prefixes..." << endl;
+	bool result = true;
+
+	ColumnNames col_names;
+	col_names.push_back("t");
+	col_names.push_back("n");
+	ColumnAttributes col_att;
+	col_att.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+	col_att.push_back(ColumnAttribute(ColumnAttribute::INT));
+	HeapTable table("_test_btree_key_prefixes", col_names, col_att);
+	table.create();
+	std::vector<std::pair<std::string, int>> keys;
+	for (int i = 0; i < 2000; i++) {
+		std::string t;
+		switch (i % 4) {
+			case 0: t = "shared-prefix-" + std::to_string(i); break;  // ties on the prefix
+			case 1: t = std::string(i % 9, 'a'); t += (char) ('a' + i % 26); t += std::to_string(i); break;
+			case 2: t = std::string(1, (char) (0x80 + i % 100)) + std::to_string(i); break;
+			default: t = std::to_string(i); break;
+		}
+		keys.push_back(std::make_pair(t, (i % 2 ? -1 : 1) * i * 100003));
+	}
+	for (auto const& key: keys) {
+		ValueDict row;
+		row["t"] = Value(key.first);
+		row["n"] = Value(key.second);
+		table.insert(&row);
+	}
+
+	ColumnNames text_col, composite_cols, int_col;
+	text_col.push_back("t");
+	composite_cols.push_back("n");
+	composite_cols.push_back("t");
+	int_col.push_back("n");
+	BTreeIndex by_text(table, "_test_btree_key_prefixes_t", text_col, true);
+	BTreeIndex by_int(table, "_test_btree_key_prefixes_n", int_col, true);
+	BTreeIndex by_both(table, "_test_btree_key_prefixes_nt", composite_cols, true);
+	by_text.set_fill_percent(5);
+	by_int.set_fill_percent(5);
+	by_text.create();
+	by_int.create();
+	by_both.create();
+	if (by_text.get_height() < 3 || by_int.get_height() < 3) {
+		cout << "trees are only " << by_text.get_height() << " and " << by_int.get_height() << " deep" << endl;
+		result = false;
+	}
+
+	for (auto const& key: keys) {
+		ValueDict dict;
+		dict["t"] = Value(key.first);
+		dict["n"] = Value(key.second);
+		std::unique_ptr<Handles> t_found(by_text.lookup(&dict));
+		std::unique_ptr<Handles> n_found(by_int.lookup(&dict));
+		std::unique_ptr<Handles> both_found(by_both.lookup(&dict));
+		if (t_found->size() != 1 || n_found->size() != 1 || both_found->size() != 1 ||
+			t_found->front() != n_found->front() || t_found->front() != both_found->front()) {
+			cout << "lookups of (" << key.first << ", " << key.second << ") disagree" << endl;
+			result = false;
+			break;
+		}
+		dict["t"] = Value(key.first + std::string(1, '\0'));  // just past the key, with the same prefix
+		std::unique_ptr<Handles> missing(by_text.lookup(&dict));
+		if (!missing->empty()) {
+			cout << "found a key that isn't there" << endl;
+			result = false;
+			break;
+		}
+	}
+
+	// a range that starts and ends on negative ints comes back in order
+	ValueDict low, high;
+	low["n"] = Value(-150000000);
+	high["n"] = Value(-1000);
+	std::unique_ptr<Handles> in_range(by_int.range(&low, &high));
+	int previous = INT32_MIN;
+	u_long expected = 0;
+	for (auto const& key: keys)
+		expected += key.second >= -150000000 && key.second <= -1000;
+	for (auto const& handle: *in_range) {
+		std::unique_ptr<ValueDict> row(table.project(handle, &int_col));
+		if (row->at("n").n < previous) {
+			expected = 0;  // out of order
+			break;
+		}
+		previous = row->at("n").n;
+	}
+	if (in_range->size() != expected) {
+		cout << "range of negative ints found " << in_range->size() << " rows in order, not " << expected << endl;
+		result = false;
+	}
+
+	by_both.drop();
+	by_int.drop();
+	by_text.drop();
+	table.drop();
+	return result;
+}
+
+/**
+ * Test the linear hashing index: lookups of every key as it grows bucket by bucket,
+ * duplicate keys, deletes, rows that VACUUM moves, and reopening it
+ */
+bool test_hash_index() {
+	cout << "test_hash_index..." << endl;
+	bool result = true;
+
+	ColumnNames col_names;
+	col_names.push_back("name");
+	col_names.push_back("n");
+	ColumnAttributes col_att;
+	col_att.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+	col_att.push_back(ColumnAttribute(ColumnAttribute::INT));
+	HeapTable table("_test_hash_index", col_names, col_att);
+	table.create();
+	Handles inserted;
+	for (int i = 0; i < 3000; i++) {
+		ValueDict row;
+		row["name"] = Value("customer-" + std::to_string(i % 2500));  // the first 500 names twice
+		row["n"] = Value(i);
+		inserted.push_back(table.insert(&row));
+	}
+	ColumnNames idx_col;
+	idx_col.push_back("name");
+
+	auto found = [&](HashIndex& idx, int i) {
+		ValueDict key;
+		key["name"] = Value("customer-" + std::to_string(i));
+		std::unique_ptr<Handles> handles(idx.lookup(&key));
+		return handles->size();
+	};
+
+	{
+		HashIndex unique_idx(table, "_test_hash_unique", idx_col, true);
+		try {
+			unique_idx.create();
+			cout << "unique hash index took duplicate keys" << endl;
+			result = false;
+			unique_idx.drop();
+		} catch (DbRelationError &e) {
+		}
+	}
+
+	HashIndex idx(table, "_test_hash_index", idx_col, false);
+	idx.create();
+	for (int i = 0; i < 2500; i++)
+		if (found(idx, i) != (i < 500 ? 2u : 1u)) {
+			cout << "hash index found " << found(idx, i) << " rows for customer-" << i << endl;
+			result = false;
+			break;
+		}
+	if (idx.get_bucket_count() <= HashIndex::INITIAL_BUCKETS || idx.get_entry_count() != 3000 || found(idx, 9999) != 0) {
+		cout << "hash index has " << idx.get_bucket_count() << " buckets for " << idx.get_entry_count() << " entries" << endl;
+		result = false;
+	}
+
+	// more rows after the index exists, then delete most of the first ones
+	uint buckets_before = idx.get_bucket_count();
+	for (int i = 3000; i < 6000; i++) {
+		ValueDict row;
+		row["name"] = Value("customer-" + std::to_string(i));
+		row["n"] = Value(i);
+		Handle handle = table.insert(&row);
+		idx.insert(handle);
+	}
+	for (int i = 0; i < 2500; i++) {
+		idx.del(inserted[i]);
+		table.del(inserted[i]);
+	}
+	if (idx.get_bucket_count() <= buckets_before || found(idx, 100) != 1 || found(idx, 2000) != 0 ||
+		found(idx, 2600) != 0 || found(idx, 5999) != 1 || idx.get_entry_count() != 3500) {
+		cout << "after inserts and deletes, hash index has " << idx.get_entry_count() << " entries" << endl;
+		result = false;
+	}
+
+	// rows moved by VACUUM are found where they went
+	VacuumProgress progress;
+	Relocations moved;
+	bool done = false;
+	while (!done) {
+		done = table.vacuum(progress, 16, moved);
+		for (auto const& relocation: moved)
+			idx.relocate(relocation.first, relocation.second);
+	}
+	idx.close();
+
+	HashIndex reopened(table, "_test_hash_index", idx_col, false);
+	reopened.open();
+	for (int i = 2500; i < 6000; i += 7) {
+		ValueDict key;
+		key["name"] = Value("customer-" + std::to_string(i < 3000 ? i % 2500 : i));
+		std::unique_ptr<Handles> handles(reopened.lookup(&key));
+		std::unique_ptr<ValueDict> row(handles->size() == 1 ? table.project(handles->front()) : nullptr);
+		if (row == nullptr || row->at("n").n != i) {
+			cout << "reopened hash index lost row " << i << " (vacuum moved " << progress.rows_moved << ")" << endl;
+			result = false;
+			break;
+		}
+	}
+	reopened.drop();
+	table.drop();
+
+	// inserting and deleting one key over and over leaves its bucket no fuller than it was
+	HeapTable churned("_test_hash_churn", col_names, col_att);
+	churned.create();
+	HashIndex churn_idx(churned, "_test_hash_churn", idx_col, false);
+	churn_idx.create();
+	ValueDict churn;
+	churn["name"] = Value("customer-churn");
+	churn["n"] = Value(-1);
+	uint overflow_pages = 0;
+	for (int i = 0; i < 3000; i++) {
+		Handle handle = churned.insert(&churn);
+		churn_idx.insert(handle);
+		overflow_pages = std::max(overflow_pages, churn_idx.get_overflow_pages());
+		churn_idx.del(handle);
+		churned.del(handle);
+	}
+	if (overflow_pages != 0 || churn_idx.get_entry_count() != 0) {
+		cout << "churn on one key chained " << overflow_pages << " overflow pages" << endl;
+		result = false;
+	}
+	churn_idx.drop();
+	churned.drop();
+	return result;
+}
 
 bool unit_test()
 {
 	test_slotted_page();
 	test_heap_file();
 	test_heap_table();
-	if(!test_btree()){
+	if(!test_btree() || !test_btree_bulk_load() || !test_btree_range() || !test_predicates() ||
+	   !test_optimize() || !test_column_batch() ||
+	   !test_filter_kernels() || !test_task_scheduler() ||
+	   !test_sql_server() || !test_concurrent_catalog() || !test_transactions() ||
+	   !test_page_sizes() || !test_free_space_map() || !test_vacuum() ||
+	   !test_hash_index() || !test_btree_postings() ||
+	   !test_btree_delete() || !test_index_insert_batch() ||
+	   !test_btree_key_prefixes()){
 		return false;
 	} else {
 		return true;